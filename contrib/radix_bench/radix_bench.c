@@ -0,0 +1,288 @@
+
+/*
+ * Lookup benchmark of radix trees compiled by ngx_radix_tree_compile().
+ *
+ * Random IPv4 and IPv6 prefixes, similar to a full routing table, are
+ * inserted into trees which are looked up with random addresses before
+ * and after compilation.  The results of compiled trees are verified
+ * against bitwise copies of the trees.
+ *
+ * See contrib/README for how to build and run it.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_BENCH_PREFIXES4  900000
+#define NGX_BENCH_PREFIXES6  200000
+#define NGX_BENCH_LOOKUPS4   10000000
+#define NGX_BENCH_LOOKUPS6   (NGX_BENCH_LOOKUPS4 / 4)
+
+
+static uint64_t ngx_bench_random(void);
+static double ngx_bench_time(void);
+static double ngx_bench_find32(ngx_radix_tree_t *tree, uint32_t *keys,
+    uintptr_t *sum);
+#if (NGX_HAVE_INET6)
+static void ngx_bench_prefix6(u_char *key, u_char *mask, ngx_uint_t len);
+static double ngx_bench_find128(ngx_radix_tree_t *tree, u_char *keys,
+    uintptr_t *sum);
+#endif
+
+
+static uint64_t  ngx_bench_state = 88172645463325252ULL;
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    double             t;
+    uint32_t          *keys4, key, mask;
+    uintptr_t          sum;
+    ngx_uint_t         i, len;
+    ngx_log_t          log;
+    ngx_pool_t        *pool;
+    ngx_radix_tree_t  *t4, s4;
+#if (NGX_HAVE_INET6)
+    u_char            *keys6, k6[16], m6[16];
+    ngx_radix_tree_t  *t6, s6;
+#endif
+
+    ngx_pagesize = getpagesize();
+
+    ngx_memzero(&log, sizeof(ngx_log_t));
+
+    pool = ngx_create_pool(16384, &log);
+    if (pool == NULL) {
+        return 1;
+    }
+
+    t4 = ngx_radix_tree_create(pool, -1);
+    keys4 = malloc(NGX_BENCH_LOOKUPS4 * sizeof(uint32_t));
+
+    if (t4 == NULL || keys4 == NULL) {
+        return 1;
+    }
+
+    /* most of the prefixes of a full table are /24 and /48 */
+
+    for (i = 0; i < NGX_BENCH_PREFIXES4; i++) {
+        len = (ngx_bench_random() % 100 < 60)
+              ? 24 : 8 + ngx_bench_random() % 17;
+
+        mask = (uint32_t) (0xffffffffULL << (32 - len));
+
+        if (ngx_radix32tree_insert(t4, (uint32_t) ngx_bench_random() & mask,
+                                   mask, 1 + ngx_bench_random() % 1000)
+            == NGX_ERROR)
+        {
+            return 1;
+        }
+    }
+
+    for (i = 0; i < NGX_BENCH_LOOKUPS4; i++) {
+        keys4[i] = (uint32_t) ngx_bench_random();
+    }
+
+    s4 = *t4;
+
+#if (NGX_HAVE_INET6)
+
+    t6 = ngx_radix_tree_create(pool, -1);
+    keys6 = malloc(NGX_BENCH_LOOKUPS6 * 16);
+
+    if (t6 == NULL || keys6 == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < NGX_BENCH_PREFIXES6; i++) {
+        len = (ngx_bench_random() % 100 < 50)
+              ? 48 : 16 + ngx_bench_random() % 49;
+
+        ngx_bench_prefix6(k6, m6, len);
+
+        if (ngx_radix128tree_insert(t6, k6, m6, 1 + ngx_bench_random() % 1000)
+            == NGX_ERROR)
+        {
+            return 1;
+        }
+    }
+
+    /* half of the IPv6 addresses share their /48 with many others */
+
+    for (i = 0; i < NGX_BENCH_LOOKUPS6; i++) {
+        ngx_bench_prefix6(&keys6[i * 16], m6, (i & 1) ? 48 : 128);
+    }
+
+    s6 = *t6;
+
+#endif
+
+    /* the copies are not compiled and are looked up bitwise */
+
+    printf("ipv4 bitwise: %.1f ns/lookup", ngx_bench_find32(t4, keys4, &sum));
+    printf(" (%lu)\n", (unsigned long) sum);
+
+    t = ngx_bench_time();
+
+    if (ngx_radix_tree_compile(t4) != NGX_OK) {
+        return 1;
+    }
+
+    printf("ipv4 compile: %.3f s\n", ngx_bench_time() - t);
+
+    printf("ipv4 trie: %.1f ns/lookup", ngx_bench_find32(t4, keys4, &sum));
+    printf(" (%lu)\n", (unsigned long) sum);
+
+#if (NGX_HAVE_INET6)
+
+    printf("ipv6 bitwise: %.1f ns/lookup", ngx_bench_find128(t6, keys6, &sum));
+    printf(" (%lu)\n", (unsigned long) sum);
+
+    t = ngx_bench_time();
+
+    if (ngx_radix_tree_compile(t6) != NGX_OK) {
+        return 1;
+    }
+
+    printf("ipv6 compile: %.3f s\n", ngx_bench_time() - t);
+
+    printf("ipv6 trie: %.1f ns/lookup", ngx_bench_find128(t6, keys6, &sum));
+    printf(" (%lu)\n", (unsigned long) sum);
+
+    for (i = 0; i < NGX_BENCH_LOOKUPS6; i++) {
+        if (ngx_radix128tree_find(t6, &keys6[i * 16])
+            != ngx_radix128tree_find(&s6, &keys6[i * 16]))
+        {
+            printf("ipv6 mismatch: %lu\n", (unsigned long) i);
+            return 1;
+        }
+    }
+
+#endif
+
+    for (i = 0; i < NGX_BENCH_LOOKUPS4; i++) {
+        if (ngx_radix32tree_find(t4, keys4[i])
+            != ngx_radix32tree_find(&s4, keys4[i]))
+        {
+            printf("ipv4 mismatch: %lu\n", (unsigned long) i);
+            return 1;
+        }
+    }
+
+    for (key = 0; key < 0xffffff00; key += 97) {
+        if (ngx_radix32tree_find(t4, key) != ngx_radix32tree_find(&s4, key)) {
+            printf("ipv4 mismatch: %08x\n", (unsigned int) key);
+            return 1;
+        }
+    }
+
+    printf("verified\n");
+
+    return 0;
+}
+
+
+/* xorshift64 */
+
+static uint64_t
+ngx_bench_random(void)
+{
+    ngx_bench_state ^= ngx_bench_state << 13;
+    ngx_bench_state ^= ngx_bench_state >> 7;
+    ngx_bench_state ^= ngx_bench_state << 17;
+
+    return ngx_bench_state;
+}
+
+
+static double
+ngx_bench_time(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static double
+ngx_bench_find32(ngx_radix_tree_t *tree, uint32_t *keys, uintptr_t *sum)
+{
+    double      t;
+    ngx_uint_t  i;
+
+    *sum = 0;
+    t = ngx_bench_time();
+
+    for (i = 0; i < NGX_BENCH_LOOKUPS4; i++) {
+        *sum += ngx_radix32tree_find(tree, keys[i]);
+    }
+
+    return (ngx_bench_time() - t) * 1e9 / NGX_BENCH_LOOKUPS4;
+}
+
+
+#if (NGX_HAVE_INET6)
+
+/* a random global unicast prefix 2000::/3 of the given length */
+
+static void
+ngx_bench_prefix6(u_char *key, u_char *mask, ngx_uint_t len)
+{
+    ngx_uint_t  i;
+
+    ngx_memzero(mask, 16);
+
+    for (i = 0; i < len; i++) {
+        mask[i >> 3] |= 0x80 >> (i & 7);
+    }
+
+    for (i = 0; i < 16; i++) {
+        key[i] = (u_char) ngx_bench_random() & mask[i];
+    }
+
+    key[0] = (key[0] & 0x1f) | 0x20;
+}
+
+
+static double
+ngx_bench_find128(ngx_radix_tree_t *tree, u_char *keys, uintptr_t *sum)
+{
+    double      t;
+    ngx_uint_t  i;
+
+    *sum = 0;
+    t = ngx_bench_time();
+
+    for (i = 0; i < NGX_BENCH_LOOKUPS6; i++) {
+        *sum += ngx_radix128tree_find(tree, &keys[i * 16]);
+    }
+
+    return (ngx_bench_time() - t) * 1e9 / NGX_BENCH_LOOKUPS6;
+}
+
+#endif
+
+
+/* the benchmark is linked with few objects, does not log and has no threads */
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+#if (NGX_THREADS)
+
+void
+ngx_spinlock(ngx_atomic_t *lock, ngx_atomic_int_t value, ngx_uint_t spin)
+{
+    *lock = value;
+}
+
+#endif
@@ -9,6 +9,15 @@
 #include <ngx_core.h>
 
 
+static ngx_uint_t ngx_buf_cache_class(size_t size);
+static void ngx_buf_cache_cleanup(void *data);
+
+
+ngx_buf_cache_stat_t  ngx_buf_cache_stat;
+
+static void  *ngx_buf_cache[NGX_BUF_CACHE_CLASSES];
+
+
 ngx_buf_t *
 ngx_create_temp_buf(ngx_pool_t *pool, size_t size)
 {
@@ -44,6 +53,134 @@ ngx_create_temp_buf(ngx_pool_t *pool, size_t size)
 }
 
 
+ngx_buf_t *
+ngx_create_cached_buf(ngx_pool_t *pool, size_t size)
+{
+    ngx_buf_t  *b;
+
+    b = ngx_calloc_buf(pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    if (ngx_buf_cache_alloc(pool, b, size) != NGX_OK) {
+        return NULL;
+    }
+
+    return b;
+}
+
+
+ngx_int_t
+ngx_buf_cache_alloc(ngx_pool_t *pool, ngx_buf_t *b, size_t size)
+{
+    u_char              *p;
+    ngx_uint_t           n;
+    ngx_pool_cleanup_t  *cln;
+
+    if (!b->cached) {
+
+        /* the memory still held at the pool destruction is returned there */
+
+        cln = ngx_pool_cleanup_add(pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_buf_cache_cleanup;
+        cln->data = b;
+
+        b->cached = 1;
+    }
+
+    n = ngx_buf_cache_class(size);
+
+    if (n < NGX_BUF_CACHE_CLASSES && ngx_buf_cache[n]) {
+        p = ngx_buf_cache[n];
+        ngx_buf_cache[n] = *(void **) p;
+
+        ngx_buf_cache_stat.hits++;
+        ngx_buf_cache_stat.size -= NGX_BUF_CACHE_MIN_SIZE << n;
+
+    } else {
+        p = ngx_alloc(n < NGX_BUF_CACHE_CLASSES
+                      ? (size_t) NGX_BUF_CACHE_MIN_SIZE << n : size,
+                      pool->log);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_buf_cache_stat.misses++;
+    }
+
+    ngx_buf_cache_stat.busy++;
+
+    b->start = p;
+    b->pos = p;
+    b->last = p;
+    b->end = p + size;
+    b->temporary = 1;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_buf_cache_free(ngx_buf_t *b)
+{
+    size_t      size;
+    ngx_uint_t  n;
+
+    n = ngx_buf_cache_class(b->end - b->start);
+    size = (size_t) NGX_BUF_CACHE_MIN_SIZE << n;
+
+    if (n < NGX_BUF_CACHE_CLASSES
+        && ngx_buf_cache_stat.size + size <= NGX_BUF_CACHE_MAX_SIZE)
+    {
+        *(void **) b->start = ngx_buf_cache[n];
+        ngx_buf_cache[n] = b->start;
+
+        ngx_buf_cache_stat.size += size;
+
+    } else {
+        ngx_free(b->start);
+    }
+
+    ngx_buf_cache_stat.busy--;
+
+    b->start = NULL;
+    b->pos = NULL;
+    b->last = NULL;
+    b->end = NULL;
+}
+
+
+static ngx_uint_t
+ngx_buf_cache_class(size_t size)
+{
+    ngx_uint_t  n;
+
+    for (n = 0; n < NGX_BUF_CACHE_CLASSES; n++) {
+        if (size <= (size_t) NGX_BUF_CACHE_MIN_SIZE << n) {
+            break;
+        }
+    }
+
+    return n;
+}
+
+
+static void
+ngx_buf_cache_cleanup(void *data)
+{
+    ngx_buf_t  *b = data;
+
+    if (b->start) {
+        ngx_buf_cache_free(b);
+    }
+}
+
+
 ngx_chain_t *
 ngx_alloc_chain_link(ngx_pool_t *pool)
 {
@@ -217,6 +354,22 @@ ngx_chain_update_chains(ngx_pool_t *p, ngx_chain_t **free, ngx_chain_t **busy,
         cl->next = *free;
         *free = cl;
     }
+
+    if (*busy) {
+        return;
+    }
+
+    /*
+     * nothing is in flight, so the memory of cached buffers goes back
+     * to the per process cache instead of staying with the free list
+     * of an idle stream
+     */
+
+    for (cl = *free; cl; cl = cl->next) {
+        if (cl->buf->cached && cl->buf->start) {
+            ngx_buf_cache_free(cl->buf);
+        }
+    }
 }
 
 
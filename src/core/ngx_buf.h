@@ -59,6 +59,8 @@ struct ngx_buf_s {
     unsigned         last_shadow:1;
     /// 表示当前缓冲区是否属于临时文件
     unsigned         temp_file:1;
+    /// the buf's memory is taken from the per process buffer cache
+    unsigned         cached:1;
 
     /// STUB int   num;
 };
@@ -83,6 +85,23 @@ typedef struct {
 } ngx_bufs_t;
 
 
+/*
+ * memory of cached buffers is kept on per process free lists by size
+ * class, from NGX_BUF_CACHE_MIN_SIZE up to NGX_BUF_CACHE_CLASSES doublings
+ */
+#define NGX_BUF_CACHE_CLASSES   7
+#define NGX_BUF_CACHE_MIN_SIZE  1024
+#define NGX_BUF_CACHE_MAX_SIZE  (4 * 1024 * 1024)
+
+
+typedef struct {
+    ngx_uint_t   hits;
+    ngx_uint_t   misses;
+    ngx_uint_t   busy;      /* buffers holding cached memory */
+    size_t       size;      /* memory kept on the free lists */
+} ngx_buf_cache_stat_t;
+
+
 typedef struct ngx_output_chain_ctx_s  ngx_output_chain_ctx_t;
 
 typedef ngx_int_t (*ngx_output_chain_filter_pt)(void *ctx, ngx_chain_t *in);
@@ -168,6 +187,9 @@ typedef struct {
 
 ngx_buf_t *ngx_create_temp_buf(ngx_pool_t *pool, size_t size);
 ngx_chain_t *ngx_create_chain_of_bufs(ngx_pool_t *pool, ngx_bufs_t *bufs);
+ngx_buf_t *ngx_create_cached_buf(ngx_pool_t *pool, size_t size);
+ngx_int_t ngx_buf_cache_alloc(ngx_pool_t *pool, ngx_buf_t *b, size_t size);
+void ngx_buf_cache_free(ngx_buf_t *b);
 
 
 #define ngx_alloc_buf(pool)  ngx_palloc(pool, sizeof(ngx_buf_t))
@@ -193,4 +215,7 @@ off_t ngx_chain_coalesce_file(ngx_chain_t **in, off_t limit);
 
 ngx_chain_t *ngx_chain_update_sent(ngx_chain_t *in, off_t sent);
 
+
+extern ngx_buf_cache_stat_t  ngx_buf_cache_stat;
+
 #endif /* _NGX_BUF_H_INCLUDED_ */
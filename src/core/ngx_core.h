@@ -27,6 +27,7 @@ typedef struct ngx_connection_s  ngx_connection_t;
 
 #if (NGX_THREADS)
 typedef struct ngx_thread_task_s  ngx_thread_task_t;
+typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
 #endif
 
 typedef void (*ngx_event_handler_pt)(ngx_event_t *ev);
@@ -38,13 +38,14 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 {
     void                *rv;
     char               **senv, **env;
+    ngx_int_t            rc;
     ngx_uint_t           i, n;
     ngx_log_t           *log;
     ngx_time_t          *tp;
     ngx_conf_t           conf;
     ngx_pool_t          *pool;
     ngx_cycle_t         *cycle, **old;
-    ngx_shm_zone_t      *shm_zone, *oshm_zone;
+    ngx_shm_zone_t      *shm_zone, *oshm_zone, *ozone;
     ngx_list_part_t     *part, *opart;
     ngx_open_file_t     *file;
     ngx_listening_t     *ls, *nls;
@@ -436,6 +437,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 
         shm_zone[i].shm.log = cycle->log;
 
+        ozone = NULL;
+
         opart = &old_cycle->shared_memory.part;
         oshm_zone = opart->elts;
 
@@ -480,6 +483,16 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                 goto shm_zone_found;
             }
 
+            /* a resized zone keeps the old one until its data is copied */
+
+            if (shm_zone[i].tag == oshm_zone[n].tag
+                && shm_zone[i].resize
+                && !shm_zone[i].noreuse)
+            {
+                ozone = &oshm_zone[n];
+                break;
+            }
+
             ngx_shm_free(&oshm_zone[n].shm);
 
             break;
@@ -497,6 +510,21 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
             goto failed;
         }
 
+        if (ozone) {
+            rc = shm_zone[i].resize(&shm_zone[i], ozone);
+
+            ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                          "shared memory zone \"%V\" resized from %uz to %uz",
+                          &shm_zone[i].shm.name, ozone->shm.size,
+                          shm_zone[i].shm.size);
+
+            ngx_shm_free(&ozone->shm);
+
+            if (rc != NGX_OK) {
+                goto failed;
+            }
+        }
+
     shm_zone_found:
 
         continue;
@@ -1295,6 +1323,7 @@ ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name, size_t size, void *tag)
     shm_zone->shm.name = *name;
     shm_zone->shm.exists = 0;
     shm_zone->init = NULL;
+    shm_zone->resize = NULL;
     shm_zone->tag = tag;
     shm_zone->noreuse = 0;
 
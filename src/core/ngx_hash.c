@@ -462,6 +462,112 @@ found:
 }
 
 
+/*
+ * builds a hash with at most one element in a bucket, so ngx_hash_find()
+ * compares a name once at most; NGX_DECLINED is returned if no such size
+ * up to hinit->max_size exists, and the caller should use ngx_hash_init()
+ */
+
+ngx_int_t
+ngx_hash_init_perfect(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
+    ngx_uint_t nelts)
+{
+    u_char          *elts, *test;
+    size_t           len;
+    ngx_uint_t       n, key, size;
+    ngx_hash_elt_t  *elt, **buckets;
+
+    test = ngx_alloc(hinit->max_size, hinit->pool->log);
+    if (test == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (size = nelts ? nelts : 1; size <= hinit->max_size; size++) {
+
+        ngx_memzero(test, size);
+
+        for (n = 0; n < nelts; n++) {
+            if (names[n].key.data == NULL) {
+                continue;
+            }
+
+            key = names[n].key_hash % size;
+
+            if (test[key]) {
+                goto next;
+            }
+
+            test[key] = 1;
+        }
+
+        goto found;
+
+    next:
+
+        continue;
+    }
+
+    ngx_free(test);
+
+    return NGX_DECLINED;
+
+found:
+
+    ngx_free(test);
+
+    buckets = ngx_pcalloc(hinit->pool, size * sizeof(ngx_hash_elt_t *));
+    if (buckets == NULL) {
+        return NGX_ERROR;
+    }
+
+    len = 0;
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        len += NGX_HASH_ELT_SIZE(&names[n]) + sizeof(void *);
+    }
+
+    elts = ngx_palloc(hinit->pool, len + ngx_cacheline_size);
+    if (elts == NULL) {
+        return NGX_ERROR;
+    }
+
+    elts = ngx_align_ptr(elts, ngx_cacheline_size);
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        key = names[n].key_hash % size;
+
+        elt = (ngx_hash_elt_t *) elts;
+
+        elt->value = names[n].value;
+        elt->len = (u_short) names[n].key.len;
+
+        ngx_strlow(elt->name, names[n].key.data, names[n].key.len);
+
+        buckets[key] = elt;
+        elts += NGX_HASH_ELT_SIZE(&names[n]);
+
+        /* the end of the bucket */
+
+        elt = (ngx_hash_elt_t *) elts;
+        elt->value = NULL;
+        elts += sizeof(void *);
+    }
+
+    hinit->hash->buckets = buckets;
+    hinit->hash->size = size;
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts)
@@ -105,6 +105,8 @@ void *ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key,
 
 ngx_int_t ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts);
+ngx_int_t ngx_hash_init_perfect(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
+    ngx_uint_t nelts);
 ngx_int_t ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts);
 
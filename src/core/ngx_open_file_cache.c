@@ -9,17 +9,99 @@
 #include <ngx_core.h>
 #include <ngx_event.h>
 
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
 
 /*
  * open file cache caches
  *    open file handles with stat() info;
  *    directories stat() info;
  *    files and directories errors: not found, access denied, etc.
+ *
+ * with the "shared" parameter stat() info and errors are also kept
+ * in a shared memory zone, so a file is stat()ed once for all workers;
+ * the info stays valid until inotify reports a change of the file,
+ * but not longer than open_file_cache_valid time.
+ * Only the open file handles are per worker.
  */
 
 
 #define NGX_MIN_READ_AHEAD  (128 * 1024)
 
+#if (NGX_HAVE_INOTIFY)
+#define NGX_OPEN_FILE_INOTIFY_MASK                                            \
+    (IN_MODIFY|IN_ATTRIB|IN_CLOSE_WRITE|IN_MOVE_SELF|IN_DELETE_SELF)
+#define NGX_OPEN_FILE_INOTIFY_BUFSIZE  4096
+#endif
+
+/* a node is moved in the LRU queue at most once in this many seconds */
+#define NGX_OPEN_FILE_SHARED_TOUCH     10
+
+
+typedef struct {
+    ngx_str_node_t           sn;
+    ngx_rbtree_node_t        wd_node;
+    ngx_queue_t              queue;
+
+    ngx_uint_t               version;
+    ngx_uint_t               generation;
+    time_t                   expire;
+    time_t                   accessed;
+
+    ngx_file_uniq_t          uniq;
+    time_t                   mtime;
+    off_t                    size;
+    off_t                    fs_size;
+    ngx_err_t                err;
+
+    unsigned                 valid:1;
+    unsigned                 watched:1;
+
+    unsigned                 is_dir:1;
+    unsigned                 is_file:1;
+    unsigned                 is_link:1;
+    unsigned                 is_exec:1;
+
+    u_char                   name[1];
+} ngx_open_file_shared_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t             rbtree;
+    ngx_rbtree_node_t        sentinel;
+    ngx_rbtree_t             wd_rbtree;
+    ngx_rbtree_node_t        wd_sentinel;
+    ngx_queue_t              queue;
+    ngx_uint_t               generation;
+    ngx_uint_t               nowatch;   /* unsigned  nowatch:1; */
+} ngx_open_file_shared_sh_t;
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_str_t                name;
+    ngx_open_file_info_t     of;
+    ngx_fd_t                 fd;
+    ngx_uint_t               version;
+    ngx_int_t                rc;
+} ngx_thread_open_file_ctx_t;
+
+#endif
+
+
+struct ngx_open_file_shared_s {
+    ngx_open_file_shared_sh_t  *sh;
+    ngx_slab_pool_t            *shpool;
+    ngx_shm_zone_t             *shm_zone;
+
+    ngx_uint_t                  generation;
+    int                         inotify;
+    time_t                      polled;
+};
+
 
 static void ngx_open_file_cache_cleanup(void *data);
 #if (NGX_HAVE_OPENAT)
@@ -37,6 +119,14 @@ static ngx_int_t ngx_file_info_wrapper(ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_file_info_t *fi, ngx_log_t *log);
 static ngx_int_t ngx_open_and_stat_file(ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_log_t *log);
+static ngx_int_t ngx_open_file_stat(ngx_str_t *name,
+    ngx_open_file_info_t *of, ngx_uint_t *version, ngx_pool_t *pool);
+#if (NGX_THREADS)
+static ngx_int_t ngx_thread_open_and_stat_file(ngx_str_t *name,
+    ngx_open_file_info_t *of, ngx_uint_t *version, ngx_pool_t *pool);
+static void ngx_thread_open_and_stat_handler(void *data, ngx_log_t *log);
+static void ngx_thread_open_file_cleanup(void *data);
+#endif
 static void ngx_open_file_add_event(ngx_open_file_cache_t *cache,
     ngx_cached_open_file_t *file, ngx_open_file_info_t *of, ngx_log_t *log);
 static void ngx_open_file_cleanup(void *data);
@@ -51,6 +141,37 @@ static ngx_cached_open_file_t *
     ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
     uint32_t hash);
 static void ngx_open_file_cache_remove(ngx_event_t *ev);
+static ngx_uint_t ngx_open_file_cache_test(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_cached_open_file_t *file, time_t now,
+    ngx_open_file_info_t *of, ngx_log_t *log);
+static ngx_int_t ngx_open_file_cache_stat(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of,
+    ngx_uint_t *version, ngx_pool_t *pool);
+static ngx_int_t ngx_open_file_shared_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+#if (NGX_HAVE_INOTIFY)
+static void ngx_open_file_shared_cleanup(void *data);
+#endif
+static int ngx_open_file_shared_watch(ngx_open_file_shared_t *shared,
+    ngx_str_t *name, ngx_log_t *log);
+static void ngx_open_file_shared_poll(ngx_open_file_shared_t *shared,
+    ngx_log_t *log);
+#if (NGX_HAVE_INOTIFY)
+static void ngx_open_file_shared_invalidate(ngx_open_file_shared_t *shared,
+    int wd);
+#endif
+static ngx_uint_t ngx_open_file_shared_fresh(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *fn);
+static ngx_open_file_shared_node_t *
+    ngx_open_file_shared_lookup(ngx_open_file_shared_t *shared,
+    ngx_str_t *name, uint32_t hash);
+static ngx_open_file_shared_node_t *
+    ngx_open_file_shared_create(ngx_open_file_shared_t *shared,
+    ngx_str_t *name, uint32_t hash);
+static void ngx_open_file_shared_store(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *fn, ngx_open_file_info_t *of, int wd);
+static void ngx_open_file_shared_free(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *fn);
 
 
 ngx_open_file_cache_t *
@@ -72,6 +193,7 @@ ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
     cache->current = 0;
     cache->max = max;
     cache->inactive = inactive;
+    cache->shared = NULL;
 
     cln = ngx_pool_cleanup_add(pool, 0);
     if (cln == NULL) {
@@ -147,6 +269,7 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     time_t                          now;
     uint32_t                        hash;
     ngx_int_t                       rc;
+    ngx_uint_t                      version;
     ngx_file_info_t                 fi;
     ngx_pool_cleanup_t             *cln;
     ngx_cached_open_file_t         *file;
@@ -183,7 +306,7 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
             return NGX_ERROR;
         }
 
-        rc = ngx_open_and_stat_file(name, of, pool->log);
+        rc = ngx_open_file_stat(name, of, NULL, pool);
 
         if (rc == NGX_OK && !of->is_dir) {
             cln->handler = ngx_pool_cleanup_file;
@@ -203,6 +326,7 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     }
 
     now = ngx_time();
+    version = 0;
 
     hash = ngx_crc32_long(name->data, name->len);
 
@@ -218,7 +342,12 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
             /* file was not used often enough to keep open */
 
-            rc = ngx_open_and_stat_file(name, of, pool->log);
+            rc = ngx_open_file_cache_stat(cache, name, hash, of, &version,
+                                          pool);
+
+            if (rc == NGX_AGAIN) {
+                goto again;
+            }
 
             if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
                 goto failed;
@@ -230,12 +359,12 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         if (file->use_event
             || (file->event == NULL
                 && (of->uniq == 0 || of->uniq == file->uniq)
-                && now - file->created < of->valid
 #if (NGX_HAVE_OPENAT)
                 && of->disable_symlinks == file->disable_symlinks
                 && of->disable_symlinks_from == file->disable_symlinks_from
 #endif
-            ))
+                && ngx_open_file_cache_test(cache, name, hash, file, now, of,
+                                            pool->log)))
         {
             if (file->err == 0) {
 
@@ -286,7 +415,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         of->fd = file->fd;
         of->uniq = file->uniq;
 
-        rc = ngx_open_and_stat_file(name, of, pool->log);
+        rc = ngx_open_file_cache_stat(cache, name, hash, of, &version, pool);
+
+        if (rc == NGX_AGAIN) {
+            goto again;
+        }
 
         if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
             goto failed;
@@ -351,7 +484,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     /* not found */
 
-    rc = ngx_open_and_stat_file(name, of, pool->log);
+    rc = ngx_open_file_cache_stat(cache, name, hash, of, &version, pool);
+
+    if (rc == NGX_AGAIN) {
+        return NGX_AGAIN;
+    }
 
     if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
         goto failed;
@@ -398,6 +535,7 @@ update:
 
     file->fd = of->fd;
     file->err = of->err;
+    file->version = version;
 #if (NGX_HAVE_OPENAT)
     file->disable_symlinks = of->disable_symlinks;
     file->disable_symlinks_from = of->disable_symlinks_from;
@@ -450,6 +588,16 @@ found:
 
     return NGX_ERROR;
 
+again:
+
+    /* the file is being tested in a thread, the caller will retry */
+
+    file->uses--;
+
+    ngx_queue_insert_head(&cache->expire_queue, &file->queue);
+
+    return NGX_AGAIN;
+
 failed:
 
     if (file) {
@@ -945,6 +1093,151 @@ done:
 }
 
 
+static ngx_int_t
+ngx_open_file_stat(ngx_str_t *name, ngx_open_file_info_t *of,
+    ngx_uint_t *version, ngx_pool_t *pool)
+{
+#if (NGX_THREADS)
+
+    if (of->thread_handler) {
+        return ngx_thread_open_and_stat_file(name, of, version, pool);
+    }
+
+#endif
+
+    return ngx_open_and_stat_file(name, of, pool->log);
+}
+
+
+#if (NGX_THREADS)
+
+/*
+ * the first call posts open() and stat() to a thread pool and returns
+ * NGX_AGAIN, the caller repeats the call with the same of->thread_task
+ * after the task is completed to get the result
+ */
+
+static ngx_int_t
+ngx_thread_open_and_stat_file(ngx_str_t *name, ngx_open_file_info_t *of,
+    ngx_uint_t *version, ngx_pool_t *pool)
+{
+    ngx_thread_task_t           *task;
+    ngx_pool_cleanup_t          *cln;
+    ngx_thread_open_file_ctx_t  *ctx;
+
+    task = of->thread_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(pool, sizeof(ngx_thread_open_file_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_thread_open_file_cleanup;
+        cln->data = task;
+
+        of->thread_task = task;
+    }
+
+    ctx = task->ctx;
+
+    if (task->event.complete) {
+        task->event.complete = 0;
+
+        if (ctx->fd == of->fd
+            && ctx->name.len == name->len
+            && ngx_strncmp(ctx->name.data, name->data, name->len) == 0)
+        {
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, pool->log, 0,
+                           "thread open: \"%V\" fd:%d", name, ctx->of.fd);
+
+            if (version) {
+                *version = ctx->version;
+            }
+
+            of->fd = ctx->of.fd;
+            of->uniq = ctx->of.uniq;
+            of->mtime = ctx->of.mtime;
+            of->size = ctx->of.size;
+            of->fs_size = ctx->of.fs_size;
+            of->err = ctx->of.err;
+            of->failed = ctx->of.failed;
+            of->is_dir = ctx->of.is_dir;
+            of->is_file = ctx->of.is_file;
+            of->is_link = ctx->of.is_link;
+            of->is_exec = ctx->of.is_exec;
+            of->is_directio = ctx->of.is_directio;
+
+            return ctx->rc;
+        }
+
+        /* the result is for another file test */
+
+        if (ctx->of.fd != NGX_INVALID_FILE && ctx->of.fd != ctx->fd) {
+            if (ngx_close_file(ctx->of.fd) == NGX_FILE_ERROR) {
+                ngx_log_error(NGX_LOG_ALERT, pool->log, ngx_errno,
+                              ngx_close_file_n " \"%V\" failed", &ctx->name);
+            }
+        }
+    }
+
+    ctx->name = *name;
+    ctx->of = *of;
+    ctx->fd = of->fd;
+    ctx->version = version ? *version : 0;
+
+    task->handler = ngx_thread_open_and_stat_handler;
+
+    if (of->thread_handler(task, of) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_thread_open_and_stat_handler(void *data, ngx_log_t *log)
+{
+    ngx_thread_open_file_ctx_t *ctx = data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0,
+                   "thread open handler: \"%V\"", &ctx->name);
+
+    ctx->rc = ngx_open_and_stat_file(&ctx->name, &ctx->of, log);
+}
+
+
+static void
+ngx_thread_open_file_cleanup(void *data)
+{
+    ngx_thread_task_t  *task = data;
+
+    ngx_thread_open_file_ctx_t  *ctx;
+
+    ctx = task->ctx;
+
+    /* a result that was not taken by the caller */
+
+    if (task->event.complete
+        && ctx->of.fd != NGX_INVALID_FILE
+        && ctx->of.fd != ctx->fd)
+    {
+        if (ngx_close_file(ctx->of.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          ngx_close_file_n " \"%V\" failed", &ctx->name);
+        }
+    }
+}
+
+#endif
+
+
 /*
  * we ignore any possible event setting error and
  * fallback to usual periodic file retests
@@ -1251,3 +1544,692 @@ ngx_open_file_cache_remove(ngx_event_t *ev)
     ngx_free(ev->data);
     ngx_free(ev);
 }
+
+
+static ngx_uint_t
+ngx_open_file_cache_test(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_cached_open_file_t *file, time_t now,
+    ngx_open_file_info_t *of, ngx_log_t *log)
+{
+    ngx_uint_t                    rc;
+    ngx_open_file_shared_t       *shared;
+    ngx_open_file_shared_node_t  *fn;
+
+    shared = cache->shared;
+
+    if (shared == NULL
+#if (NGX_HAVE_OPENAT)
+        || of->disable_symlinks
+#endif
+       )
+    {
+        return (now - file->created < of->valid);
+    }
+
+    ngx_open_file_shared_poll(shared, log);
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    fn = ngx_open_file_shared_lookup(shared, name, hash);
+
+    if (fn == NULL) {
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+        return 0;
+    }
+
+    rc = (ngx_open_file_shared_fresh(shared, fn)
+          && fn->version == file->version);
+
+    if (fn->accessed + NGX_OPEN_FILE_SHARED_TOUCH <= now) {
+        fn->accessed = now;
+
+        ngx_queue_remove(&fn->queue);
+        ngx_queue_insert_head(&shared->sh->queue, &fn->queue);
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_open_file_cache_stat(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of, ngx_uint_t *version,
+    ngx_pool_t *pool)
+{
+    int                           wd;
+    ngx_int_t                     rc;
+    ngx_open_file_shared_t       *shared;
+    ngx_open_file_shared_node_t  *fn;
+
+    shared = cache->shared;
+
+    if (shared == NULL
+#if (NGX_HAVE_OPENAT)
+        || of->disable_symlinks
+#endif
+       )
+    {
+        return ngx_open_file_stat(name, of, NULL, pool);
+    }
+
+    ngx_open_file_shared_poll(shared, pool->log);
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    fn = ngx_open_file_shared_lookup(shared, name, hash);
+
+    if (fn && ngx_open_file_shared_fresh(shared, fn)) {
+
+        *version = fn->version;
+
+        if (fn->err) {
+
+            if (of->errors) {
+                of->fd = NGX_INVALID_FILE;
+                of->err = fn->err;
+                of->failed = ngx_open_file_n;
+
+                ngx_shmtx_unlock(&shared->shpool->mutex);
+
+                return NGX_ERROR;
+            }
+
+        } else if (fn->is_dir
+                   || (of->fd != NGX_INVALID_FILE && of->uniq == fn->uniq))
+        {
+            if (fn->is_dir) {
+                of->fd = NGX_INVALID_FILE;
+            }
+
+            of->uniq = fn->uniq;
+            of->mtime = fn->mtime;
+            of->size = fn->size;
+            of->fs_size = fn->fs_size;
+            of->is_dir = fn->is_dir;
+            of->is_file = fn->is_file;
+            of->is_link = fn->is_link;
+            of->is_exec = fn->is_exec;
+
+            ngx_shmtx_unlock(&shared->shpool->mutex);
+
+            return NGX_OK;
+        }
+
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+
+        /* the info is current, but a file handle is needed */
+
+        return ngx_open_file_stat(name, of, NULL, pool);
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    /*
+     * the watch is added before stat() so any change made after
+     * the stat() is reported, and the info is stored only if
+     * the node was not invalidated meanwhile
+     */
+
+    wd = ngx_open_file_shared_watch(shared, name, pool->log);
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    fn = ngx_open_file_shared_lookup(shared, name, hash);
+
+    if (fn == NULL) {
+        fn = ngx_open_file_shared_create(shared, name, hash);
+    }
+
+    *version = fn ? fn->version : 0;
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    /* a stat() made in a thread is stored with the version it was made at */
+
+    rc = ngx_open_file_stat(name, of, version, pool);
+
+    if (rc != NGX_OK && of->err == 0) {
+        return rc;
+    }
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    fn = ngx_open_file_shared_lookup(shared, name, hash);
+
+    if (fn && fn->version == *version) {
+        ngx_open_file_shared_store(shared, fn, of, wd);
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    return rc;
+}
+
+
+ngx_open_file_shared_t *
+ngx_open_file_cache_shared(ngx_conf_t *cf, ngx_str_t *name, size_t size,
+    void *tag)
+{
+    ngx_shm_zone_t          *shm_zone;
+    ngx_open_file_shared_t  *shared;
+#if (NGX_HAVE_INOTIFY)
+    ngx_pool_cleanup_t      *cln;
+#endif
+
+    shm_zone = ngx_shared_memory_add(cf, name, size, tag);
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
+    if (shm_zone->data) {
+        return shm_zone->data;
+    }
+
+    shared = ngx_pcalloc(cf->pool, sizeof(ngx_open_file_shared_t));
+    if (shared == NULL) {
+        return NULL;
+    }
+
+    shared->shm_zone = shm_zone;
+    shared->inotify = -1;
+
+#if (NGX_HAVE_INOTIFY)
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_open_file_shared_cleanup;
+    cln->data = shared;
+
+    shared->inotify = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+
+    if (shared->inotify == -1) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, ngx_errno,
+                           "inotify_init1() failed, "
+                           "open file cache \"%V\" will use "
+                           "open_file_cache_valid", name);
+    }
+
+#endif
+
+    shm_zone->init = ngx_open_file_shared_init;
+    shm_zone->data = shared;
+
+    return shared;
+}
+
+
+static ngx_int_t
+ngx_open_file_shared_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_open_file_shared_t  *oshared = data;
+
+    size_t                        len;
+    ngx_queue_t                  *q;
+    ngx_open_file_shared_t       *shared;
+    ngx_open_file_shared_sh_t    *sh;
+    ngx_open_file_shared_node_t  *fn;
+
+    shared = shm_zone->data;
+
+    if (oshared) {
+        shared->sh = oshared->sh;
+        shared->shpool = oshared->shpool;
+
+        /*
+         * watches of the previous cycle belong to its inotify instance,
+         * so the stored info is not used by the new cycle
+         */
+
+        sh = shared->sh;
+
+        ngx_shmtx_lock(&shared->shpool->mutex);
+
+        sh->generation++;
+        sh->nowatch = 0;
+
+        ngx_rbtree_init(&sh->wd_rbtree, &sh->wd_sentinel,
+                        ngx_rbtree_insert_value);
+
+        for (q = ngx_queue_head(&sh->queue);
+             q != ngx_queue_sentinel(&sh->queue);
+             q = ngx_queue_next(q))
+        {
+            fn = ngx_queue_data(q, ngx_open_file_shared_node_t, queue);
+            fn->watched = 0;
+        }
+
+        shared->generation = sh->generation;
+
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+
+        return NGX_OK;
+    }
+
+    shared->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shared->sh = shared->shpool->data;
+        shared->generation = shared->sh->generation;
+
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(shared->shpool, sizeof(ngx_open_file_shared_sh_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shared->sh = sh;
+    shared->shpool->data = sh;
+
+    ngx_rbtree_init(&sh->rbtree, &sh->sentinel, ngx_str_rbtree_insert_value);
+    ngx_rbtree_init(&sh->wd_rbtree, &sh->wd_sentinel,
+                    ngx_rbtree_insert_value);
+
+    ngx_queue_init(&sh->queue);
+
+    sh->generation = 0;
+    sh->nowatch = 0;
+    shared->generation = 0;
+
+    len = sizeof(" in open file cache \"\"") + shm_zone->shm.name.len;
+
+    shared->shpool->log_ctx = ngx_slab_alloc(shared->shpool, len);
+    if (shared->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shared->shpool->log_ctx, " in open file cache \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shared->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_INOTIFY)
+
+static void
+ngx_open_file_shared_cleanup(void *data)
+{
+    ngx_open_file_shared_t  *shared = data;
+
+    if (shared->inotify != -1 && close(shared->inotify) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "inotify close() failed");
+    }
+}
+
+#endif
+
+
+static int
+ngx_open_file_shared_watch(ngx_open_file_shared_t *shared, ngx_str_t *name,
+    ngx_log_t *log)
+{
+#if (NGX_HAVE_INOTIFY)
+
+    int        wd;
+    u_char    *p;
+    ngx_err_t  err;
+    u_char     dir[NGX_MAX_PATH];
+
+    if (shared->inotify == -1 || shared->sh->nowatch) {
+        return -1;
+    }
+
+    wd = inotify_add_watch(shared->inotify, (char *) name->data,
+                           NGX_OPEN_FILE_INOTIFY_MASK|IN_MASK_ADD);
+
+    if (wd == -1) {
+        err = ngx_errno;
+
+        if (err == NGX_ENOENT) {
+
+            /* a file not found is watched for in its directory */
+
+            for (p = name->data + name->len; p > name->data; p--) {
+                if (p[-1] == '/') {
+                    break;
+                }
+            }
+
+            if (p > name->data + 1 && (size_t) (p - name->data) < NGX_MAX_PATH)
+            {
+                ngx_cpystrn(dir, name->data, p - name->data);
+
+                wd = inotify_add_watch(shared->inotify, (char *) dir,
+                                       IN_CREATE|IN_MOVED_TO|IN_MASK_ADD);
+            }
+
+        } else if (err != NGX_ENOTDIR && err != NGX_EACCES) {
+
+            /*
+             * the watch limit is reached or the like: new files are not
+             * watched anymore until the zone is reused by a new cycle
+             */
+
+            shared->sh->nowatch = 1;
+
+            ngx_log_error(NGX_LOG_WARN, log, err,
+                          "inotify_add_watch(\"%V\") failed, open file "
+                          "cache \"%V\" will use open_file_cache_valid "
+                          "for new files", name, &shared->shm_zone->shm.name);
+        }
+
+        /* forbidden files and the rest are retested periodically */
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "open file cache watch: \"%V\" wd:%d", name, wd);
+
+    return wd;
+
+#else
+
+    return -1;
+
+#endif
+}
+
+
+static void
+ngx_open_file_shared_poll(ngx_open_file_shared_t *shared, ngx_log_t *log)
+{
+#if (NGX_HAVE_INOTIFY)
+
+    u_char                *p, *last;
+    ssize_t                n;
+    ngx_err_t              err;
+    struct inotify_event  *ev;
+    union {
+        struct inotify_event  event;
+        u_char                buf[NGX_OPEN_FILE_INOTIFY_BUFSIZE];
+    } events;
+
+    /*
+     * the inotify instance is shared by all workers, each event is
+     * read by one of them; changes are noticed within a second
+     */
+
+    if (shared->inotify == -1 || shared->polled == ngx_time()) {
+        return;
+    }
+
+    shared->polled = ngx_time();
+
+    for ( ;; ) {
+
+        n = read(shared->inotify, events.buf, NGX_OPEN_FILE_INOTIFY_BUFSIZE);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, log, err,
+                              "inotify read() failed");
+            }
+
+            return;
+        }
+
+        if (n == 0) {
+            return;
+        }
+
+        ngx_shmtx_lock(&shared->shpool->mutex);
+
+        last = events.buf + n;
+
+        for (p = events.buf; p < last; p += sizeof(struct inotify_event)
+                                            + ev->len)
+        {
+            ev = (struct inotify_event *) p;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                           "open file cache event: wd:%d mask:%xD",
+                           ev->wd, ev->mask);
+
+            ngx_open_file_shared_invalidate(shared,
+                                   (ev->mask & IN_Q_OVERFLOW) ? -1 : ev->wd);
+        }
+
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+    }
+
+#endif
+}
+
+
+#if (NGX_HAVE_INOTIFY)
+
+static void
+ngx_open_file_shared_invalidate(ngx_open_file_shared_t *shared, int wd)
+{
+    ngx_queue_t                  *q;
+    ngx_rbtree_key_t              key;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_open_file_shared_node_t  *fn;
+
+    if (wd == -1) {
+
+        /* events were lost */
+
+        for (q = ngx_queue_head(&shared->sh->queue);
+             q != ngx_queue_sentinel(&shared->sh->queue);
+             q = ngx_queue_next(q))
+        {
+            fn = ngx_queue_data(q, ngx_open_file_shared_node_t, queue);
+
+            fn->valid = 0;
+            fn->version++;
+        }
+
+        return;
+    }
+
+    key = (ngx_rbtree_key_t) wd;
+    sentinel = shared->sh->wd_rbtree.sentinel;
+
+    /* several names may refer to the same watched inode */
+
+    for ( ;; ) {
+
+        node = shared->sh->wd_rbtree.root;
+
+        while (node != sentinel && node->key != key) {
+            node = (key < node->key) ? node->left : node->right;
+        }
+
+        if (node == sentinel) {
+            return;
+        }
+
+        fn = (ngx_open_file_shared_node_t *)
+                 ((u_char *) node - offsetof(ngx_open_file_shared_node_t,
+                                             wd_node));
+
+        ngx_rbtree_delete(&shared->sh->wd_rbtree, node);
+
+        fn->watched = 0;
+        fn->valid = 0;
+        fn->version++;
+    }
+}
+
+#endif
+
+
+static ngx_uint_t
+ngx_open_file_shared_fresh(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *fn)
+{
+    return (fn->valid
+            && fn->generation == shared->sh->generation
+            && fn->expire > ngx_time());
+}
+
+
+static ngx_open_file_shared_node_t *
+ngx_open_file_shared_lookup(ngx_open_file_shared_t *shared, ngx_str_t *name,
+    uint32_t hash)
+{
+    return (ngx_open_file_shared_node_t *)
+               ngx_str_rbtree_lookup(&shared->sh->rbtree, name, hash);
+}
+
+
+static ngx_open_file_shared_node_t *
+ngx_open_file_shared_create(ngx_open_file_shared_t *shared, ngx_str_t *name,
+    uint32_t hash)
+{
+    size_t                        n;
+    ngx_queue_t                  *q;
+    ngx_uint_t                    i;
+    ngx_open_file_shared_node_t  *fn;
+
+    n = offsetof(ngx_open_file_shared_node_t, name) + name->len;
+
+    fn = ngx_slab_alloc_locked(shared->shpool, n);
+
+    if (fn == NULL) {
+
+        /* free the least recently used nodes and try again */
+
+        for (i = 0; i < 2; i++) {
+
+            if (ngx_queue_empty(&shared->sh->queue)) {
+                break;
+            }
+
+            q = ngx_queue_last(&shared->sh->queue);
+
+            ngx_open_file_shared_free(shared,
+                    ngx_queue_data(q, ngx_open_file_shared_node_t, queue));
+        }
+
+        fn = ngx_slab_alloc_locked(shared->shpool, n);
+
+        if (fn == NULL) {
+            return NULL;
+        }
+    }
+
+    ngx_memcpy(fn->name, name->data, name->len);
+
+    fn->sn.node.key = hash;
+    fn->sn.str.len = name->len;
+    fn->sn.str.data = fn->name;
+
+    fn->version = 0;
+    fn->generation = shared->generation;
+    fn->expire = 0;
+    fn->accessed = ngx_time();
+    fn->err = 0;
+    fn->valid = 0;
+    fn->watched = 0;
+
+    ngx_rbtree_insert(&shared->sh->rbtree, &fn->sn.node);
+
+    ngx_queue_insert_head(&shared->sh->queue, &fn->queue);
+
+    return fn;
+}
+
+
+static void
+ngx_open_file_shared_store(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *fn, ngx_open_file_info_t *of, int wd)
+{
+    fn->err = of->err;
+
+    if (of->err == 0) {
+        fn->uniq = of->uniq;
+        fn->mtime = of->mtime;
+        fn->size = of->size;
+        fn->fs_size = of->fs_size;
+        fn->is_dir = of->is_dir;
+        fn->is_file = of->is_file;
+        fn->is_link = of->is_link;
+        fn->is_exec = of->is_exec;
+    }
+
+    fn->valid = 1;
+    fn->generation = shared->generation;
+
+    /*
+     * a watch follows symlinks and does not report changes of the path
+     * components, so open_file_cache_valid still limits the time the info
+     * is used, even if the file is watched
+     */
+
+    fn->expire = ngx_time() + of->valid;
+
+    if (wd != -1 && shared->generation == shared->sh->generation) {
+
+        if (fn->watched && fn->wd_node.key != (ngx_rbtree_key_t) wd) {
+            ngx_rbtree_delete(&shared->sh->wd_rbtree, &fn->wd_node);
+            fn->watched = 0;
+        }
+
+        if (!fn->watched) {
+            fn->wd_node.key = (ngx_rbtree_key_t) wd;
+            ngx_rbtree_insert(&shared->sh->wd_rbtree, &fn->wd_node);
+            fn->watched = 1;
+        }
+
+        return;
+    }
+
+    if (fn->watched) {
+        ngx_rbtree_delete(&shared->sh->wd_rbtree, &fn->wd_node);
+        fn->watched = 0;
+    }
+}
+
+
+static void
+ngx_open_file_shared_free(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *fn)
+{
+#if (NGX_HAVE_INOTIFY)
+    ngx_rbtree_key_t    key;
+    ngx_rbtree_node_t  *node, *sentinel;
+#endif
+
+    ngx_queue_remove(&fn->queue);
+
+    ngx_rbtree_delete(&shared->sh->rbtree, &fn->sn.node);
+
+    if (fn->watched) {
+        ngx_rbtree_delete(&shared->sh->wd_rbtree, &fn->wd_node);
+
+#if (NGX_HAVE_INOTIFY)
+
+        /* remove the watch unless another name still uses it */
+
+        key = fn->wd_node.key;
+        node = shared->sh->wd_rbtree.root;
+        sentinel = shared->sh->wd_rbtree.sentinel;
+
+        while (node != sentinel && node->key != key) {
+            node = (key < node->key) ? node->left : node->right;
+        }
+
+        if (node == sentinel
+            && shared->generation == shared->sh->generation)
+        {
+            (void) inotify_rm_watch(shared->inotify, (int) key);
+        }
+
+#endif
+    }
+
+    ngx_slab_free_locked(shared->shpool, fn);
+}
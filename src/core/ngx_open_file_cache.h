@@ -16,7 +16,9 @@
 #define NGX_OPEN_FILE_DIRECTIO_OFF  NGX_MAX_OFF_T_VALUE
 
 
-typedef struct {
+typedef struct ngx_open_file_info_s  ngx_open_file_info_t;
+
+struct ngx_open_file_info_s {
     ngx_fd_t                 fd;
     ngx_file_uniq_t          uniq;
     time_t                   mtime;
@@ -48,10 +50,18 @@ typedef struct {
     unsigned                 is_link:1;
     unsigned                 is_exec:1;
     unsigned                 is_directio:1;
-} ngx_open_file_info_t;
+
+#if (NGX_THREADS)
+    ngx_int_t              (*thread_handler)(ngx_thread_task_t *task,
+                                             ngx_open_file_info_t *of);
+    void                    *thread_ctx;
+    ngx_thread_task_t       *thread_task;
+#endif
+};
 
 
 typedef struct ngx_cached_open_file_s  ngx_cached_open_file_t;
+typedef struct ngx_open_file_shared_s  ngx_open_file_shared_t;
 
 struct ngx_cached_open_file_s {
     ngx_rbtree_node_t        node;
@@ -68,6 +78,7 @@ struct ngx_cached_open_file_s {
     ngx_err_t                err;
 
     uint32_t                 uses;
+    ngx_uint_t               version;
 
 #if (NGX_HAVE_OPENAT)
     size_t                   disable_symlinks_from;
@@ -96,6 +107,8 @@ typedef struct {
     ngx_uint_t               current;
     ngx_uint_t               max;
     time_t                   inactive;
+
+    ngx_open_file_shared_t  *shared;
 } ngx_open_file_cache_t;
 
 
@@ -124,6 +137,8 @@ ngx_open_file_cache_t *ngx_open_file_cache_init(ngx_pool_t *pool,
     ngx_uint_t max, time_t inactive);
 ngx_int_t ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool);
+ngx_open_file_shared_t *ngx_open_file_cache_shared(ngx_conf_t *cf,
+    ngx_str_t *name, size_t size, void *tag);
 
 
 #endif /* _NGX_OPEN_FILE_CACHE_H_INCLUDED_ */
@@ -160,6 +160,14 @@ ngx_output_chain(ngx_output_chain_ctx_t *ctx, ngx_chain_t *in)
 
                         ngx_free_chain(ctx->pool, cl);
 
+                        if (ctx->buf->start == NULL
+                            && ngx_buf_cache_alloc(ctx->pool, ctx->buf,
+                                                   ctx->bufs.size)
+                               != NGX_OK)
+                        {
+                            return NGX_ERROR;
+                        }
+
                     } else if (out || ctx->allocated == ctx->bufs.num) {
 
                         break;
@@ -477,6 +485,17 @@ ngx_output_chain_get_buf(ngx_output_chain_ctx_t *ctx, off_t bsize)
             return NGX_ERROR;
         }
 
+    } else if (recycled) {
+
+        /*
+         * only full sized bufs are taken from the buffer cache,
+         * as the memory is attached again with ctx->bufs.size
+         */
+
+        if (ngx_buf_cache_alloc(ctx->pool, b, size) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
     } else {
         b->start = ngx_palloc(ctx->pool, size);
         if (b->start == NULL) {
@@ -9,10 +9,44 @@
 #include <ngx_core.h>
 
 
+#if (NGX_PALLOC_PROFILER)
+#undef ngx_palloc
+#undef ngx_pnalloc
+#undef ngx_pcalloc
+#undef ngx_pmemalign
+#endif
+
+
+typedef struct {
+    size_t                size;
+    void                 *free;
+    ngx_uint_t            n;
+} ngx_pool_cache_slot_t;
+
+
 static ngx_inline void *ngx_palloc_small(ngx_pool_t *pool, size_t size,
     ngx_uint_t align);
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static void *ngx_pool_cache_get(size_t size, ngx_log_t *log);
+static void ngx_pool_cache_put(void *p, size_t size);
+static ngx_inline void ngx_pool_free_large(ngx_pool_large_t *l);
+#if (NGX_PALLOC_PROFILER)
+static void ngx_palloc_record(size_t size, const char *file, ngx_uint_t line);
+#endif
+
+
+ngx_pool_cache_stat_t  ngx_pool_cache_stat;
+
+static ngx_pool_cache_slot_t  ngx_pool_cache[NGX_POOL_CACHE_SLOTS];
+
+#if (NGX_THREADS)
+static ngx_atomic_t  ngx_pool_cache_lock;
+#endif
+
+#if (NGX_PALLOC_PROFILER)
+ngx_palloc_profile_t  *ngx_palloc_profile;
+#endif
 
 
 ngx_pool_t *
@@ -20,7 +54,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    p = ngx_pool_cache_get(size, log);
     if (p == NULL) {
         return NULL;
     }
@@ -82,12 +116,12 @@ ngx_destroy_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_free_large(l);
         }
     }
 
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_pool_cache_put(p, p->d.end - (u_char *) p);
 
         if (n == NULL) {
             break;
@@ -104,7 +138,7 @@ ngx_reset_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_free_large(l);
         }
     }
 
@@ -183,7 +217,7 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_pool_cache_get(psize, pool->log);
     if (m == NULL) {
         return NULL;
     }
@@ -217,7 +251,13 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     ngx_uint_t         n;
     ngx_pool_large_t  *large;
 
-    p = ngx_alloc(size, pool->log);
+    if (size % NGX_POOL_CACHE_UNIT == 0) {
+        p = ngx_pool_cache_get(size, pool->log);
+
+    } else {
+        p = ngx_alloc(size, pool->log);
+    }
+
     if (p == NULL) {
         return NULL;
     }
@@ -227,6 +267,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
+            large->size = size;
             return p;
         }
 
@@ -237,11 +278,12 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
 
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if (large == NULL) {
-        ngx_free(p);
+        ngx_pool_cache_put(p, size % NGX_POOL_CACHE_UNIT ? 0 : size);
         return NULL;
     }
 
     large->alloc = p;
+    large->size = size;
     large->next = pool->large;
     pool->large = large;
 
@@ -267,6 +309,7 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
     }
 
     large->alloc = p;
+    large->size = 0;
     large->next = pool->large;
     pool->large = large;
 
@@ -283,7 +326,7 @@ ngx_pfree(ngx_pool_t *pool, void *p)
         if (p == l->alloc) {
             ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                            "free: %p", l->alloc);
-            ngx_free(l->alloc);
+            ngx_pool_free_large(l);
             l->alloc = NULL;
 
             return NGX_OK;
@@ -294,6 +337,283 @@ ngx_pfree(ngx_pool_t *pool, void *p)
 }
 
 
+size_t
+ngx_pool_footprint(ngx_pool_t *pool)
+{
+    size_t             size;
+    ngx_pool_t        *p;
+    ngx_pool_large_t  *l;
+
+    size = 0;
+
+    /*
+     * blocks of ngx_pmemalign() have no size recorded and are not counted,
+     * they are only used for directio output buffers and radix tree pages
+     */
+
+    for (p = pool; p; p = p->d.next) {
+        size += p->d.end - (u_char *) p;
+    }
+
+    for (l = pool->large; l; l = l->next) {
+        if (l->alloc) {
+            size += l->size;
+        }
+    }
+
+    return size;
+}
+
+
+#if (NGX_PALLOC_PROFILER)
+
+void *
+ngx_palloc_at(ngx_pool_t *pool, size_t size, const char *file,
+    ngx_uint_t line)
+{
+    ngx_palloc_record(size, file, line);
+
+    return ngx_palloc(pool, size);
+}
+
+
+void *
+ngx_pnalloc_at(ngx_pool_t *pool, size_t size, const char *file,
+    ngx_uint_t line)
+{
+    ngx_palloc_record(size, file, line);
+
+    return ngx_pnalloc(pool, size);
+}
+
+
+void *
+ngx_pcalloc_at(ngx_pool_t *pool, size_t size, const char *file,
+    ngx_uint_t line)
+{
+    ngx_palloc_record(size, file, line);
+
+    return ngx_pcalloc(pool, size);
+}
+
+
+void *
+ngx_pmemalign_at(ngx_pool_t *pool, size_t size, size_t alignment,
+    const char *file, ngx_uint_t line)
+{
+    ngx_palloc_record(size, file, line);
+
+    return ngx_pmemalign(pool, size, alignment);
+}
+
+
+/*
+ * each worker has its own open addressing table of call sites in
+ * the shared zone, a site is identified by the __FILE__ string address
+ * and the line; a slot is taken under the worker lock as threads of
+ * the worker may allocate too, counters are updated atomically
+ *
+ * the address is only compared and never dereferenced by others, as it
+ * is not valid in processes of another binary; the file name is copied
+ * into the slot instead, keeping its tail if it is too long
+ */
+
+static void
+ngx_palloc_record(size_t size, const char *file, ngx_uint_t line)
+{
+    size_t                 len;
+    ngx_uint_t             i, n, mask;
+    ngx_atomic_t          *lock;
+    ngx_palloc_site_t     *site, *table;
+    ngx_palloc_profile_t  *pp;
+
+    pp = ngx_palloc_profile;
+
+    if (pp == NULL) {
+        return;
+    }
+
+    if (ngx_worker >= pp->workers) {
+        (void) ngx_atomic_fetch_add(&pp->lost, 1);
+        return;
+    }
+
+    table = pp->table + ngx_worker * pp->sites;
+    lock = &pp->locks[ngx_worker];
+
+    mask = pp->sites - 1;
+    i = ((uintptr_t) file ^ (line * 2654435761U)) & mask;
+
+    for (n = 0; n < pp->sites; n++, i = (i + 1) & mask) {
+
+        site = &table[i];
+
+        if (site->file == 0) {
+
+            ngx_spinlock(lock, 1, 2048);
+
+            if (site->file == 0) {
+                len = ngx_strlen(file);
+
+                if (len > NGX_PALLOC_SITE_NAME_LEN) {
+                    ngx_memcpy(site->name, file + len
+                                           - NGX_PALLOC_SITE_NAME_LEN,
+                               NGX_PALLOC_SITE_NAME_LEN);
+                    len = NGX_PALLOC_SITE_NAME_LEN;
+
+                } else {
+                    ngx_memcpy(site->name, file, len);
+                }
+
+                site->name_len = len;
+                site->line = line;
+                ngx_memory_barrier();
+                site->file = (ngx_atomic_uint_t) file;
+            }
+
+            ngx_unlock(lock);
+        }
+
+        if (site->file == (ngx_atomic_uint_t) file && site->line == line) {
+            (void) ngx_atomic_fetch_add(&site->count, 1);
+            (void) ngx_atomic_fetch_add(&site->bytes, size);
+            return;
+        }
+    }
+
+    (void) ngx_atomic_fetch_add(&pp->lost, 1);
+}
+
+#endif
+
+
+static void *
+ngx_pool_cache_get(size_t size, ngx_log_t *log)
+{
+#if !(NGX_DEBUG_PALLOC)
+
+    void                   *p;
+    ngx_uint_t              i;
+    ngx_pool_cache_slot_t  *slot;
+
+#if (NGX_THREADS)
+    ngx_spinlock(&ngx_pool_cache_lock, 1, 2048);
+#endif
+
+    for (i = 0; i < NGX_POOL_CACHE_SLOTS; i++) {
+        slot = &ngx_pool_cache[i];
+
+        if (slot->size != size || slot->free == NULL) {
+            continue;
+        }
+
+        p = slot->free;
+        slot->free = *(void **) p;
+        slot->n--;
+
+        ngx_pool_cache_stat.hits++;
+        ngx_pool_cache_stat.blocks--;
+        ngx_pool_cache_stat.size -= size;
+
+#if (NGX_THREADS)
+        ngx_unlock(&ngx_pool_cache_lock);
+#endif
+
+        return p;
+    }
+
+    ngx_pool_cache_stat.misses++;
+
+#if (NGX_THREADS)
+    ngx_unlock(&ngx_pool_cache_lock);
+#endif
+
+#endif
+
+    return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+}
+
+
+static void
+ngx_pool_cache_put(void *p, size_t size)
+{
+#if !(NGX_DEBUG_PALLOC)
+
+    ngx_uint_t              i;
+    ngx_pool_cache_slot_t  *slot, *empty;
+
+    if (size == 0) {
+        ngx_free(p);
+        return;
+    }
+
+#if (NGX_THREADS)
+    ngx_spinlock(&ngx_pool_cache_lock, 1, 2048);
+#endif
+
+    slot = NULL;
+
+    if (ngx_pool_cache_stat.size + size <= NGX_POOL_CACHE_MAX_SIZE) {
+
+        empty = NULL;
+
+        for (i = 0; i < NGX_POOL_CACHE_SLOTS; i++) {
+
+            if (ngx_pool_cache[i].size == size) {
+                slot = &ngx_pool_cache[i];
+                break;
+            }
+
+            if (ngx_pool_cache[i].n == 0 && empty == NULL) {
+                empty = &ngx_pool_cache[i];
+            }
+        }
+
+        /* a slot without blocks is given to a new size */
+
+        if (slot == NULL && empty) {
+            slot = empty;
+            slot->size = size;
+        }
+    }
+
+    if (slot) {
+        *(void **) p = slot->free;
+        slot->free = p;
+        slot->n++;
+
+        ngx_pool_cache_stat.blocks++;
+        ngx_pool_cache_stat.size += size;
+    }
+
+#if (NGX_THREADS)
+    ngx_unlock(&ngx_pool_cache_lock);
+#endif
+
+    if (slot) {
+        return;
+    }
+
+#endif
+
+    ngx_free(p);
+}
+
+
+static ngx_inline void
+ngx_pool_free_large(ngx_pool_large_t *l)
+{
+    /*
+     * only sizes multiple of NGX_POOL_CACHE_UNIT are kept; blocks of
+     * ngx_pmemalign() have zero size and are freed, as the cache does not
+     * track alignment
+     */
+
+    ngx_pool_cache_put(l->alloc,
+                       l->size % NGX_POOL_CACHE_UNIT ? 0 : l->size);
+}
+
+
 void *
 ngx_pcalloc(ngx_pool_t *pool, size_t size)
 {
@@ -26,6 +26,14 @@
     ngx_align((sizeof(ngx_pool_t) + 2 * sizeof(ngx_pool_large_t)),            \
               NGX_POOL_ALIGNMENT)
 
+/*
+ * freed pool blocks, and large allocations of sizes multiple of
+ * NGX_POOL_CACHE_UNIT, are kept on per process free lists by size
+ */
+#define NGX_POOL_CACHE_SLOTS     8
+#define NGX_POOL_CACHE_UNIT      1024
+#define NGX_POOL_CACHE_MAX_SIZE  (4 * 1024 * 1024)
+
 
 typedef void (*ngx_pool_cleanup_pt)(void *data);
 
@@ -43,6 +51,7 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;
     void                 *alloc;
+    size_t                size;
 };
 
 
@@ -72,6 +81,39 @@ typedef struct {
 } ngx_pool_cleanup_file_t;
 
 
+typedef struct {
+    ngx_uint_t            hits;
+    ngx_uint_t            misses;
+    ngx_uint_t            blocks;
+    size_t                size;
+} ngx_pool_cache_stat_t;
+
+
+#if (NGX_PALLOC_PROFILER)
+
+#define NGX_PALLOC_SITE_NAME_LEN  64
+
+typedef struct {
+    ngx_atomic_t          file;         /* const char *, 0 if free */
+    ngx_uint_t            line;
+    ngx_atomic_t          count;
+    ngx_atomic_t          bytes;
+    size_t                name_len;
+    u_char                name[NGX_PALLOC_SITE_NAME_LEN];
+} ngx_palloc_site_t;
+
+
+typedef struct {
+    ngx_uint_t            workers;
+    ngx_uint_t            sites;        /* per worker, a power of 2 */
+    ngx_atomic_t          lost;
+    ngx_atomic_t         *locks;
+    ngx_palloc_site_t    *table;
+} ngx_palloc_profile_t;
+
+#endif
+
+
 void *ngx_alloc(size_t size, ngx_log_t *log);
 void *ngx_calloc(size_t size, ngx_log_t *log);
 
@@ -84,6 +126,31 @@ void *ngx_pnalloc(ngx_pool_t *pool, size_t size);
 void *ngx_pcalloc(ngx_pool_t *pool, size_t size);
 void *ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment);
 ngx_int_t ngx_pfree(ngx_pool_t *pool, void *p);
+size_t ngx_pool_footprint(ngx_pool_t *pool);
+
+#if (NGX_PALLOC_PROFILER)
+
+/* allocations are accounted to the call site */
+
+void *ngx_palloc_at(ngx_pool_t *pool, size_t size, const char *file,
+    ngx_uint_t line);
+void *ngx_pnalloc_at(ngx_pool_t *pool, size_t size, const char *file,
+    ngx_uint_t line);
+void *ngx_pcalloc_at(ngx_pool_t *pool, size_t size, const char *file,
+    ngx_uint_t line);
+void *ngx_pmemalign_at(ngx_pool_t *pool, size_t size, size_t alignment,
+    const char *file, ngx_uint_t line);
+
+#define ngx_palloc(pool, size)                                                \
+    ngx_palloc_at(pool, size, __FILE__, __LINE__)
+#define ngx_pnalloc(pool, size)                                               \
+    ngx_pnalloc_at(pool, size, __FILE__, __LINE__)
+#define ngx_pcalloc(pool, size)                                               \
+    ngx_pcalloc_at(pool, size, __FILE__, __LINE__)
+#define ngx_pmemalign(pool, size, alignment)                                  \
+    ngx_pmemalign_at(pool, size, alignment, __FILE__, __LINE__)
+
+#endif
 
 
 ngx_pool_cleanup_t *ngx_pool_cleanup_add(ngx_pool_t *p, size_t size);
@@ -92,4 +159,10 @@ void ngx_pool_cleanup_file(void *data);
 void ngx_pool_delete_file(void *data);
 
 
+extern ngx_pool_cache_stat_t  ngx_pool_cache_stat;
+#if (NGX_PALLOC_PROFILER)
+extern ngx_palloc_profile_t  *ngx_palloc_profile;
+#endif
+
+
 #endif /* _NGX_PALLOC_H_INCLUDED_ */
@@ -9,6 +9,36 @@
 #include <ngx_core.h>
 
 
+#define NGX_RADIX_TRIE_STRIDE  6
+
+
+/*
+ * without the instruction gcc calls a library function for the builtin,
+ * which is slower than the bit arithmetic below
+ */
+
+#if (__POPCNT__)
+
+#define ngx_radix_popcount(x)  (ngx_uint_t) __builtin_popcountll(x)
+
+#else
+
+static ngx_inline ngx_uint_t
+ngx_radix_popcount(uint64_t x)
+{
+    x -= (x >> 1) & 0x5555555555555555ULL;
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+
+    return (ngx_uint_t) ((x * 0x0101010101010101ULL) >> 56);
+}
+
+#endif
+
+
+static ngx_int_t ngx_radix_trie_build(ngx_array_t *nodes, ngx_array_t *leaves,
+    ngx_uint_t n, ngx_radix_node_t *node, uintptr_t value);
+static ngx_uint_t ngx_radix_trie_valued(ngx_radix_node_t *node);
 static ngx_radix_node_t *ngx_radix_alloc(ngx_radix_tree_t *tree);
 
 
@@ -27,6 +57,8 @@ ngx_radix_tree_create(ngx_pool_t *pool, ngx_int_t preallocate)
     tree->free = NULL;
     tree->start = NULL;
     tree->size = 0;
+    tree->trie = NULL;
+    tree->leaves = NULL;
 
     tree->root = ngx_radix_alloc(tree);
     if (tree->root == NULL) {
@@ -112,6 +144,8 @@ ngx_radix32tree_insert(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask,
     uint32_t           bit;
     ngx_radix_node_t  *node, *next;
 
+    tree->trie = NULL;
+
     bit = 0x80000000;
 
     node = tree->root;
@@ -176,6 +210,8 @@ ngx_radix32tree_delete(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask)
     uint32_t           bit;
     ngx_radix_node_t  *node;
 
+    tree->trie = NULL;
+
     bit = 0x80000000;
     node = tree->root;
 
@@ -236,9 +272,32 @@ ngx_radix32tree_delete(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask)
 uintptr_t
 ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key)
 {
-    uint32_t           bit;
-    uintptr_t          value;
-    ngx_radix_node_t  *node;
+    uint32_t                bit;
+    uint64_t                k, slot;
+    uintptr_t               value;
+    ngx_uint_t              shift;
+    ngx_radix_node_t       *node;
+    ngx_radix_trie_node_t  *trie;
+
+    if (tree->trie) {
+        k = (uint64_t) key << 32;
+        shift = 64 - NGX_RADIX_TRIE_STRIDE;
+        trie = tree->trie;
+
+        for ( ;; ) {
+            slot = (uint64_t) 1 << ((k >> shift) & 0x3f);
+
+            if ((trie->vector & slot) == 0) {
+                slot = trie->leafvec & ((slot << 1) - 1);
+                return tree->leaves[trie->base0 + ngx_radix_popcount(slot) - 1];
+            }
+
+            trie = &tree->trie[trie->base1
+                       + ngx_radix_popcount(trie->vector & (slot - 1))];
+
+            shift -= NGX_RADIX_TRIE_STRIDE;
+        }
+    }
 
     bit = 0x80000000;
     value = NGX_RADIX_NO_VALUE;
@@ -273,6 +332,8 @@ ngx_radix128tree_insert(ngx_radix_tree_t *tree, u_char *key, u_char *mask,
     ngx_uint_t         i;
     ngx_radix_node_t  *node, *next;
 
+    tree->trie = NULL;
+
     i = 0;
     bit = 0x80;
 
@@ -355,6 +416,8 @@ ngx_radix128tree_delete(ngx_radix_tree_t *tree, u_char *key, u_char *mask)
     ngx_uint_t         i;
     ngx_radix_node_t  *node;
 
+    tree->trie = NULL;
+
     i = 0;
     bit = 0x80;
     node = tree->root;
@@ -424,10 +487,39 @@ ngx_radix128tree_delete(ngx_radix_tree_t *tree, u_char *key, u_char *mask)
 uintptr_t
 ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key)
 {
-    u_char             bit;
-    uintptr_t          value;
-    ngx_uint_t         i;
-    ngx_radix_node_t  *node;
+    u_char                  bit;
+    uint64_t                slot;
+    uintptr_t               value;
+    ngx_uint_t              i, off, w;
+    ngx_radix_node_t       *node;
+    ngx_radix_trie_node_t  *trie;
+
+    if (tree->trie) {
+        off = 0;
+        trie = tree->trie;
+
+        for ( ;; ) {
+            i = off >> 3;
+
+            w = key[i] << 8;
+
+            if (i < 15) {
+                w |= key[i + 1];
+            }
+
+            slot = (uint64_t) 1 << ((w >> (10 - (off & 7))) & 0x3f);
+
+            if ((trie->vector & slot) == 0) {
+                slot = trie->leafvec & ((slot << 1) - 1);
+                return tree->leaves[trie->base0 + ngx_radix_popcount(slot) - 1];
+            }
+
+            trie = &tree->trie[trie->base1
+                       + ngx_radix_popcount(trie->vector & (slot - 1))];
+
+            off += NGX_RADIX_TRIE_STRIDE;
+        }
+    }
 
     i = 0;
     bit = 0x80;
@@ -460,6 +552,182 @@ ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key)
 #endif
 
 
+/*
+ * The tree is compiled into a multibit trie after it has been built:
+ * a lookup takes at most 6 node loads for IPv4 and 22 for IPv6 instead
+ * of one load per bit.  Any modification of the tree discards the trie.
+ */
+
+ngx_int_t
+ngx_radix_tree_compile(ngx_radix_tree_t *tree)
+{
+    ngx_int_t    rc;
+    ngx_pool_t  *temp_pool;
+    ngx_array_t  nodes, leaves;
+
+    tree->trie = NULL;
+
+    temp_pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, tree->pool->log);
+    if (temp_pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    if (ngx_array_init(&nodes, temp_pool, 64, sizeof(ngx_radix_trie_node_t))
+        != NGX_OK)
+    {
+        goto done;
+    }
+
+    if (ngx_array_init(&leaves, temp_pool, 256, sizeof(uintptr_t)) != NGX_OK) {
+        goto done;
+    }
+
+    if (ngx_array_push(&nodes) == NULL) {
+        goto done;
+    }
+
+    if (ngx_radix_trie_build(&nodes, &leaves, 0, tree->root,
+                             tree->root->value)
+        != NGX_OK)
+    {
+        goto done;
+    }
+
+    tree->leaves = ngx_palloc(tree->pool, leaves.nelts * sizeof(uintptr_t));
+    if (tree->leaves == NULL) {
+        goto done;
+    }
+
+    ngx_memcpy(tree->leaves, leaves.elts, leaves.nelts * sizeof(uintptr_t));
+
+    tree->trie = ngx_palloc(tree->pool,
+                            nodes.nelts * sizeof(ngx_radix_trie_node_t));
+    if (tree->trie == NULL) {
+        goto done;
+    }
+
+    ngx_memcpy(tree->trie, nodes.elts,
+               nodes.nelts * sizeof(ngx_radix_trie_node_t));
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, tree->pool->log, 0,
+                   "radix tree compiled: %ui nodes, %ui leaves",
+                   nodes.nelts, leaves.nelts);
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_destroy_pool(temp_pool);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_radix_trie_build(ngx_array_t *nodes, ngx_array_t *leaves, ngx_uint_t n,
+    ngx_radix_node_t *node, uintptr_t value)
+{
+    uint64_t                slot, vector, leafvec;
+    uint32_t                base0, base1;
+    uintptr_t               v, last, *leaf, values[64];
+    ngx_uint_t              i, j, k;
+    ngx_radix_node_t       *next, *children[64];
+    ngx_radix_trie_node_t  *trie;
+
+    vector = 0;
+    leafvec = 0;
+    last = NGX_RADIX_NO_VALUE;
+    k = 0;
+
+    base0 = (uint32_t) leaves->nelts;
+
+    for (i = 0; i < 64; i++) {
+        next = node;
+        v = value;
+
+        for (j = 1 << (NGX_RADIX_TRIE_STRIDE - 1); j; j >>= 1) {
+            next = (i & j) ? next->right : next->left;
+
+            if (next == NULL) {
+                break;
+            }
+
+            if (next->value != NGX_RADIX_NO_VALUE) {
+                v = next->value;
+            }
+        }
+
+        slot = (uint64_t) 1 << i;
+
+        if (next
+            && (ngx_radix_trie_valued(next->left)
+                || ngx_radix_trie_valued(next->right)))
+        {
+            vector |= slot;
+            children[k] = next;
+            values[k] = v;
+            k++;
+            continue;
+        }
+
+        if (leafvec && v == last) {
+            continue;
+        }
+
+        leaf = ngx_array_push(leaves);
+        if (leaf == NULL) {
+            return NGX_ERROR;
+        }
+
+        *leaf = v;
+        last = v;
+        leafvec |= slot;
+    }
+
+    base1 = (uint32_t) nodes->nelts;
+
+    if (k && ngx_array_push_n(nodes, k) == NULL) {
+        return NGX_ERROR;
+    }
+
+    trie = (ngx_radix_trie_node_t *) nodes->elts + n;
+
+    trie->vector = vector;
+    trie->leafvec = leafvec;
+    trie->base0 = base0;
+    trie->base1 = base1;
+
+    for (i = 0; i < k; i++) {
+        if (ngx_radix_trie_build(nodes, leaves, base1 + i, children[i],
+                                 values[i])
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_radix_trie_valued(ngx_radix_node_t *node)
+{
+    if (node == NULL) {
+        return 0;
+    }
+
+    if (node->value != NGX_RADIX_NO_VALUE) {
+        return 1;
+    }
+
+    return ngx_radix_trie_valued(node->left)
+           || ngx_radix_trie_valued(node->right);
+}
+
+
 static ngx_radix_node_t *
 ngx_radix_alloc(ngx_radix_tree_t *tree)
 {
@@ -25,17 +25,34 @@ struct ngx_radix_node_s {
 };
 
 
+/*
+ * a node of the compiled multibit trie: each node resolves 6 bits of a key,
+ * the "vector" bitmap marks slots with child nodes, and the "leafvec" bitmap
+ * marks slots starting a run of equal values in the leaves array
+ */
+
+typedef struct {
+    uint64_t                vector;
+    uint64_t                leafvec;
+    uint32_t                base0;
+    uint32_t                base1;
+} ngx_radix_trie_node_t;
+
+
 typedef struct {
-    ngx_radix_node_t  *root;
-    ngx_pool_t        *pool;
-    ngx_radix_node_t  *free;
-    char              *start;
-    size_t             size;
+    ngx_radix_node_t       *root;
+    ngx_pool_t             *pool;
+    ngx_radix_node_t       *free;
+    char                   *start;
+    size_t                  size;
+    ngx_radix_trie_node_t  *trie;
+    uintptr_t              *leaves;
 } ngx_radix_tree_t;
 
 
 ngx_radix_tree_t *ngx_radix_tree_create(ngx_pool_t *pool,
     ngx_int_t preallocate);
+ngx_int_t ngx_radix_tree_compile(ngx_radix_tree_t *tree);
 
 ngx_int_t ngx_radix32tree_insert(ngx_radix_tree_t *tree,
     uint32_t key, uint32_t mask, uintptr_t value);
@@ -14,6 +14,14 @@ typedef struct {
 } ngx_regex_conf_t;
 
 
+#define NGX_REGEX_SET_MAX      64
+#define NGX_REGEX_SET_SUBJECT  256
+#define NGX_REGEX_SET_STEPS    4
+
+
+static ngx_uint_t ngx_regex_combinable(u_char *p);
+static ngx_regex_t *ngx_regex_combine(ngx_pool_t *pool, ngx_regex_elt_t *elts,
+    ngx_uint_t n);
 static void * ngx_libc_cdecl ngx_regex_malloc(size_t size);
 static void ngx_libc_cdecl ngx_regex_free(void *p);
 #if (NGX_HAVE_PCRE_JIT)
@@ -227,6 +235,374 @@ ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 }
 
 
+/*
+ * Regexes are tested in order and the first one that matches wins.
+ * Runs of regexes are combined into a single pattern
+ *
+ *     \A(?:(*MARK:0)(?s:.*?)(?:re0)|(*MARK:1)(?s:.*?)(?:re1)|...)
+ *
+ * which is anchored at the start of a subject, so its alternatives are
+ * tried in order just like separate regexes, and the mark of the matched
+ * alternative gives the index of the first matching regex.  Regexes which
+ * depend on group numbers or on the start of a match are not combined.
+ *
+ * A combined pattern loses the start of match optimizations of its
+ * regexes, such as a required character, and may backtrack much more
+ * than any of them.  It is therefore used for short subjects only, with
+ * a match limit proportional to the subject length, and the regexes are
+ * run one by one otherwise, so the regexes are copied.
+ */
+
+ngx_regex_set_t *
+ngx_regex_compile_sets(ngx_pool_t *pool, ngx_regex_elt_t *elts, ngx_uint_t n)
+{
+    ngx_uint_t        i, j;
+    ngx_array_t       sets;
+    ngx_regex_t      *re;
+    ngx_regex_elt_t  *copy;
+    ngx_regex_set_t  *set;
+
+    if (ngx_array_init(&sets, pool, 4, sizeof(ngx_regex_set_t)) != NGX_OK) {
+        return NULL;
+    }
+
+    copy = ngx_palloc(pool, n * sizeof(ngx_regex_elt_t));
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy(copy, elts, n * sizeof(ngx_regex_elt_t));
+    elts = copy;
+
+    i = 0;
+
+    while (i < n) {
+
+        for (j = i;
+             j < n && j - i < NGX_REGEX_SET_MAX
+             && ngx_regex_combinable(elts[j].name);
+             j++)
+        {
+            /* void */
+        }
+
+        re = (j - i > 1) ? ngx_regex_combine(pool, &elts[i], j - i) : NULL;
+
+        if (re) {
+            set = ngx_array_push(&sets);
+            if (set == NULL) {
+                return NULL;
+            }
+
+            set->regex = re;
+            set->name = (u_char *) "regex set";
+            set->elts = &elts[i];
+            set->nelts = j - i;
+
+            i = j;
+            continue;
+        }
+
+        if (j == i) {
+            j++;
+        }
+
+        while (i < j) {
+            set = ngx_array_push(&sets);
+            if (set == NULL) {
+                return NULL;
+            }
+
+            set->regex = elts[i].regex;
+            set->name = elts[i].name;
+            set->elts = &elts[i];
+            set->nelts = 1;
+
+            i++;
+        }
+    }
+
+    set = ngx_array_push(&sets);
+    if (set == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(set, sizeof(ngx_regex_set_t));
+
+    return sets.elts;
+}
+
+
+ngx_int_t
+ngx_regex_exec_sets(ngx_regex_set_t *sets, ngx_str_t *s, ngx_log_t *log)
+{
+    u_char           *name;
+    ngx_int_t         rc, i, n;
+    ngx_regex_set_t  *set;
+#if (defined PCRE_EXTRA_MARK)
+    u_char           *mark;
+    pcre_extra        extra;
+    unsigned long     limit;
+#endif
+
+    i = 0;
+
+    for (set = sets; set->nelts; set++) {
+
+#if (defined PCRE_EXTRA_MARK)
+
+        if (set->nelts > 1 && s->len <= NGX_REGEX_SET_SUBJECT) {
+
+            /* the shared study data are not modified */
+
+            if (set->regex->extra) {
+                extra = *set->regex->extra;
+
+            } else {
+                ngx_memzero(&extra, sizeof(pcre_extra));
+            }
+
+            limit = NGX_REGEX_SET_STEPS * (s->len + 1) * set->nelts;
+
+            if (!(extra.flags & PCRE_EXTRA_MATCH_LIMIT)
+                || extra.match_limit > limit)
+            {
+                extra.flags |= PCRE_EXTRA_MATCH_LIMIT;
+                extra.match_limit = limit;
+            }
+
+            mark = NULL;
+
+            extra.flags |= PCRE_EXTRA_MARK;
+            extra.mark = &mark;
+
+            rc = pcre_exec(set->regex->code, &extra, (const char *) s->data,
+                           s->len, 0, 0, NULL, 0);
+
+            if (rc == NGX_REGEX_NO_MATCHED) {
+                i += set->nelts;
+                continue;
+            }
+
+            if (rc >= 0) {
+                n = (mark == NULL) ? NGX_ERROR
+                                   : ngx_atoi(mark, ngx_strlen(mark));
+
+                if (n == NGX_ERROR || (ngx_uint_t) n >= set->nelts) {
+                    ngx_log_error(NGX_LOG_ALERT, log, 0,
+                                  "invalid mark in regex set on \"%V\"", s);
+                    return NGX_ERROR;
+                }
+
+                return i + n;
+            }
+
+            if (rc != PCRE_ERROR_MATCHLIMIT
+                && rc != PCRE_ERROR_RECURSIONLIMIT)
+            {
+                name = set->name;
+                goto failed;
+            }
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                           "regex set limit exceeded: %i on \"%V\"", rc, s);
+        }
+
+#endif
+
+        for (n = 0; n < (ngx_int_t) set->nelts; n++) {
+            rc = ngx_regex_exec(set->elts[n].regex, s, NULL, 0);
+
+            if (rc == NGX_REGEX_NO_MATCHED) {
+                continue;
+            }
+
+            if (rc < 0) {
+                name = set->elts[n].name;
+                goto failed;
+            }
+
+            return i + n;
+        }
+
+        i += set->nelts;
+    }
+
+    return NGX_DECLINED;
+
+failed:
+
+    ngx_log_error(NGX_LOG_ALERT, log, 0,
+                  ngx_regex_exec_n " failed: %i on \"%V\" using \"%s\"",
+                  rc, s, name);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_regex_combinable(u_char *p)
+{
+#if (defined PCRE_EXTRA_MARK)
+
+    for ( /* void */ ; *p; p++) {
+
+        switch (*p) {
+
+        case '\\':
+            p++;
+
+            /* backreferences and \G */
+
+            if ((*p >= '1' && *p <= '9')
+                || *p == 'g' || *p == 'k' || *p == 'G' || *p == '\0')
+            {
+                return 0;
+            }
+
+            break;
+
+        case '#':
+
+            /* a comment in the extended mode */
+
+            return 0;
+
+        case '(':
+
+            /* backtracking control verbs */
+
+            if (p[1] == '*') {
+                return 0;
+            }
+
+            if (p[1] != '?') {
+                break;
+            }
+
+            /* recursion, subroutine calls, conditions and callouts */
+
+            if ((p[2] >= '0' && p[2] <= '9')
+                || p[2] == 'R' || p[2] == '(' || p[2] == '&' || p[2] == '+'
+                || p[2] == 'C'
+                || (p[2] == 'P' && (p[3] == '=' || p[3] == '>'))
+                || (p[2] == '-' && p[3] >= '0' && p[3] <= '9'))
+            {
+                return 0;
+            }
+
+            break;
+        }
+    }
+
+    return 1;
+
+#else
+
+    return 0;
+
+#endif
+}
+
+
+static ngx_regex_t *
+ngx_regex_combine(ngx_pool_t *pool, ngx_regex_elt_t *elts, ngx_uint_t n)
+{
+    int                   first;
+    u_char               *p;
+    size_t                len;
+    ngx_uint_t            i;
+    unsigned long         options;
+    ngx_regex_compile_t   rc;
+    u_char                errstr[NGX_MAX_CONF_ERRSTR];
+
+    len = sizeof("\\A(?:)");
+
+    for (i = 0; i < n; i++) {
+        len += sizeof("|(*MARK:)(?s:(?:.*?\\v)?\?)(?:(?i))") - 1
+               + NGX_INT_T_LEN + ngx_strlen(elts[i].name);
+    }
+
+    p = ngx_pnalloc(pool, len);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pattern.data = p;
+
+    p = ngx_cpymem(p, "\\A(?:", sizeof("\\A(?:") - 1);
+
+    for (i = 0; i < n; i++) {
+
+        if (pcre_fullinfo(elts[i].regex->code, NULL, PCRE_INFO_OPTIONS,
+                          &options)
+            != 0)
+        {
+            return NULL;
+        }
+
+        if (i) {
+            *p++ = '|';
+        }
+
+        if (pcre_fullinfo(elts[i].regex->code, NULL, PCRE_INFO_FIRSTBYTE,
+                          &first)
+            != 0)
+        {
+            return NULL;
+        }
+
+        p = ngx_sprintf(p, "(*MARK:%ui)", i);
+
+        /*
+         * an anchored regex can match at the start of a subject only;
+         * a regex starting with ".*" or with "^" in the multiline mode
+         * can match at the start of a subject or after a newline only,
+         * and starting it at every position would rescan the rest of
+         * the subject from each of them; "\v" covers all newline types
+         */
+
+        if (options & PCRE_ANCHORED) {
+            /* void */
+
+        } else if (first == -1) {
+            p = ngx_cpymem(p, "(?s:(?:.*?\\v)?\?)",
+                           sizeof("(?s:(?:.*?\\v)?\?)") - 1);
+
+        } else {
+            p = ngx_cpymem(p, "(?s:.*?)", sizeof("(?s:.*?)") - 1);
+        }
+
+        p = ngx_cpymem(p, "(?:", sizeof("(?:") - 1);
+
+        if (options & PCRE_CASELESS) {
+            p = ngx_cpymem(p, "(?i)", sizeof("(?i)") - 1);
+        }
+
+        p = ngx_sprintf(p, "%s)", elts[i].name);
+    }
+
+    *p++ = ')';
+    *p = '\0';
+
+    rc.pattern.len = p - rc.pattern.data;
+    rc.pool = pool;
+    rc.options = PCRE_DUPNAMES;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    if (ngx_regex_compile(&rc) != NGX_OK) {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, pool->log, 0,
+                       "regex set is not used: %V", &rc.err);
+        return NULL;
+    }
+
+    return rc.regex;
+}
+
+
 static void * ngx_libc_cdecl
 ngx_regex_malloc(size_t size)
 {
@@ -46,6 +46,19 @@ typedef struct {
 } ngx_regex_elt_t;
 
 
+/*
+ * a run of consecutive regexes: either a single regex,
+ * or "nelts" regexes combined into one pattern
+ */
+
+typedef struct {
+    ngx_regex_t      *regex;
+    u_char           *name;
+    ngx_regex_elt_t  *elts;
+    ngx_uint_t        nelts;
+} ngx_regex_set_t;
+
+
 void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
@@ -56,5 +69,10 @@ ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
+ngx_regex_set_t *ngx_regex_compile_sets(ngx_pool_t *pool, ngx_regex_elt_t *elts,
+    ngx_uint_t n);
+ngx_int_t ngx_regex_exec_sets(ngx_regex_set_t *sets, ngx_str_t *s,
+    ngx_log_t *log);
+
 
 #endif /* _NGX_REGEX_H_INCLUDED_ */
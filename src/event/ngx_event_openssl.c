@@ -9,24 +9,97 @@
 #include <ngx_core.h>
 #include <ngx_event.h>
 
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
 
 #define NGX_SSL_PASSWORD_BUFFER_SIZE  4096
 
 
+/* a file buf that can be sent with SSL_sendfile() over kernel TLS */
+
+#define ngx_ssl_buf_in_file(c, b)                                             \
+    ((c)->ssl->sendfile && (b)->in_file && !ngx_buf_in_memory(b))
+
+
 typedef struct {
     ngx_uint_t  engine;   /* unsigned  engine:1; */
 } ngx_openssl_conf_t;
 
 
+typedef struct {
+    ngx_str_node_t              sn;
+    ngx_queue_t                 queue;
+
+    X509                       *cert;
+    STACK_OF(X509)             *chain;
+    EVP_PKEY                   *pkey;
+
+    time_t                      created;
+} ngx_ssl_cert_cache_node_t;
+
+
+struct ngx_ssl_cert_cache_s {
+    ngx_rbtree_t                rbtree;
+    ngx_rbtree_node_t           sentinel;
+    ngx_queue_t                 queue;
+
+    ngx_uint_t                  current;
+    ngx_uint_t                  max;
+    time_t                      valid;
+
+#if (NGX_THREADS)
+    ngx_thread_mutex_t          mutex;
+#endif
+
+    ngx_log_t                  *log;
+};
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_connection_t           *connection;
+    int                         n;
+    int                         sslerr;
+    ngx_err_t                   err;
+} ngx_ssl_handshake_ctx_t;
+
+#endif
+
+
 static int ngx_ssl_password_callback(char *buf, int size, int rwflag,
     void *userdata);
 static int ngx_ssl_verify_callback(int ok, X509_STORE_CTX *x509_store);
 static void ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where,
     int ret);
 static void ngx_ssl_passwords_cleanup(void *data);
+static ngx_ssl_cert_cache_node_t *ngx_ssl_cert_cache_load(ngx_log_t *log,
+    ngx_str_t *name, ngx_str_t *cert, ngx_str_t *key,
+    ngx_array_t *passwords);
+static ngx_int_t ngx_ssl_cert_cache_use(ngx_connection_t *c,
+    ngx_ssl_cert_cache_node_t *cn);
+static void ngx_ssl_cert_cache_free(ngx_ssl_cert_cache_t *cache,
+    ngx_ssl_cert_cache_node_t *cn);
+static void ngx_ssl_cert_cache_free_node(ngx_ssl_cert_cache_node_t *cn);
+static void ngx_ssl_cert_cache_cleanup(void *data);
+static ngx_int_t ngx_ssl_handshake_complete(ngx_connection_t *c);
+static ngx_int_t ngx_ssl_handshake_wait(ngx_connection_t *c, int sslerr);
+#ifdef SSL_CLIENT_HELLO_RETRY
+static ngx_int_t ngx_ssl_handshake_fetch_session(ngx_connection_t *c);
+#endif
+#if (NGX_THREADS)
+static ngx_int_t ngx_ssl_handshake_thread(ngx_connection_t *c);
+static void ngx_ssl_handshake_thread_handler(void *data, ngx_log_t *log);
+static void ngx_ssl_handshake_thread_event_handler(ngx_event_t *ev);
+#endif
 static void ngx_ssl_handshake_handler(ngx_event_t *ev);
 static ngx_int_t ngx_ssl_handle_recv(ngx_connection_t *c, int n);
 static void ngx_ssl_write_handler(ngx_event_t *wev);
+static u_char *ngx_ssl_record_end(ngx_connection_t *c, ngx_buf_t *buf);
+static ssize_t ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file,
+    size_t size);
 static void ngx_ssl_read_handler(ngx_event_t *rev);
 static void ngx_ssl_shutdown_handler(ngx_event_t *ev);
 static void ngx_ssl_connection_error(ngx_connection_t *c, int sslerr,
@@ -44,8 +117,12 @@ static ngx_ssl_session_t *ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 #endif
     u_char *id, int len, int *copy);
 static void ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess);
-static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n);
+#ifdef SSL_CLIENT_HELLO_RETRY
+static int ngx_ssl_client_hello_callback(ngx_ssl_conn_t *ssl_conn, int *al,
+    void *arg);
+#endif
+static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_shard_t *shard,
+    ngx_uint_t n);
 static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
@@ -53,6 +130,8 @@ static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
 static int ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
     HMAC_CTX *hctx, int enc);
+static ngx_int_t ngx_ssl_rotate_ticket_keys(
+    ngx_ssl_session_ticket_keys_t *keys, ngx_log_t *log);
 #endif
 
 #if OPENSSL_VERSION_NUMBER < 0x10002002L
@@ -104,6 +183,7 @@ int  ngx_ssl_connection_index;
 int  ngx_ssl_server_conf_index;
 int  ngx_ssl_session_cache_index;
 int  ngx_ssl_session_ticket_keys_index;
+int  ngx_ssl_session_store_index;
 int  ngx_ssl_certificate_index;
 int  ngx_ssl_next_certificate_index;
 int  ngx_ssl_stapling_index;
@@ -180,6 +260,14 @@ ngx_ssl_init(ngx_log_t *log)
         return NGX_ERROR;
     }
 
+    ngx_ssl_session_store_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL,
+                                                           NULL);
+    if (ngx_ssl_session_store_index == -1) {
+        ngx_ssl_error(NGX_LOG_ALERT, log, 0,
+                      "SSL_CTX_get_ex_new_index() failed");
+        return NGX_ERROR;
+    }
+
     ngx_ssl_certificate_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL,
                                                          NULL);
     if (ngx_ssl_certificate_index == -1) {
@@ -578,6 +666,10 @@ ngx_ssl_password_callback(char *buf, int size, int rwflag, void *userdata)
         return 0;
     }
 
+    if (pwd == NULL) {
+        return 0;
+    }
+
     if (pwd->len > (size_t) size) {
         ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
                       "password is truncated to %d bytes", size);
@@ -591,231 +683,631 @@ ngx_ssl_password_callback(char *buf, int size, int rwflag, void *userdata)
 }
 
 
-ngx_int_t
-ngx_ssl_ciphers(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *ciphers,
-    ngx_uint_t prefer_server_ciphers)
+ngx_ssl_cert_cache_t *
+ngx_ssl_cert_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t valid)
 {
-    if (SSL_CTX_set_cipher_list(ssl->ctx, (char *) ciphers->data) == 0) {
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "SSL_CTX_set_cipher_list(\"%V\") failed",
-                      ciphers);
-        return NGX_ERROR;
-    }
+    ngx_pool_cleanup_t    *cln;
+    ngx_ssl_cert_cache_t  *cache;
 
-    if (prefer_server_ciphers) {
-        SSL_CTX_set_options(ssl->ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+    cache = ngx_palloc(pool, sizeof(ngx_ssl_cert_cache_t));
+    if (cache == NULL) {
+        return NULL;
     }
 
-#if (OPENSSL_VERSION_NUMBER < 0x10100001L && !defined LIBRESSL_VERSION_NUMBER)
-    /* a temporary 512-bit RSA key is required for export versions of MSIE */
-    SSL_CTX_set_tmp_rsa_callback(ssl->ctx, ngx_ssl_rsa512_key_callback);
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->queue);
+
+    cache->current = 0;
+    cache->max = max;
+    cache->valid = valid;
+    cache->log = pool->log;
+
+#if (NGX_THREADS)
+    if (ngx_thread_mutex_create(&cache->mutex, pool->log) != NGX_OK) {
+        return NULL;
+    }
 #endif
 
-    return NGX_OK;
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_ssl_cert_cache_cleanup;
+    cln->data = cache;
+
+    return cache;
 }
 
 
 ngx_int_t
-ngx_ssl_client_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
-    ngx_int_t depth)
+ngx_ssl_connection_certificate(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords,
+    ngx_ssl_cert_cache_t *cache)
 {
-    STACK_OF(X509_NAME)  *list;
+    u_char                     *p;
+    uint32_t                    hash;
+    ngx_int_t                   rc;
+    ngx_str_t                   name;
+    ngx_ssl_cert_cache_node_t  *cn, *old;
 
-    SSL_CTX_set_verify(ssl->ctx, SSL_VERIFY_PEER, ngx_ssl_verify_callback);
-
-    SSL_CTX_set_verify_depth(ssl->ctx, depth);
-
-    if (cert->len == 0) {
-        return NGX_OK;
-    }
-
-    if (ngx_conf_full_name(cf->cycle, cert, 1) != NGX_OK) {
+    if (ngx_strncmp(key->data, "engine:", sizeof("engine:") - 1) == 0) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "loading \"engine:...\" certificate keys "
+                      "with variables is not supported");
         return NGX_ERROR;
     }
 
-    if (SSL_CTX_load_verify_locations(ssl->ctx, (char *) cert->data, NULL)
-        == 0)
-    {
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "SSL_CTX_load_verify_locations(\"%s\") failed",
-                      cert->data);
+    /* certificates are cached by the names of both files */
+
+    name.len = cert->len + 1 + key->len;
+    name.data = ngx_pnalloc(pool, name.len);
+    if (name.data == NULL) {
         return NGX_ERROR;
     }
 
-    /*
-     * SSL_CTX_load_verify_locations() may leave errors in the error queue
-     * while returning success
-     */
+    p = ngx_cpymem(name.data, cert->data, cert->len);
+    *p++ = '\0';
+    ngx_memcpy(p, key->data, key->len);
 
-    ERR_clear_error();
+    if (cache == NULL) {
+        cn = ngx_ssl_cert_cache_load(c->log, &name, cert, key, passwords);
+        if (cn == NULL) {
+            return NGX_ERROR;
+        }
 
-    list = SSL_load_client_CA_file((char *) cert->data);
+        rc = ngx_ssl_cert_cache_use(c, cn);
 
-    if (list == NULL) {
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "SSL_load_client_CA_file(\"%s\") failed", cert->data);
-        return NGX_ERROR;
+        ngx_ssl_cert_cache_free_node(cn);
+
+        return rc;
     }
 
-    /*
-     * before 0.9.7h and 0.9.8 SSL_load_client_CA_file()
-     * always leaved an error in the error queue
-     */
+    hash = ngx_crc32_long(name.data, name.len);
 
-    ERR_clear_error();
+#if (NGX_THREADS)
+    (void) ngx_thread_mutex_lock(&cache->mutex, c->log);
+#endif
 
-    SSL_CTX_set_client_CA_list(ssl->ctx, list);
+    cn = (ngx_ssl_cert_cache_node_t *)
+             ngx_str_rbtree_lookup(&cache->rbtree, &name, hash);
 
-    return NGX_OK;
-}
+    if (cn && ngx_time() - cn->created < cache->valid) {
 
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "ssl cert cache hit: \"%s\"", cert->data);
 
-ngx_int_t
-ngx_ssl_trusted_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
-    ngx_int_t depth)
-{
-    SSL_CTX_set_verify_depth(ssl->ctx, depth);
+        ngx_queue_remove(&cn->queue);
+        ngx_queue_insert_head(&cache->queue, &cn->queue);
 
-    if (cert->len == 0) {
-        return NGX_OK;
-    }
+        rc = ngx_ssl_cert_cache_use(c, cn);
 
-    if (ngx_conf_full_name(cf->cycle, cert, 1) != NGX_OK) {
-        return NGX_ERROR;
-    }
+#if (NGX_THREADS)
+        (void) ngx_thread_mutex_unlock(&cache->mutex, c->log);
+#endif
 
-    if (SSL_CTX_load_verify_locations(ssl->ctx, (char *) cert->data, NULL)
-        == 0)
-    {
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "SSL_CTX_load_verify_locations(\"%s\") failed",
-                      cert->data);
-        return NGX_ERROR;
+        return rc;
     }
 
-    /*
-     * SSL_CTX_load_verify_locations() may leave errors in the error queue
-     * while returning success
-     */
+#if (NGX_THREADS)
+    (void) ngx_thread_mutex_unlock(&cache->mutex, c->log);
+#endif
 
-    ERR_clear_error();
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl cert cache miss: \"%s\"", cert->data);
 
-    return NGX_OK;
-}
+    /* files are read without the lock */
 
+    cn = ngx_ssl_cert_cache_load(c->log, &name, cert, key, passwords);
+    if (cn == NULL) {
+        return NGX_ERROR;
+    }
 
-ngx_int_t
-ngx_ssl_crl(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *crl)
-{
-    X509_STORE   *store;
-    X509_LOOKUP  *lookup;
+    cn->sn.node.key = hash;
+    cn->created = ngx_time();
 
-    if (crl->len == 0) {
-        return NGX_OK;
-    }
+#if (NGX_THREADS)
+    (void) ngx_thread_mutex_lock(&cache->mutex, c->log);
+#endif
 
-    if (ngx_conf_full_name(cf->cycle, crl, 1) != NGX_OK) {
-        return NGX_ERROR;
+    old = (ngx_ssl_cert_cache_node_t *)
+              ngx_str_rbtree_lookup(&cache->rbtree, &name, hash);
+
+    if (old) {
+        ngx_ssl_cert_cache_free(cache, old);
     }
 
-    store = SSL_CTX_get_cert_store(ssl->ctx);
+    if (cache->current >= cache->max) {
 
-    if (store == NULL) {
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "SSL_CTX_get_cert_store() failed");
-        return NGX_ERROR;
-    }
+        /* evict the least recently used certificate */
 
-    lookup = X509_STORE_add_lookup(store, X509_LOOKUP_file());
+        old = ngx_queue_data(ngx_queue_last(&cache->queue),
+                             ngx_ssl_cert_cache_node_t, queue);
 
-    if (lookup == NULL) {
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "X509_STORE_add_lookup() failed");
-        return NGX_ERROR;
+        ngx_ssl_cert_cache_free(cache, old);
     }
 
-    if (X509_LOOKUP_load_file(lookup, (char *) crl->data, X509_FILETYPE_PEM)
-        == 0)
-    {
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "X509_LOOKUP_load_file(\"%s\") failed", crl->data);
-        return NGX_ERROR;
-    }
+    ngx_rbtree_insert(&cache->rbtree, &cn->sn.node);
+    ngx_queue_insert_head(&cache->queue, &cn->queue);
+    cache->current++;
 
-    X509_STORE_set_flags(store,
-                         X509_V_FLAG_CRL_CHECK|X509_V_FLAG_CRL_CHECK_ALL);
+    rc = ngx_ssl_cert_cache_use(c, cn);
 
-    return NGX_OK;
+#if (NGX_THREADS)
+    (void) ngx_thread_mutex_unlock(&cache->mutex, c->log);
+#endif
+
+    return rc;
 }
 
 
-static int
-ngx_ssl_verify_callback(int ok, X509_STORE_CTX *x509_store)
+static ngx_ssl_cert_cache_node_t *
+ngx_ssl_cert_cache_load(ngx_log_t *log, ngx_str_t *name, ngx_str_t *cert,
+    ngx_str_t *key, ngx_array_t *passwords)
 {
-#if (NGX_DEBUG)
-    char              *subject, *issuer;
-    int                err, depth;
-    X509              *cert;
-    X509_NAME         *sname, *iname;
-    ngx_connection_t  *c;
-    ngx_ssl_conn_t    *ssl_conn;
-
-    ssl_conn = X509_STORE_CTX_get_ex_data(x509_store,
-                                          SSL_get_ex_data_X509_STORE_CTX_idx());
-
-    c = ngx_ssl_get_connection(ssl_conn);
-
-    cert = X509_STORE_CTX_get_current_cert(x509_store);
-    err = X509_STORE_CTX_get_error(x509_store);
-    depth = X509_STORE_CTX_get_error_depth(x509_store);
+    BIO                        *bio;
+    X509                       *x509;
+    u_long                      n;
+    ngx_str_t                  *pwd;
+    ngx_uint_t                  tries;
+    ngx_ssl_cert_cache_node_t  *cn;
+
+    cn = ngx_alloc(sizeof(ngx_ssl_cert_cache_node_t) + name->len, log);
+    if (cn == NULL) {
+        return NULL;
+    }
 
-    sname = X509_get_subject_name(cert);
-    subject = sname ? X509_NAME_oneline(sname, NULL, 0) : "(none)";
+    ngx_memzero(cn, sizeof(ngx_ssl_cert_cache_node_t));
 
-    iname = X509_get_issuer_name(cert);
-    issuer = iname ? X509_NAME_oneline(iname, NULL, 0) : "(none)";
+    cn->sn.str.len = name->len;
+    cn->sn.str.data = (u_char *) &cn[1];
+    ngx_memcpy(cn->sn.str.data, name->data, name->len);
 
-    ngx_log_debug5(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                   "verify:%d, error:%d, depth:%d, "
-                   "subject:\"%s\", issuer:\"%s\"",
-                   ok, err, depth, subject, issuer);
+    bio = BIO_new_file((char *) cert->data, "r");
+    if (bio == NULL) {
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "BIO_new_file(\"%s\") failed", cert->data);
+        goto failed;
+    }
 
-    if (sname) {
-        OPENSSL_free(subject);
+    cn->cert = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL);
+    if (cn->cert == NULL) {
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "PEM_read_bio_X509_AUX(\"%s\") failed", cert->data);
+        BIO_free(bio);
+        goto failed;
     }
 
-    if (iname) {
-        OPENSSL_free(issuer);
+    cn->chain = sk_X509_new_null();
+    if (cn->chain == NULL) {
+        ngx_ssl_error(NGX_LOG_ERR, log, 0, "sk_X509_new_null() failed");
+        BIO_free(bio);
+        goto failed;
     }
-#endif
 
-    return 1;
-}
+    /* read rest of the chain */
 
+    for ( ;; ) {
 
-static void
-ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where, int ret)
-{
-    BIO               *rbio, *wbio;
-    ngx_connection_t  *c;
+        x509 = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+        if (x509 == NULL) {
+            n = ERR_peek_last_error();
 
-    if (where & SSL_CB_HANDSHAKE_START) {
-        c = ngx_ssl_get_connection((ngx_ssl_conn_t *) ssl_conn);
+            if (ERR_GET_LIB(n) == ERR_LIB_PEM
+                && ERR_GET_REASON(n) == PEM_R_NO_START_LINE)
+            {
+                /* end of file */
+                ERR_clear_error();
+                break;
+            }
 
-        if (c->ssl->handshaked) {
-            c->ssl->renegotiation = 1;
-            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL renegotiation");
+            /* some real error */
+
+            ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                          "PEM_read_bio_X509(\"%s\") failed", cert->data);
+            BIO_free(bio);
+            goto failed;
+        }
+
+        if (sk_X509_push(cn->chain, x509) == 0) {
+            ngx_ssl_error(NGX_LOG_ERR, log, 0, "sk_X509_push() failed");
+            X509_free(x509);
+            BIO_free(bio);
+            goto failed;
         }
     }
 
-    if ((where & SSL_CB_ACCEPT_LOOP) == SSL_CB_ACCEPT_LOOP) {
-        c = ngx_ssl_get_connection((ngx_ssl_conn_t *) ssl_conn);
+    BIO_free(bio);
 
-        if (!c->ssl->handshake_buffer_set) {
-            /*
-             * By default OpenSSL uses 4k buffer during a handshake,
-             * which is too low for long certificate chains and might
-             * result in extra round-trips.
+    bio = BIO_new_file((char *) key->data, "r");
+    if (bio == NULL) {
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "BIO_new_file(\"%s\") failed", key->data);
+        goto failed;
+    }
+
+    /*
+     * without passwords the callback is still set, so OpenSSL
+     * does not prompt for a password on the terminal
+     */
+
+    if (passwords) {
+        tries = passwords->nelts;
+        pwd = passwords->elts;
+
+    } else {
+        tries = 1;
+        pwd = NULL;
+    }
+
+    for ( ;; ) {
+
+        cn->pkey = PEM_read_bio_PrivateKey(bio, NULL,
+                                           ngx_ssl_password_callback, pwd);
+        if (cn->pkey) {
+            break;
+        }
+
+        if (--tries) {
+            ERR_clear_error();
+            (void) BIO_reset(bio);
+            pwd++;
+            continue;
+        }
+
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "PEM_read_bio_PrivateKey(\"%s\") failed", key->data);
+        BIO_free(bio);
+        goto failed;
+    }
+
+    BIO_free(bio);
+
+    return cn;
+
+failed:
+
+    ngx_ssl_cert_cache_free_node(cn);
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_ssl_cert_cache_use(ngx_connection_t *c, ngx_ssl_cert_cache_node_t *cn)
+{
+    /* the name starts with the certificate file name */
+
+    if (SSL_use_certificate(c->ssl->connection, cn->cert) == 0) {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                      "SSL_use_certificate(\"%s\") failed", cn->sn.str.data);
+        return NGX_ERROR;
+    }
+
+#ifdef SSL_CTRL_CHAIN
+
+    if (SSL_set1_chain(c->ssl->connection, cn->chain) == 0) {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                      "SSL_set1_chain(\"%s\") failed", cn->sn.str.data);
+        return NGX_ERROR;
+    }
+
+#endif
+
+    if (SSL_use_PrivateKey(c->ssl->connection, cn->pkey) == 0) {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                      "SSL_use_PrivateKey(\"%s\") failed", cn->sn.str.data);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_ssl_cert_cache_free(ngx_ssl_cert_cache_t *cache,
+    ngx_ssl_cert_cache_node_t *cn)
+{
+    ngx_rbtree_delete(&cache->rbtree, &cn->sn.node);
+    ngx_queue_remove(&cn->queue);
+    cache->current--;
+
+    ngx_ssl_cert_cache_free_node(cn);
+}
+
+
+static void
+ngx_ssl_cert_cache_free_node(ngx_ssl_cert_cache_node_t *cn)
+{
+    if (cn->cert) {
+        X509_free(cn->cert);
+    }
+
+    if (cn->chain) {
+        sk_X509_pop_free(cn->chain, X509_free);
+    }
+
+    if (cn->pkey) {
+        EVP_PKEY_free(cn->pkey);
+    }
+
+    ngx_free(cn);
+}
+
+
+static void
+ngx_ssl_cert_cache_cleanup(void *data)
+{
+    ngx_ssl_cert_cache_t  *cache = data;
+
+    ngx_queue_t                *q;
+    ngx_ssl_cert_cache_node_t  *cn;
+
+    while (!ngx_queue_empty(&cache->queue)) {
+        q = ngx_queue_head(&cache->queue);
+        cn = ngx_queue_data(q, ngx_ssl_cert_cache_node_t, queue);
+
+        ngx_ssl_cert_cache_free(cache, cn);
+    }
+
+#if (NGX_THREADS)
+    (void) ngx_thread_mutex_destroy(&cache->mutex, cache->log);
+#endif
+}
+
+
+ngx_int_t
+ngx_ssl_ciphers(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *ciphers,
+    ngx_uint_t prefer_server_ciphers)
+{
+    if (SSL_CTX_set_cipher_list(ssl->ctx, (char *) ciphers->data) == 0) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_set_cipher_list(\"%V\") failed",
+                      ciphers);
+        return NGX_ERROR;
+    }
+
+    if (prefer_server_ciphers) {
+        SSL_CTX_set_options(ssl->ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+    }
+
+#if (OPENSSL_VERSION_NUMBER < 0x10100001L && !defined LIBRESSL_VERSION_NUMBER)
+    /* a temporary 512-bit RSA key is required for export versions of MSIE */
+    SSL_CTX_set_tmp_rsa_callback(ssl->ctx, ngx_ssl_rsa512_key_callback);
+#endif
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl)
+{
+#if (defined SSL_OP_ENABLE_KTLS && defined BIO_get_ktls_send && !NGX_WIN32)
+
+    /*
+     * OpenSSL installs the keys into the kernel after the handshake
+     * if the kernel and the cipher allow it, ngx_ssl_handshake() then
+     * checks whether SSL_sendfile() can be used on the connection
+     */
+
+    SSL_CTX_set_options(ssl->ctx, SSL_OP_ENABLE_KTLS);
+
+#else
+
+    ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                  "kernel TLS is not supported by OpenSSL library used, "
+                  "ignored");
+
+#endif
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_client_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
+    ngx_int_t depth)
+{
+    STACK_OF(X509_NAME)  *list;
+
+    SSL_CTX_set_verify(ssl->ctx, SSL_VERIFY_PEER, ngx_ssl_verify_callback);
+
+    SSL_CTX_set_verify_depth(ssl->ctx, depth);
+
+    if (cert->len == 0) {
+        return NGX_OK;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, cert, 1) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (SSL_CTX_load_verify_locations(ssl->ctx, (char *) cert->data, NULL)
+        == 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_load_verify_locations(\"%s\") failed",
+                      cert->data);
+        return NGX_ERROR;
+    }
+
+    /*
+     * SSL_CTX_load_verify_locations() may leave errors in the error queue
+     * while returning success
+     */
+
+    ERR_clear_error();
+
+    list = SSL_load_client_CA_file((char *) cert->data);
+
+    if (list == NULL) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_load_client_CA_file(\"%s\") failed", cert->data);
+        return NGX_ERROR;
+    }
+
+    /*
+     * before 0.9.7h and 0.9.8 SSL_load_client_CA_file()
+     * always leaved an error in the error queue
+     */
+
+    ERR_clear_error();
+
+    SSL_CTX_set_client_CA_list(ssl->ctx, list);
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_trusted_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
+    ngx_int_t depth)
+{
+    SSL_CTX_set_verify_depth(ssl->ctx, depth);
+
+    if (cert->len == 0) {
+        return NGX_OK;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, cert, 1) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (SSL_CTX_load_verify_locations(ssl->ctx, (char *) cert->data, NULL)
+        == 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_load_verify_locations(\"%s\") failed",
+                      cert->data);
+        return NGX_ERROR;
+    }
+
+    /*
+     * SSL_CTX_load_verify_locations() may leave errors in the error queue
+     * while returning success
+     */
+
+    ERR_clear_error();
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_crl(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *crl)
+{
+    X509_STORE   *store;
+    X509_LOOKUP  *lookup;
+
+    if (crl->len == 0) {
+        return NGX_OK;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, crl, 1) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    store = SSL_CTX_get_cert_store(ssl->ctx);
+
+    if (store == NULL) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_get_cert_store() failed");
+        return NGX_ERROR;
+    }
+
+    lookup = X509_STORE_add_lookup(store, X509_LOOKUP_file());
+
+    if (lookup == NULL) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "X509_STORE_add_lookup() failed");
+        return NGX_ERROR;
+    }
+
+    if (X509_LOOKUP_load_file(lookup, (char *) crl->data, X509_FILETYPE_PEM)
+        == 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "X509_LOOKUP_load_file(\"%s\") failed", crl->data);
+        return NGX_ERROR;
+    }
+
+    X509_STORE_set_flags(store,
+                         X509_V_FLAG_CRL_CHECK|X509_V_FLAG_CRL_CHECK_ALL);
+
+    return NGX_OK;
+}
+
+
+static int
+ngx_ssl_verify_callback(int ok, X509_STORE_CTX *x509_store)
+{
+#if (NGX_DEBUG)
+    char              *subject, *issuer;
+    int                err, depth;
+    X509              *cert;
+    X509_NAME         *sname, *iname;
+    ngx_connection_t  *c;
+    ngx_ssl_conn_t    *ssl_conn;
+
+    ssl_conn = X509_STORE_CTX_get_ex_data(x509_store,
+                                          SSL_get_ex_data_X509_STORE_CTX_idx());
+
+    c = ngx_ssl_get_connection(ssl_conn);
+
+    cert = X509_STORE_CTX_get_current_cert(x509_store);
+    err = X509_STORE_CTX_get_error(x509_store);
+    depth = X509_STORE_CTX_get_error_depth(x509_store);
+
+    sname = X509_get_subject_name(cert);
+    subject = sname ? X509_NAME_oneline(sname, NULL, 0) : "(none)";
+
+    iname = X509_get_issuer_name(cert);
+    issuer = iname ? X509_NAME_oneline(iname, NULL, 0) : "(none)";
+
+    ngx_log_debug5(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "verify:%d, error:%d, depth:%d, "
+                   "subject:\"%s\", issuer:\"%s\"",
+                   ok, err, depth, subject, issuer);
+
+    if (sname) {
+        OPENSSL_free(subject);
+    }
+
+    if (iname) {
+        OPENSSL_free(issuer);
+    }
+#endif
+
+    return 1;
+}
+
+
+static void
+ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where, int ret)
+{
+    BIO               *rbio, *wbio;
+    ngx_connection_t  *c;
+
+    if (where & SSL_CB_HANDSHAKE_START) {
+        c = ngx_ssl_get_connection((ngx_ssl_conn_t *) ssl_conn);
+
+        if (c->ssl->handshaked) {
+            c->ssl->renegotiation = 1;
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL renegotiation");
+        }
+    }
+
+    if ((where & SSL_CB_ACCEPT_LOOP) == SSL_CB_ACCEPT_LOOP) {
+        c = ngx_ssl_get_connection((ngx_ssl_conn_t *) ssl_conn);
+
+        if (!c->ssl->handshake_buffer_set) {
+            /*
+             * By default OpenSSL uses 4k buffer during a handshake,
+             * which is too low for long certificate chains and might
+             * result in extra round-trips.
              *
              * To adjust a buffer size we detect that buffering was added
              * to write side of the connection by comparing rbio and wbio.
@@ -983,6 +1475,53 @@ cleanup:
 }
 
 
+ngx_array_t *
+ngx_ssl_preserve_passwords(ngx_conf_t *cf, ngx_array_t *passwords)
+{
+    ngx_str_t           *opwd, *pwd;
+    ngx_uint_t           i;
+    ngx_array_t         *pwds;
+    ngx_pool_cleanup_t  *cln;
+
+    /*
+     * passwords are read into the temporary pool, they are copied
+     * if certificates are loaded at run time
+     */
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    pwds = ngx_array_create(cf->pool, passwords->nelts, sizeof(ngx_str_t));
+
+    if (cln == NULL || pwds == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_ssl_passwords_cleanup;
+    cln->data = pwds;
+
+    opwd = passwords->elts;
+
+    for (i = 0; i < passwords->nelts; i++) {
+
+        pwd = ngx_array_push(pwds);
+        if (pwd == NULL) {
+            return NULL;
+        }
+
+        pwd->len = opwd[i].len;
+        pwd->data = ngx_pnalloc(cf->pool, pwd->len);
+
+        if (pwd->data == NULL) {
+            pwds->nelts--;
+            return NULL;
+        }
+
+        ngx_memcpy(pwd->data, opwd[i].data, opwd[i].len);
+    }
+
+    return pwds;
+}
+
+
 static void
 ngx_ssl_passwords_cleanup(void *data)
 {
@@ -1133,6 +1672,13 @@ ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
 
     sc->buffer = ((flags & NGX_SSL_BUFFER) != 0);
     sc->buffer_size = ssl->buffer_size;
+    sc->dyn_rec = ssl->dyn_rec;
+
+#if (NGX_THREADS)
+    if (!(flags & NGX_SSL_CLIENT)) {
+        sc->thread_pool = ssl->thread_pool;
+    }
+#endif
 
     sc->session_ctx = ssl->ctx;
 
@@ -1186,6 +1732,12 @@ ngx_ssl_handshake(ngx_connection_t *c)
     int        n, sslerr;
     ngx_err_t  err;
 
+#if (NGX_THREADS)
+    if (c->ssl->thread_pool) {
+        return ngx_ssl_handshake_thread(c);
+    }
+#endif
+
     ngx_ssl_clear_error(c->log);
 
     n = SSL_do_handshake(c->ssl->connection);
@@ -1193,139 +1745,377 @@ ngx_ssl_handshake(ngx_connection_t *c)
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_do_handshake: %d", n);
 
     if (n == 1) {
+        return ngx_ssl_handshake_complete(c);
+    }
 
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    sslerr = SSL_get_error(c->ssl->connection, n);
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+
+    if (sslerr == SSL_ERROR_WANT_READ || sslerr == SSL_ERROR_WANT_WRITE) {
+        return ngx_ssl_handshake_wait(c, sslerr);
+    }
+
+#ifdef SSL_CLIENT_HELLO_RETRY
+
+    if (sslerr == SSL_ERROR_WANT_CLIENT_HELLO_CB) {
+        return ngx_ssl_handshake_fetch_session(c);
+    }
 
-#if (NGX_DEBUG)
-        {
-        char         buf[129], *s, *d;
-#if OPENSSL_VERSION_NUMBER >= 0x10000000L
-        const
 #endif
-        SSL_CIPHER  *cipher;
 
-        cipher = SSL_get_current_cipher(c->ssl->connection);
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
 
-        if (cipher) {
-            SSL_CIPHER_description(cipher, &buf[1], 128);
+    c->ssl->no_wait_shutdown = 1;
+    c->ssl->no_send_shutdown = 1;
+    c->read->eof = 1;
 
-            for (s = &buf[1], d = buf; *s; s++) {
-                if (*s == ' ' && *d == ' ') {
-                    continue;
-                }
+    if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
+        ngx_connection_error(c, err,
+                             "peer closed connection in SSL handshake");
 
-                if (*s == LF || *s == CR) {
-                    continue;
-                }
+        return NGX_ERROR;
+    }
+
+    c->read->error = 1;
+
+    ngx_ssl_connection_error(c, sslerr, err, "SSL_do_handshake() failed");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_ssl_handshake_complete(ngx_connection_t *c)
+{
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_DEBUG)
+    {
+    char         buf[129], *s, *d;
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
+    const
+#endif
+    SSL_CIPHER  *cipher;
+
+    cipher = SSL_get_current_cipher(c->ssl->connection);
+
+    if (cipher) {
+        SSL_CIPHER_description(cipher, &buf[1], 128);
 
-                *++d = *s;
+        for (s = &buf[1], d = buf; *s; s++) {
+            if (*s == ' ' && *d == ' ') {
+                continue;
             }
 
-            if (*d != ' ') {
-                d++;
+            if (*s == LF || *s == CR) {
+                continue;
             }
 
-            *d = '\0';
+            *++d = *s;
+        }
 
-            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                           "SSL: %s, cipher: \"%s\"",
-                           SSL_get_version(c->ssl->connection), &buf[1]);
+        if (*d != ' ') {
+            d++;
+        }
 
-            if (SSL_session_reused(c->ssl->connection)) {
-                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                               "SSL reused session");
-            }
+        *d = '\0';
 
-        } else {
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL: %s, cipher: \"%s\"",
+                       SSL_get_version(c->ssl->connection), &buf[1]);
+
+        if (SSL_session_reused(c->ssl->connection)) {
             ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                           "SSL no shared ciphers");
-        }
+                           "SSL reused session");
         }
+
+    } else {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL no shared ciphers");
+    }
+    }
 #endif
 
-        c->ssl->handshaked = 1;
+    c->ssl->handshaked = 1;
+
+    if (c->ssl->fetched_session) {
+        ngx_ssl_free_session(c->ssl->fetched_session);
+        c->ssl->fetched_session = NULL;
+    }
+
+#if (defined SSL_OP_ENABLE_KTLS && defined BIO_get_ktls_send && !NGX_WIN32)
+
+    if (BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "BIO_get_ktls_send(): 1");
+        c->ssl->sendfile = 1;
+    }
+
+#endif
 
-        c->recv = ngx_ssl_recv;
-        c->send = ngx_ssl_write;
-        c->recv_chain = ngx_ssl_recv_chain;
-        c->send_chain = ngx_ssl_send_chain;
+    c->recv = ngx_ssl_recv;
+    c->send = ngx_ssl_write;
+    c->recv_chain = ngx_ssl_recv_chain;
+    c->send_chain = ngx_ssl_send_chain;
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 #ifdef SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS
 
-        /* initial handshake done, disable renegotiation (CVE-2009-3555) */
-        if (c->ssl->connection->s3) {
-            c->ssl->connection->s3->flags |= SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS;
-        }
+    /* initial handshake done, disable renegotiation (CVE-2009-3555) */
+    if (c->ssl->connection->s3) {
+        c->ssl->connection->s3->flags |= SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS;
+    }
 
 #endif
 #endif
 
-        return NGX_OK;
-    }
-
-    sslerr = SSL_get_error(c->ssl->connection, n);
+    return NGX_OK;
+}
 
-    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
 
+static ngx_int_t
+ngx_ssl_handshake_wait(ngx_connection_t *c, int sslerr)
+{
     if (sslerr == SSL_ERROR_WANT_READ) {
         c->read->ready = 0;
-        c->read->handler = ngx_ssl_handshake_handler;
-        c->write->handler = ngx_ssl_handshake_handler;
 
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    } else {
+        c->write->ready = 0;
+    }
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    c->read->handler = ngx_ssl_handshake_handler;
+    c->write->handler = ngx_ssl_handshake_handler;
 
-        return NGX_AGAIN;
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-    if (sslerr == SSL_ERROR_WANT_WRITE) {
-        c->write->ready = 0;
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+#ifdef SSL_CLIENT_HELLO_RETRY
+
+static ngx_int_t
+ngx_ssl_handshake_fetch_session(ngx_connection_t *c)
+{
+    ngx_int_t  rc;
+
+    rc = ngx_ssl_session_store_fetch(c);
+
+    if (rc == NGX_DECLINED) {
+        /* the handshake continues without a session */
+        return ngx_ssl_handshake(c);
+    }
+
+    if (rc == NGX_AGAIN) {
         c->read->handler = ngx_ssl_handshake_handler;
         c->write->handler = ngx_ssl_handshake_handler;
+    }
 
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    return rc;
+}
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+#endif
+
+
+#if (NGX_THREADS)
+
+/*
+ * The handshake steps run in a thread pool, so the private key operations
+ * do not block the worker.  Nothing else touches the connection meanwhile:
+ * the event handlers only note that the socket became ready.
+ *
+ * The OpenSSL callbacks run in the thread as well.  The server name,
+ * ALPN/NPN and ticket key callbacks only read the configuration and
+ * allocate from the connection pool.  The shared session cache is locked
+ * with the zone mutex: it is taken with an atomic compare-and-set, so it
+ * excludes threads of a worker as it excludes other processes.  The
+ * certificate status callback copies the OCSP response under a lock and
+ * leaves the response refresh to the worker, as it creates connections
+ * and timers.
+ */
+
+static ngx_int_t
+ngx_ssl_handshake_thread(ngx_connection_t *c)
+{
+    ngx_thread_task_t        *task;
+    ngx_ssl_handshake_ctx_t  *ctx;
+
+    task = c->ssl->handshake_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(c->pool, sizeof(ngx_ssl_handshake_ctx_t));
+        if (task == NULL) {
             return NGX_ERROR;
         }
 
-        return NGX_AGAIN;
+        task->handler = ngx_ssl_handshake_thread_handler;
+
+        c->ssl->handshake_task = task;
     }
 
-    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+    ctx = task->ctx;
+    ctx->connection = c;
 
-    c->ssl->no_wait_shutdown = 1;
-    c->ssl->no_send_shutdown = 1;
-    c->read->eof = 1;
+    task->event.data = c;
+    task->event.handler = ngx_ssl_handshake_thread_event_handler;
+    task->event.log = c->log;
+
+    c->read->ready = 0;
+    c->write->ready = 0;
+    c->read->handler = ngx_ssl_handshake_handler;
+    c->write->handler = ngx_ssl_handshake_handler;
+
+    /* the flag is set before posting, the callbacks test it in the thread */
+
+    c->ssl->handshake_in_thread = 1;
+
+    if (ngx_thread_task_post(c->ssl->thread_pool, task) != NGX_OK) {
+        c->ssl->handshake_in_thread = 0;
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_ssl_handshake_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_ssl_handshake_ctx_t *ctx = data;
+
+    ngx_connection_t  *c;
+
+    c = ctx->connection;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "SSL handshake thread handler");
+
+    ngx_ssl_clear_error(c->log);
+
+    ngx_set_errno(0);
+
+    ctx->n = SSL_do_handshake(c->ssl->connection);
+
+    if (ctx->n == 1) {
+        return;
+    }
+
+    ctx->sslerr = SSL_get_error(c->ssl->connection, ctx->n);
+    ctx->err = (ctx->sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    if (ctx->sslerr == SSL_ERROR_WANT_READ
+        || ctx->sslerr == SSL_ERROR_WANT_WRITE)
+    {
+        return;
+    }
+
+#ifdef SSL_CLIENT_HELLO_RETRY
+    if (ctx->sslerr == SSL_ERROR_WANT_CLIENT_HELLO_CB) {
+        return;
+    }
+#endif
+
+    if (ERR_peek_error() == 0) {
+        ctx->sslerr = SSL_ERROR_ZERO_RETURN;
+        return;
+    }
+
+    /* the OpenSSL error queue is per thread, so the error is logged here */
+
+    ngx_ssl_connection_error(c, ctx->sslerr, ctx->err,
+                             "SSL_do_handshake() failed");
+}
+
+
+static void
+ngx_ssl_handshake_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_int_t                 rc;
+    ngx_connection_t         *c;
+    ngx_ssl_handshake_ctx_t  *ctx;
+
+    c = ev->data;
+    ctx = c->ssl->handshake_task->ctx;
+
+    c->ssl->handshake_in_thread = 0;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL_do_handshake in thread: %d, SSL_get_error: %d",
+                   ctx->n, ctx->n == 1 ? 0 : ctx->sslerr);
+
+    if (c->ssl->pending_session) {
+        ngx_ssl_session_store_save(c, c->ssl->pending_session);
+        ngx_ssl_free_session(c->ssl->pending_session);
+        c->ssl->pending_session = NULL;
+    }
+
+    if (c->ssl->pending_staple) {
+        ngx_ssl_stapling_pending(c);
+    }
+
+    if (ctx->n == 1) {
+        rc = ngx_ssl_handshake_complete(c);
+
+    } else if (ctx->sslerr == SSL_ERROR_WANT_READ
+               || ctx->sslerr == SSL_ERROR_WANT_WRITE)
+    {
+        if (c->read->timedout) {
+            c->ssl->handler(c);
+            return;
+        }
+
+        if ((ctx->sslerr == SSL_ERROR_WANT_READ && c->read->ready)
+            || (ctx->sslerr == SSL_ERROR_WANT_WRITE && c->write->ready))
+        {
+            /* the socket became ready while the thread was running */
+            rc = ngx_ssl_handshake_thread(c);
+
+        } else {
+            rc = ngx_ssl_handshake_wait(c, ctx->sslerr);
+        }
+
+#ifdef SSL_CLIENT_HELLO_RETRY
+    } else if (ctx->sslerr == SSL_ERROR_WANT_CLIENT_HELLO_CB) {
+        rc = ngx_ssl_handshake_fetch_session(c);
+#endif
+
+    } else {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+        c->read->eof = 1;
 
-    if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
-        ngx_connection_error(c, err,
-                             "peer closed connection in SSL handshake");
+        if (ctx->sslerr == SSL_ERROR_ZERO_RETURN) {
+            ngx_connection_error(c, ctx->err,
+                                 "peer closed connection in SSL handshake");
 
-        return NGX_ERROR;
-    }
+        } else {
+            c->read->error = 1;
+        }
 
-    c->read->error = 1;
+        rc = NGX_ERROR;
+    }
 
-    ngx_ssl_connection_error(c, sslerr, err, "SSL_do_handshake() failed");
+    if (rc == NGX_AGAIN) {
+        return;
+    }
 
-    return NGX_ERROR;
+    c->ssl->handler(c);
 }
 
+#endif
+
 
 static void
 ngx_ssl_handshake_handler(ngx_event_t *ev)
@@ -1337,6 +2127,24 @@ ngx_ssl_handshake_handler(ngx_event_t *ev)
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "SSL handshake handler: %d", ev->write);
 
+#if (NGX_THREADS)
+
+    if (c->ssl->handshake_in_thread) {
+
+        /* the result and a timeout are handled on the thread completion */
+
+        return;
+    }
+
+#endif
+
+    if (c->ssl->session_fetching) {
+
+        /* the handshake is continued when the session lookup is finished */
+
+        return;
+    }
+
     if (ev->timedout) {
         c->ssl->handler(c);
         return;
@@ -1605,6 +2413,7 @@ ngx_chain_t *
 ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 {
     int          n;
+    u_char      *end;
     ngx_uint_t   flush;
     ssize_t      send, size;
     ngx_buf_t   *buf;
@@ -1617,6 +2426,28 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
+            if (ngx_ssl_buf_in_file(c, in->buf)) {
+                size = (ssize_t) (in->buf->file_last - in->buf->file_pos);
+
+                n = ngx_ssl_sendfile(c, in->buf, size);
+
+                if (n == NGX_ERROR) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                if (n == NGX_AGAIN) {
+                    return in;
+                }
+
+                in->buf->file_pos += n;
+
+                if (in->buf->file_pos == in->buf->file_last) {
+                    in = in->next;
+                }
+
+                continue;
+            }
+
             n = ngx_ssl_write(c, in->buf->pos, in->buf->last - in->buf->pos);
 
             if (n == NGX_ERROR) {
@@ -1671,7 +2502,9 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 
     for ( ;; ) {
 
-        while (in && buf->last < buf->end && send < limit) {
+        end = ngx_ssl_record_end(c, buf);
+
+        while (in && buf->last < end && send < limit) {
             if (in->buf->last_buf || in->buf->flush) {
                 flush = 1;
             }
@@ -1681,10 +2514,18 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
+            if (ngx_ssl_buf_in_file(c, in->buf)) {
+
+                /* the buffered data go first, then the file is sent */
+
+                flush = 1;
+                break;
+            }
+
             size = in->buf->last - in->buf->pos;
 
-            if (size > buf->end - buf->last) {
-                size = buf->end - buf->last;
+            if (size > end - buf->last) {
+                size = end - buf->last;
             }
 
             if (send + size > limit) {
@@ -1705,12 +2546,55 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
             }
         }
 
-        if (!flush && send < limit && buf->last < buf->end) {
+        if (!flush && send < limit && buf->last < end) {
             break;
         }
 
         size = buf->last - buf->pos;
 
+        if (size == 0 && in && send < limit && ngx_ssl_buf_in_file(c, in->buf))
+        {
+            size = (ssize_t) (in->buf->file_last - in->buf->file_pos);
+
+            if (send + size > limit) {
+                size = (ssize_t) (limit - send);
+            }
+
+            n = ngx_ssl_sendfile(c, in->buf, size);
+
+            if (n == NGX_ERROR) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            if (n == NGX_AGAIN) {
+                break;
+            }
+
+            in->buf->file_pos += n;
+            send += n;
+
+            c->ssl->dyn_rec_sent += n;
+            c->ssl->dyn_rec_last_write = ngx_current_msec;
+
+            if (in->buf->file_pos == in->buf->file_last) {
+                in = in->next;
+            }
+
+            if (n < size) {
+                /* the socket buffer is full, as with plain sendfile() */
+                c->write->ready = 0;
+                break;
+            }
+
+            flush = 0;
+
+            if (in == NULL || send == limit) {
+                break;
+            }
+
+            continue;
+        }
+
         if (size == 0) {
             buf->flush = 0;
             c->buffered &= ~NGX_SSL_BUFFERED;
@@ -1729,6 +2613,9 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 
         buf->pos += n;
 
+        c->ssl->dyn_rec_sent += n;
+        c->ssl->dyn_rec_last_write = ngx_current_msec;
+
         if (n < size) {
             break;
         }
@@ -1756,6 +2643,43 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 }
 
 
+/*
+ * Dynamic record sizing: after the handshake or an idle period the data
+ * are sent in small records, each fitting into a single TCP segment,
+ * so a client can start processing before the whole congestion window
+ * arrives.  After the threshold is sent the full buffer is used again.
+ */
+
+static u_char *
+ngx_ssl_record_end(ngx_connection_t *c, ngx_buf_t *buf)
+{
+    u_char                *end;
+    ngx_ssl_connection_t  *sc;
+
+    sc = c->ssl;
+
+    if (sc->dyn_rec.size_lo == 0) {
+        return buf->end;
+    }
+
+    if (ngx_current_msec - sc->dyn_rec_last_write > sc->dyn_rec.timeout) {
+        sc->dyn_rec_sent = 0;
+    }
+
+    if (sc->dyn_rec_sent >= sc->dyn_rec.threshold
+        || sc->dyn_rec.size_lo >= (size_t) (buf->end - buf->start))
+    {
+        return buf->end;
+    }
+
+    end = buf->start + sc->dyn_rec.size_lo;
+
+    /* the data already buffered with a larger record size stay */
+
+    return ngx_max(end, buf->last);
+}
+
+
 ssize_t
 ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
 {
@@ -1835,6 +2759,117 @@ ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
 }
 
 
+static ssize_t
+ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file, size_t size)
+{
+#if (defined SSL_OP_ENABLE_KTLS && defined BIO_get_ktls_send && !NGX_WIN32)
+
+    int            sslerr;
+    ossl_ssize_t   n;
+    ngx_err_t      err;
+
+    ngx_ssl_clear_error(c->log);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL to sendfile: @%O %uz", file->file_pos, size);
+
+    ngx_set_errno(0);
+
+    n = SSL_sendfile(c->ssl->connection, file->file->fd, file->file_pos,
+                     size, 0);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_sendfile: %z", n);
+
+    if (n > 0) {
+
+        if (c->ssl->saved_read_handler) {
+
+            c->read->handler = c->ssl->saved_read_handler;
+            c->ssl->saved_read_handler = NULL;
+            c->read->ready = 1;
+
+            if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_post_event(c->read, &ngx_posted_events);
+        }
+
+        c->sent += n;
+
+        return n;
+    }
+
+    if (n == 0) {
+
+        /*
+         * if sendfile returns zero, then someone has truncated the file,
+         * so the offset became beyond the end of the file
+         */
+
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL_sendfile() reported that \"%s\" was truncated at %O",
+                      file->file->name.data, file->file_pos);
+
+        return NGX_ERROR;
+    }
+
+    sslerr = SSL_get_error(c->ssl->connection, n);
+
+    if (sslerr == SSL_ERROR_SSL
+        && ERR_GET_REASON(ERR_peek_error()) == SSL_R_UNINITIALIZED
+        && ngx_errno != 0)
+    {
+        /* OpenSSL does not return SSL_ERROR_SYSCALL on sendfile() errors */
+        sslerr = SSL_ERROR_SYSCALL;
+    }
+
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+
+    if (sslerr == SSL_ERROR_WANT_WRITE
+        || (sslerr == SSL_ERROR_SYSCALL && err == NGX_EAGAIN))
+    {
+        c->write->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    if (sslerr == SSL_ERROR_WANT_READ) {
+
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "peer started SSL renegotiation");
+
+        c->read->ready = 0;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (c->ssl->saved_read_handler == NULL) {
+            c->ssl->saved_read_handler = c->read->handler;
+            c->read->handler = ngx_ssl_read_handler;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    c->ssl->no_wait_shutdown = 1;
+    c->ssl->no_send_shutdown = 1;
+    c->write->error = 1;
+
+    ngx_ssl_connection_error(c, sslerr, err, "SSL_sendfile() failed");
+
+#else
+
+    ngx_log_error(NGX_LOG_ALERT, c->log, 0, "SSL_sendfile() not available");
+
+#endif
+
+    return NGX_ERROR;
+}
+
+
 static void
 ngx_ssl_read_handler(ngx_event_t *rev)
 {
@@ -1854,6 +2889,20 @@ ngx_ssl_free_buffer(ngx_connection_t *c)
             c->ssl->buf->start = NULL;
         }
     }
+
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined LIBRESSL_VERSION_NUMBER)
+
+    /*
+     * SSL_MODE_RELEASE_BUFFERS does not always drop the read buffer,
+     * the library allocates the buffers again on the next read or write
+     */
+
+    if (SSL_free_buffers(c->ssl->connection) == 0) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL buffers are in use");
+    }
+
+#endif
 }
 
 
@@ -1870,6 +2919,10 @@ ngx_ssl_shutdown(ngx_connection_t *c)
          * Avoid calling SSL_shutdown() if handshake wasn't completed.
          */
 
+        if (c->ssl->fetched_session) {
+            ngx_ssl_free_session(c->ssl->fetched_session);
+        }
+
         SSL_free(c->ssl->connection);
         c->ssl = NULL;
 
@@ -2050,6 +3103,9 @@ ngx_ssl_connection_error(ngx_connection_t *c, int sslerr, ngx_err_t err,
 #endif
 #ifdef SSL_R_INAPPROPRIATE_FALLBACK
             || n == SSL_R_INAPPROPRIATE_FALLBACK                     /*  373 */
+#endif
+#ifdef SSL_R_CERT_CB_ERROR
+            || n == SSL_R_CERT_CB_ERROR                              /*  377 */
 #endif
             || n == 1000 /* SSL_R_SSLV3_ALERT_CLOSE_NOTIFY */
 #ifdef SSL_R_SSLV3_ALERT_UNEXPECTED_MESSAGE
@@ -2326,55 +3382,158 @@ ngx_ssl_session_id_context(ngx_ssl_t *ssl, ngx_str_t *sess_ctx)
 
 failed:
 
-    EVP_MD_CTX_destroy(md);
+    EVP_MD_CTX_destroy(md);
+
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    u_char                         *p;
+    size_t                          len, size;
+    ngx_uint_t                      i, n, pages, *shards;
+    ngx_slab_page_t                *page;
+    ngx_slab_pool_t                *shpool, *sp;
+    ngx_ssl_session_cache_t        *cache;
+    ngx_ssl_session_cache_shard_t  *shard;
+
+    /* the number of shards is passed from the configuration */
+
+    shards = shm_zone->data;
+    n = shards ? *shards : 1;
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+    /* the shard mutexes would need their own lock files */
+    n = 1;
+#endif
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (data || shm_zone->shm.exists) {
+        cache = data ? data : shpool->data;
+
+        if (cache->nshards != n) {
+            ngx_log_error(NGX_LOG_NOTICE, shm_zone->shm.log, 0,
+                          "SSL session shared cache \"%V\" keeps %ui "
+                          "shards instead of %ui until it is recreated",
+                          &shm_zone->shm.name, cache->nshards, n);
+        }
+
+        shm_zone->data = cache;
+        return NGX_OK;
+    }
+
+    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t));
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = cache;
+    shm_zone->data = cache;
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+    cache->ticket_keys_n = 0;
+#endif
+
+    len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in SSL session shared cache \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shpool->log_nomem = 0;
+
+    cache->shards = ngx_slab_alloc(shpool,
+                                   n * sizeof(ngx_ssl_session_cache_shard_t));
+    if (cache->shards == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->nshards = n;
+
+    /*
+     * the shards split the free pages of the zone between own slab pools,
+     * so sessions in different shards are allocated and expired under
+     * different mutexes; the pages are taken with a single allocation
+     * of the largest free run, and each shard pays for its own slab pool
+     * header and page descriptors out of its part
+     */
+
+    p = NULL;
+    size = 0;
+    pages = 0;
+
+    if (n > 1) {
+        for (page = shpool->free.next;
+             page != &shpool->free;
+             page = page->next)
+        {
+            if (page->slab > pages) {
+                pages = page->slab;
+            }
+        }
+
+        if (pages / n < 8) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "SSL session shared cache \"%V\" is too small "
+                          "for %ui shards", &shm_zone->shm.name, n);
+            return NGX_ERROR;
+        }
+
+        p = ngx_slab_alloc(shpool, pages << ngx_pagesize_shift);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        size = (pages / n) << ngx_pagesize_shift;
+    }
 
-    return NGX_ERROR;
-}
+    for (i = 0; i < n; i++) {
+        shard = &cache->shards[i];
 
+        if (n == 1) {
+            sp = shpool;
 
-ngx_int_t
-ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
-{
-    size_t                    len;
-    ngx_slab_pool_t          *shpool;
-    ngx_ssl_session_cache_t  *cache;
+        } else {
+            if (i == n - 1) {
 
-    if (data) {
-        shm_zone->data = data;
-        return NGX_OK;
-    }
+                /* the last shard takes the pages left after the division */
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+                size = (pages << ngx_pagesize_shift) - i * size;
+            }
 
-    if (shm_zone->shm.exists) {
-        shm_zone->data = shpool->data;
-        return NGX_OK;
-    }
+            sp = (ngx_slab_pool_t *) p;
 
-    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t));
-    if (cache == NULL) {
-        return NGX_ERROR;
-    }
+            sp->end = p + size;
+            sp->min_shift = 3;
+            sp->addr = p;
 
-    shpool->data = cache;
-    shm_zone->data = cache;
+            if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+                return NGX_ERROR;
+            }
 
-    ngx_rbtree_init(&cache->session_rbtree, &cache->sentinel,
-                    ngx_ssl_session_rbtree_insert_value);
+            ngx_slab_init(sp);
 
-    ngx_queue_init(&cache->expire_queue);
+            sp->data = cache;
+            sp->log_ctx = shpool->log_ctx;
+            sp->log_nomem = 0;
 
-    len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
+            p += size;
+        }
 
-    shpool->log_ctx = ngx_slab_alloc(shpool, len);
-    if (shpool->log_ctx == NULL) {
-        return NGX_ERROR;
-    }
+        shard->shpool = sp;
 
-    ngx_sprintf(shpool->log_ctx, " in SSL session shared cache \"%V\"%Z",
-                &shm_zone->shm.name);
+        ngx_rbtree_init(&shard->session_rbtree, &shard->sentinel,
+                        ngx_ssl_session_rbtree_insert_value);
 
-    shpool->log_nomem = 0;
+        ngx_queue_init(&shard->expire_queue);
+    }
 
     return NGX_OK;
 }
@@ -2400,17 +3559,52 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 static int
 ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 {
-    int                       len;
-    u_char                   *p, *id, *cached_sess, *session_id;
-    uint32_t                  hash;
-    SSL_CTX                  *ssl_ctx;
-    unsigned int              session_id_length;
-    ngx_shm_zone_t           *shm_zone;
-    ngx_connection_t         *c;
-    ngx_slab_pool_t          *shpool;
-    ngx_ssl_sess_id_t        *sess_id;
-    ngx_ssl_session_cache_t  *cache;
-    u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
+    int                             len;
+    u_char                         *p, *id, *cached_sess, *session_id;
+    uint32_t                        hash;
+    SSL_CTX                        *ssl_ctx;
+    unsigned int                    session_id_length;
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_connection_t               *c;
+    ngx_slab_pool_t                *shpool;
+    ngx_ssl_sess_id_t              *sess_id;
+    ngx_ssl_session_cache_t        *cache;
+    ngx_ssl_session_cache_shard_t  *shard;
+    u_char                          buf[NGX_SSL_MAX_SESSION_SIZE];
+
+    c = ngx_ssl_get_connection(ssl_conn);
+
+    ssl_ctx = c->ssl->session_ctx;
+
+    if (SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_store_index)) {
+
+#if (NGX_THREADS && defined SSL_CLIENT_HELLO_RETRY)
+
+        if (c->ssl->handshake_in_thread) {
+
+            /* the session is saved when the handshake step is completed */
+
+            if (c->ssl->pending_session) {
+                ngx_ssl_free_session(c->ssl->pending_session);
+            }
+
+            SSL_SESSION_up_ref(sess);
+            c->ssl->pending_session = sess;
+
+        } else {
+            ngx_ssl_session_store_save(c, sess);
+        }
+
+#else
+        ngx_ssl_session_store_save(c, sess);
+#endif
+    }
+
+    shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
+
+    if (shm_zone == NULL) {
+        return 0;
+    }
 
     len = i2d_SSL_SESSION(sess, NULL);
 
@@ -2423,18 +3617,27 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     p = buf;
     i2d_SSL_SESSION(sess, &p);
 
-    c = ngx_ssl_get_connection(ssl_conn);
+#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
 
-    ssl_ctx = c->ssl->session_ctx;
-    shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
+    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
+
+#else
+
+    session_id = sess->session_id;
+    session_id_length = sess->session_id_length;
+
+#endif
+
+    hash = ngx_crc32_short(session_id, session_id_length);
 
     cache = shm_zone->data;
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = &cache->shards[hash % cache->nshards];
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
     /* drop one or two expired sessions */
-    ngx_ssl_expire_sessions(cache, shpool, 1);
+    ngx_ssl_expire_sessions(shard, 1);
 
     cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -2442,7 +3645,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -2458,7 +3661,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
 
@@ -2467,17 +3670,6 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
         }
     }
 
-#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
-
-    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
-
-#else
-
-    session_id = sess->session_id;
-    session_id_length = sess->session_id_length;
-
-#endif
-
 #if (NGX_PTR_SIZE == 8)
 
     id = sess_id->sess_id;
@@ -2490,7 +3682,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         id = ngx_slab_alloc_locked(shpool, session_id_length);
 
@@ -2505,8 +3697,6 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     ngx_memcpy(id, session_id, session_id_length);
 
-    hash = ngx_crc32_short(session_id, session_id_length);
-
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "ssl new session: %08XD:%ud:%d",
                    hash, session_id_length, len);
@@ -2519,9 +3709,9 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     sess_id->expire = ngx_time() + SSL_CTX_get_timeout(ssl_ctx);
 
-    ngx_queue_insert_head(&cache->expire_queue, &sess_id->queue);
+    ngx_queue_insert_head(&shard->expire_queue, &sess_id->queue);
 
-    ngx_rbtree_insert(&cache->session_rbtree, &sess_id->node);
+    ngx_rbtree_insert(&shard->session_rbtree, &sess_id->node);
 
     ngx_shmtx_unlock(&shpool->mutex);
 
@@ -2556,17 +3746,18 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 #if OPENSSL_VERSION_NUMBER >= 0x0090707fL
     const
 #endif
-    u_char                   *p;
-    uint32_t                  hash;
-    ngx_int_t                 rc;
-    ngx_shm_zone_t           *shm_zone;
-    ngx_slab_pool_t          *shpool;
-    ngx_rbtree_node_t        *node, *sentinel;
-    ngx_ssl_session_t        *sess;
-    ngx_ssl_sess_id_t        *sess_id;
-    ngx_ssl_session_cache_t  *cache;
-    u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
-    ngx_connection_t         *c;
+    u_char                         *p;
+    uint32_t                        hash;
+    ngx_int_t                       rc;
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_slab_pool_t                *shpool;
+    ngx_rbtree_node_t              *node, *sentinel;
+    ngx_ssl_session_t              *sess;
+    ngx_ssl_sess_id_t              *sess_id;
+    ngx_ssl_session_cache_t        *cache;
+    ngx_ssl_session_cache_shard_t  *shard;
+    u_char                          buf[NGX_SSL_MAX_SESSION_SIZE];
+    ngx_connection_t               *c;
 
     hash = ngx_crc32_short((u_char *) (uintptr_t) id, (size_t) len);
     *copy = 0;
@@ -2576,19 +3767,34 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "ssl get session: %08XD:%d", hash, len);
 
+    if (c->ssl->session_fetched) {
+
+        /* looked up by the client hello callback or in the store */
+
+        sess = c->ssl->fetched_session;
+        c->ssl->fetched_session = NULL;
+
+        return sess;
+    }
+
     shm_zone = SSL_CTX_get_ex_data(c->ssl->session_ctx,
                                    ngx_ssl_session_cache_index);
 
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
     cache = shm_zone->data;
+    shard = &cache->shards[hash % cache->nshards];
 
     sess = NULL;
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2624,7 +3830,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2648,6 +3854,104 @@ done:
 }
 
 
+#ifdef SSL_CLIENT_HELLO_RETRY
+
+/*
+ * A session missing in the shared cache is looked up in the session store:
+ * the callback asks to retry the handshake, and ngx_ssl_handshake() starts
+ * the lookup.  The session found is then returned to OpenSSL by
+ * ngx_ssl_get_cached_session().
+ */
+
+static int
+ngx_ssl_client_hello_callback(ngx_ssl_conn_t *ssl_conn, int *al, void *arg)
+{
+    int                 copy;
+    size_t              len;
+    const u_char       *id;
+    ngx_connection_t   *c;
+    ngx_ssl_session_t  *sess;
+#ifdef TLS1_3_VERSION
+    size_t              n;
+    const u_char       *p;
+#endif
+
+    c = ngx_ssl_get_connection(ssl_conn);
+
+    if (c->ssl->session_fetched) {
+        return SSL_CLIENT_HELLO_SUCCESS;
+    }
+
+    len = SSL_client_hello_get0_session_id(ssl_conn, &id);
+
+    if (len == 0) {
+        return SSL_CLIENT_HELLO_SUCCESS;
+    }
+
+#ifdef TLS1_3_VERSION
+
+    /* TLSv1.3 resumes sessions with tickets, the session id is a dummy */
+
+    if (!(SSL_get_options(ssl_conn) & SSL_OP_NO_TLSv1_3)
+        && SSL_client_hello_get0_ext(ssl_conn, TLSEXT_TYPE_supported_versions,
+                                     &p, &n)
+        && n > 0)
+    {
+        for (n = ngx_min(n - 1, p[0]), p++; n >= 2; n -= 2, p += 2) {
+            if (p[0] == (TLS1_3_VERSION >> 8)
+                && p[1] == (TLS1_3_VERSION & 0xff))
+            {
+                return SSL_CLIENT_HELLO_SUCCESS;
+            }
+        }
+    }
+
+#endif
+
+    if (SSL_CTX_get_ex_data(c->ssl->session_ctx, ngx_ssl_session_cache_index)) {
+
+        sess = ngx_ssl_get_cached_session(ssl_conn, id, len, &copy);
+
+        if (sess) {
+            c->ssl->session_fetched = 1;
+            c->ssl->fetched_session = sess;
+
+            return SSL_CLIENT_HELLO_SUCCESS;
+        }
+    }
+
+    return SSL_CLIENT_HELLO_RETRY;
+}
+
+#endif
+
+
+ngx_int_t
+ngx_ssl_session_store(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_ssl_session_store_t *store)
+{
+#ifdef SSL_CLIENT_HELLO_RETRY
+
+    if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_store_index, store)
+        == 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_set_ex_data() failed");
+        return NGX_ERROR;
+    }
+
+    SSL_CTX_sess_set_new_cb(ssl->ctx, ngx_ssl_new_session);
+    SSL_CTX_sess_set_get_cb(ssl->ctx, ngx_ssl_get_cached_session);
+    SSL_CTX_sess_set_remove_cb(ssl->ctx, ngx_ssl_remove_session);
+
+    SSL_CTX_set_client_hello_cb(ssl->ctx, ngx_ssl_client_hello_callback, NULL);
+
+#endif
+
+    return NGX_OK;
+}
+
+
 void
 ngx_ssl_remove_cached_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 {
@@ -2660,15 +3964,16 @@ ngx_ssl_remove_cached_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 static void
 ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 {
-    u_char                   *id;
-    uint32_t                  hash;
-    ngx_int_t                 rc;
-    unsigned int              len;
-    ngx_shm_zone_t           *shm_zone;
-    ngx_slab_pool_t          *shpool;
-    ngx_rbtree_node_t        *node, *sentinel;
-    ngx_ssl_sess_id_t        *sess_id;
-    ngx_ssl_session_cache_t  *cache;
+    u_char                         *id;
+    uint32_t                        hash;
+    ngx_int_t                       rc;
+    unsigned int                    len;
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_slab_pool_t                *shpool;
+    ngx_rbtree_node_t              *node, *sentinel;
+    ngx_ssl_sess_id_t              *sess_id;
+    ngx_ssl_session_cache_t        *cache;
+    ngx_ssl_session_cache_shard_t  *shard;
 
     shm_zone = SSL_CTX_get_ex_data(ssl, ngx_ssl_session_cache_index);
 
@@ -2694,12 +3999,13 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                    "ssl remove session: %08XD:%ud", hash, len);
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = &cache->shards[hash % cache->nshards];
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2723,7 +4029,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2744,8 +4050,7 @@ done:
 
 
 static void
-ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n)
+ngx_ssl_expire_sessions(ngx_ssl_session_cache_shard_t *shard, ngx_uint_t n)
 {
     time_t              now;
     ngx_queue_t        *q;
@@ -2755,11 +4060,11 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&cache->expire_queue)) {
+        if (ngx_queue_empty(&shard->expire_queue)) {
             return;
         }
 
-        q = ngx_queue_last(&cache->expire_queue);
+        q = ngx_queue_last(&shard->expire_queue);
 
         sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
 
@@ -2772,13 +4077,13 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
         ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                        "expire session: %08Xi", sess_id->node.key);
 
-        ngx_rbtree_delete(&cache->session_rbtree, &sess_id->node);
+        ngx_rbtree_delete(&shard->session_rbtree, &sess_id->node);
 
-        ngx_slab_free_locked(shpool, sess_id->session);
+        ngx_slab_free_locked(shard->shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
-        ngx_slab_free_locked(shpool, sess_id->id);
+        ngx_slab_free_locked(shard->shpool, sess_id->id);
 #endif
-        ngx_slab_free_locked(shpool, sess_id);
+        ngx_slab_free_locked(shard->shpool, sess_id);
     }
 }
 
@@ -2828,24 +4133,66 @@ ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
 
 ngx_int_t
-ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
+ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths,
+    time_t rotation, time_t lifetime)
 {
-    u_char                         buf[48];
-    ssize_t                        n;
-    ngx_str_t                     *path;
-    ngx_file_t                     file;
-    ngx_uint_t                     i;
-    ngx_array_t                   *keys;
-    ngx_file_info_t                fi;
-    ngx_ssl_session_ticket_key_t  *key;
+    u_char                          buf[48];
+    ssize_t                         n;
+    ngx_str_t                      *path;
+    ngx_file_t                      file;
+    ngx_uint_t                      i;
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_file_info_t                 fi;
+    ngx_ssl_session_ticket_key_t   *key;
+    ngx_ssl_session_ticket_keys_t  *keys;
+
+    keys = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_session_ticket_keys_t));
+    if (keys == NULL) {
+        return NGX_ERROR;
+    }
 
     if (paths == NULL) {
-        return NGX_OK;
+
+        /*
+         * without key files the keys are generated at run time and
+         * rotated in the shared session cache, so all worker processes
+         * use the same keys and a reload does not invalidate tickets
+         */
+
+        shm_zone = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_session_cache_index);
+
+        if (shm_zone == NULL || rotation == 0) {
+            return NGX_OK;
+        }
+
+        if (1 + (lifetime + rotation - 1) / rotation
+            > NGX_SSL_SESSION_TICKET_KEYS)
+        {
+            ngx_log_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "session ticket key lifetime %T must not exceed "
+                          "%d rotation intervals of %T",
+                          lifetime, NGX_SSL_SESSION_TICKET_KEYS - 1, rotation);
+            return NGX_ERROR;
+        }
+
+        if (ngx_array_init(&keys->keys, cf->pool, NGX_SSL_SESSION_TICKET_KEYS,
+                           sizeof(ngx_ssl_session_ticket_key_t))
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        keys->shm_zone = shm_zone;
+        keys->rotation = rotation;
+        keys->lifetime = lifetime;
+
+        goto done;
     }
 
-    keys = ngx_array_create(cf->pool, paths->nelts,
-                            sizeof(ngx_ssl_session_ticket_key_t));
-    if (keys == NULL) {
+    if (ngx_array_init(&keys->keys, cf->pool, paths->nelts,
+                       sizeof(ngx_ssl_session_ticket_key_t))
+        != NGX_OK)
+    {
         return NGX_ERROR;
     }
 
@@ -2894,7 +4241,7 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
             goto failed;
         }
 
-        key = ngx_array_push(keys);
+        key = ngx_array_push(&keys->keys);
         if (key == NULL) {
             goto failed;
         }
@@ -2902,6 +4249,7 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
         ngx_memcpy(key->name, buf, 16);
         ngx_memcpy(key->aes_key, buf + 16, 16);
         ngx_memcpy(key->hmac_key, buf + 32, 16);
+        key->expire = 0;
 
         if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
             ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
@@ -2909,6 +4257,8 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
         }
     }
 
+done:
+
     if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_ticket_keys_index, keys)
         == 0)
     {
@@ -2948,18 +4298,38 @@ failed:
 #endif
 
 
+/*
+ * rotated keys are copied from the shared cache while handshakes
+ * may run in thread pool threads, so they are read under a lock
+ */
+
+#if (NGX_THREADS)
+#define ngx_ssl_session_ticket_lock(keys)                                    \
+    if ((keys)->shm_zone) {                                                  \
+        ngx_spinlock(&(keys)->lock, 1, 2048);                                \
+    }
+#define ngx_ssl_session_ticket_unlock(keys)                                  \
+    if ((keys)->shm_zone) {                                                  \
+        ngx_unlock(&(keys)->lock);                                           \
+    }
+#else
+#define ngx_ssl_session_ticket_lock(keys)
+#define ngx_ssl_session_ticket_unlock(keys)
+#endif
+
+
 static int
 ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
     HMAC_CTX *hctx, int enc)
 {
-    SSL_CTX                       *ssl_ctx;
-    ngx_uint_t                     i;
-    ngx_array_t                   *keys;
-    ngx_connection_t              *c;
-    ngx_ssl_session_ticket_key_t  *key;
+    SSL_CTX                        *ssl_ctx;
+    ngx_uint_t                      i, n;
+    ngx_connection_t               *c;
+    ngx_ssl_session_ticket_key_t    k, *key;
+    ngx_ssl_session_ticket_keys_t  *keys;
 #if (NGX_DEBUG)
-    u_char                         buf[32];
+    u_char                          buf[32];
 #endif
 
     c = ngx_ssl_get_connection(ssl_conn);
@@ -2970,58 +4340,167 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
         return -1;
     }
 
-    key = keys->elts;
+    if (keys->shm_zone && ngx_time() >= keys->sync) {
+        if (ngx_ssl_rotate_ticket_keys(keys, c->log) != NGX_OK) {
+            return -1;
+        }
+    }
 
     if (enc == 1) {
         /* encrypt session ticket */
 
+        ngx_ssl_session_ticket_lock(keys);
+
+        key = keys->keys.elts;
+        k = key[0];
+
+        ngx_ssl_session_ticket_unlock(keys);
+
         ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                        "ssl session ticket encrypt, key: \"%*s\" (%s session)",
-                       ngx_hex_dump(buf, key[0].name, 16) - buf, buf,
+                       ngx_hex_dump(buf, k.name, 16) - buf, buf,
                        SSL_session_reused(ssl_conn) ? "reused" : "new");
 
         RAND_bytes(iv, 16);
-        EVP_EncryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key[0].aes_key, iv);
-        HMAC_Init_ex(hctx, key[0].hmac_key, 16,
-                     ngx_ssl_session_ticket_md(), NULL);
-        ngx_memcpy(name, key[0].name, 16);
+        EVP_EncryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, k.aes_key, iv);
+        HMAC_Init_ex(hctx, k.hmac_key, 16, ngx_ssl_session_ticket_md(), NULL);
+        ngx_memcpy(name, k.name, 16);
 
-        return 0;
+        OPENSSL_cleanse(&k, sizeof(ngx_ssl_session_ticket_key_t));
+
+        return 1;
 
     } else {
         /* decrypt session ticket */
 
-        for (i = 0; i < keys->nelts; i++) {
+        ngx_ssl_session_ticket_lock(keys);
+
+        key = keys->keys.elts;
+        n = keys->keys.nelts;
+
+        for (i = 0; i < n; i++) {
             if (ngx_memcmp(name, key[i].name, 16) == 0) {
-                goto found;
+
+                if (i > 0 && key[i].expire && key[i].expire <= ngx_time()) {
+                    i = n;
+                    break;
+                }
+
+                k = key[i];
+                break;
             }
         }
 
-        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                       "ssl session ticket decrypt, key: \"%*s\" not found",
-                       ngx_hex_dump(buf, name, 16) - buf, buf);
+        ngx_ssl_session_ticket_unlock(keys);
 
-        return 0;
+        if (i == n) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "ssl session ticket decrypt, key: \"%*s\" "
+                           "not found",
+                           ngx_hex_dump(buf, name, 16) - buf, buf);
 
-    found:
+            return 0;
+        }
 
         ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                        "ssl session ticket decrypt, key: \"%*s\"%s",
-                       ngx_hex_dump(buf, key[i].name, 16) - buf, buf,
+                       ngx_hex_dump(buf, k.name, 16) - buf, buf,
                        (i == 0) ? " (default)" : "");
 
-        HMAC_Init_ex(hctx, key[i].hmac_key, 16,
-                     ngx_ssl_session_ticket_md(), NULL);
-        EVP_DecryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key[i].aes_key, iv);
+        HMAC_Init_ex(hctx, k.hmac_key, 16, ngx_ssl_session_ticket_md(), NULL);
+        EVP_DecryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, k.aes_key, iv);
+
+        OPENSSL_cleanse(&k, sizeof(ngx_ssl_session_ticket_key_t));
 
         return (i == 0) ? 1 : 2 /* renew */;
     }
 }
 
+
+static ngx_int_t
+ngx_ssl_rotate_ticket_keys(ngx_ssl_session_ticket_keys_t *keys, ngx_log_t *log)
+{
+    u_char                         buf[48];
+    time_t                         now;
+    ngx_uint_t                     i, n;
+    ngx_slab_pool_t               *shpool;
+    ngx_ssl_session_cache_t       *cache;
+    ngx_ssl_session_ticket_key_t  *key;
+
+    now = ngx_time();
+
+    cache = keys->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) keys->shm_zone->shm.addr;
+
+    key = cache->ticket_keys;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    if (cache->ticket_keys_n == 0 || key[0].expire <= now) {
+
+        if (RAND_bytes(buf, 48) != 1) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            ngx_ssl_error(NGX_LOG_ALERT, log, 0, "RAND_bytes() failed");
+            return NGX_ERROR;
+        }
+
+        /*
+         * the current key is kept for decryption only for the lifetime
+         * counted from the moment it was due to rotate, the keys whose
+         * lifetime has passed are dropped
+         */
+
+        if (cache->ticket_keys_n) {
+            key[0].expire += keys->lifetime;
+        }
+
+        n = 0;
+
+        for (i = 0; i < cache->ticket_keys_n; i++) {
+            if (key[i].expire > now) {
+                key[n++] = key[i];
+            }
+        }
+
+        if (n == NGX_SSL_SESSION_TICKET_KEYS) {
+            n--;
+        }
+
+        ngx_memmove(&key[1], &key[0], n * sizeof(ngx_ssl_session_ticket_key_t));
+
+        ngx_memcpy(key[0].name, buf, 16);
+        ngx_memcpy(key[0].aes_key, buf + 16, 16);
+        ngx_memcpy(key[0].hmac_key, buf + 32, 16);
+        key[0].expire = now + keys->rotation;
+
+        cache->ticket_keys_n = n + 1;
+
+        OPENSSL_cleanse(buf, 48);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "ssl session ticket keys rotated, %ui keys",
+                       cache->ticket_keys_n);
+    }
+
+    ngx_ssl_session_ticket_lock(keys);
+
+    ngx_memcpy(keys->keys.elts, key,
+               cache->ticket_keys_n * sizeof(ngx_ssl_session_ticket_key_t));
+    keys->keys.nelts = cache->ticket_keys_n;
+    keys->sync = key[0].expire;
+
+    ngx_ssl_session_ticket_unlock(keys);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    return NGX_OK;
+}
+
 #else
 
 ngx_int_t
-ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
+ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths,
+    time_t rotation, time_t lifetime)
 {
     if (paths) {
         ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
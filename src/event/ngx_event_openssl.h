@@ -54,10 +54,23 @@
 #define ngx_ssl_conn_t          SSL
 
 
+/* dynamic record sizing, disabled if size_lo is zero */
+
+typedef struct {
+    size_t                      size_lo;
+    size_t                      threshold;
+    ngx_msec_t                  timeout;
+} ngx_ssl_dyn_rec_t;
+
+
 typedef struct {
     SSL_CTX                    *ctx;
     ngx_log_t                  *log;
     size_t                      buffer_size;
+    ngx_ssl_dyn_rec_t           dyn_rec;
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+#endif
 } ngx_ssl_t;
 
 
@@ -69,17 +82,34 @@ typedef struct {
     ngx_buf_t                  *buf;
     size_t                      buffer_size;
 
+    ngx_ssl_dyn_rec_t           dyn_rec;
+    size_t                      dyn_rec_sent;
+    ngx_msec_t                  dyn_rec_last_write;
+
     ngx_connection_handler_pt   handler;
 
     ngx_event_handler_pt        saved_read_handler;
     ngx_event_handler_pt        saved_write_handler;
 
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+    ngx_thread_task_t          *handshake_task;
+    ngx_ssl_session_t          *pending_session;
+    void                       *pending_staple;
+#endif
+
+    ngx_ssl_session_t          *fetched_session;
+
     unsigned                    handshaked:1;
     unsigned                    renegotiation:1;
     unsigned                    buffer:1;
     unsigned                    no_wait_shutdown:1;
     unsigned                    no_send_shutdown:1;
     unsigned                    handshake_buffer_set:1;
+    unsigned                    sendfile:1;
+    unsigned                    handshake_in_thread:1;
+    unsigned                    session_fetching:1;
+    unsigned                    session_fetched:1;
 } ngx_ssl_connection_t;
 
 
@@ -91,6 +121,10 @@ typedef struct {
 
 #define NGX_SSL_MAX_SESSION_SIZE  4096
 
+typedef struct ngx_ssl_session_store_s  ngx_ssl_session_store_t;
+
+typedef struct ngx_ssl_cert_cache_s  ngx_ssl_cert_cache_t;
+
 typedef struct ngx_ssl_sess_id_s  ngx_ssl_sess_id_t;
 
 struct ngx_ssl_sess_id_s {
@@ -107,22 +141,46 @@ struct ngx_ssl_sess_id_s {
 };
 
 
-typedef struct {
-    ngx_rbtree_t                session_rbtree;
-    ngx_rbtree_node_t           sentinel;
-    ngx_queue_t                 expire_queue;
-} ngx_ssl_session_cache_t;
-
-
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
 
+#define NGX_SSL_SESSION_TICKET_KEYS  16
+
 typedef struct {
     u_char                      name[16];
     u_char                      aes_key[16];
     u_char                      hmac_key[16];
+    time_t                      expire;
 } ngx_ssl_session_ticket_key_t;
 
+
+typedef struct {
+    ngx_array_t                 keys;
+    ngx_shm_zone_t             *shm_zone;
+    time_t                      rotation;
+    time_t                      lifetime;
+    time_t                      sync;
+    ngx_atomic_t                lock;
+} ngx_ssl_session_ticket_keys_t;
+
+#endif
+
+
+typedef struct {
+    ngx_slab_pool_t            *shpool;
+    ngx_rbtree_t                session_rbtree;
+    ngx_rbtree_node_t           sentinel;
+    ngx_queue_t                 expire_queue;
+} ngx_ssl_session_cache_shard_t;
+
+
+typedef struct {
+    ngx_uint_t                  nshards;
+    ngx_ssl_session_cache_shard_t  *shards;
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+    ngx_uint_t                  ticket_keys_n;
+    ngx_ssl_session_ticket_key_t  ticket_keys[NGX_SSL_SESSION_TICKET_KEYS];
 #endif
+} ngx_ssl_session_cache_t;
 
 
 #define NGX_SSL_SSLv2    0x0002
@@ -144,8 +202,14 @@ ngx_int_t ngx_ssl_certificates(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_array_t *certs, ngx_array_t *keys, ngx_array_t *passwords);
 ngx_int_t ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords);
+ngx_ssl_cert_cache_t *ngx_ssl_cert_cache_init(ngx_pool_t *pool,
+    ngx_uint_t max, time_t valid);
+ngx_int_t ngx_ssl_connection_certificate(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords,
+    ngx_ssl_cert_cache_t *cache);
 ngx_int_t ngx_ssl_ciphers(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *ciphers,
     ngx_uint_t prefer_server_ciphers);
+ngx_int_t ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl);
 ngx_int_t ngx_ssl_client_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *cert, ngx_int_t depth);
 ngx_int_t ngx_ssl_trusted_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
@@ -155,16 +219,32 @@ ngx_int_t ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *file, ngx_str_t *responder, ngx_uint_t verify);
 ngx_int_t ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_resolver_t *resolver, ngx_msec_t resolver_timeout);
+ngx_int_t ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone);
+void ngx_ssl_stapling_prefetch(ngx_ssl_t *ssl);
+#if (NGX_THREADS)
+void ngx_ssl_stapling_pending(ngx_connection_t *c);
+#endif
+ngx_shm_zone_t *ngx_ssl_stapling_cache_zone(ngx_conf_t *cf, ngx_str_t *name,
+    size_t size);
 RSA *ngx_ssl_rsa512_key_callback(ngx_ssl_conn_t *ssl_conn, int is_export,
     int key_length);
 ngx_array_t *ngx_ssl_read_password_file(ngx_conf_t *cf, ngx_str_t *file);
+ngx_array_t *ngx_ssl_preserve_passwords(ngx_conf_t *cf,
+    ngx_array_t *passwords);
 ngx_int_t ngx_ssl_dhparam(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file);
 ngx_int_t ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name);
 ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
     ssize_t builtin_session_cache, ngx_shm_zone_t *shm_zone, time_t timeout);
 ngx_int_t ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl,
-    ngx_array_t *paths);
+    ngx_array_t *paths, time_t rotation, time_t lifetime);
 ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
+ngx_ssl_session_store_t *ngx_ssl_session_store_create(ngx_conf_t *cf,
+    ngx_str_t *addr, ngx_msec_t timeout, ngx_uint_t keepalive);
+ngx_int_t ngx_ssl_session_store(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_ssl_session_store_t *store);
+ngx_int_t ngx_ssl_session_store_fetch(ngx_connection_t *c);
+void ngx_ssl_session_store_save(ngx_connection_t *c, ngx_ssl_session_t *sess);
 ngx_int_t ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c,
     ngx_uint_t flags);
 
@@ -230,6 +310,7 @@ extern int  ngx_ssl_connection_index;
 extern int  ngx_ssl_server_conf_index;
 extern int  ngx_ssl_session_cache_index;
 extern int  ngx_ssl_session_ticket_keys_index;
+extern int  ngx_ssl_session_store_index;
 extern int  ngx_ssl_certificate_index;
 extern int  ngx_ssl_next_certificate_index;
 extern int  ngx_ssl_stapling_index;
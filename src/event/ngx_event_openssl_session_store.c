@@ -0,0 +1,659 @@
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_event_connect.h>
+
+
+#ifdef SSL_CLIENT_HELLO_RETRY
+
+
+#define NGX_SSL_SESSION_STORE_KEY  "nginx_ssl_sess_"
+#define NGX_SSL_SESSION_STORE_BUF  (NGX_SSL_MAX_SESSION_SIZE + 256)
+
+
+typedef struct {
+    ngx_ssl_session_store_t     *store;
+    ngx_queue_t                  queue;
+    ngx_connection_t            *connection;
+} ngx_ssl_session_store_cache_t;
+
+
+struct ngx_ssl_session_store_s {
+    ngx_addr_t                  *addrs;
+    ngx_msec_t                   timeout;
+
+    ngx_queue_t                  cache;
+    ngx_queue_t                  free;
+};
+
+
+typedef struct {
+    ngx_ssl_session_store_t     *store;
+
+    /* the connection waiting for a session lookup, NULL for saving */
+    ngx_connection_t            *connection;
+
+    ngx_connection_t            *peer;
+
+    ngx_buf_t                    buf;
+    u_char                       data[NGX_SSL_SESSION_STORE_BUF];
+} ngx_ssl_session_store_ctx_t;
+
+
+static ngx_int_t ngx_ssl_session_store_request(
+    ngx_ssl_session_store_ctx_t *ctx);
+static void ngx_ssl_session_store_write_handler(ngx_event_t *wev);
+static void ngx_ssl_session_store_read_handler(ngx_event_t *rev);
+static ngx_int_t ngx_ssl_session_store_parse(ngx_ssl_session_store_ctx_t *ctx,
+    ngx_ssl_session_t **sess);
+static void ngx_ssl_session_store_finalize(ngx_ssl_session_store_ctx_t *ctx,
+    ngx_ssl_session_t *sess, ngx_uint_t keepalive);
+static void ngx_ssl_session_store_close_handler(ngx_event_t *ev);
+static void ngx_ssl_session_store_dummy_handler(ngx_event_t *ev);
+static u_char *ngx_ssl_session_store_key(u_char *p, const u_char *id,
+    size_t len);
+
+
+ngx_ssl_session_store_t *
+ngx_ssl_session_store_create(ngx_conf_t *cf, ngx_str_t *addr,
+    ngx_msec_t timeout, ngx_uint_t keepalive)
+{
+    ngx_url_t                       u;
+    ngx_uint_t                      i;
+    ngx_ssl_session_store_t        *store;
+    ngx_ssl_session_store_cache_t  *cached;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = *addr;
+    u.default_port = 11211;
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in session store \"%V\"", u.err, &u.url);
+        }
+
+        return NULL;
+    }
+
+    if (u.naddrs == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no addresses in session store \"%V\"", &u.url);
+        return NULL;
+    }
+
+    store = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_session_store_t));
+    if (store == NULL) {
+        return NULL;
+    }
+
+    store->addrs = u.addrs;
+    store->timeout = timeout;
+
+    ngx_queue_init(&store->cache);
+    ngx_queue_init(&store->free);
+
+    cached = ngx_pcalloc(cf->pool,
+                         sizeof(ngx_ssl_session_store_cache_t) * keepalive);
+    if (cached == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < keepalive; i++) {
+        cached[i].store = store;
+        ngx_queue_insert_head(&store->free, &cached[i].queue);
+    }
+
+    return store;
+}
+
+
+/*
+ * The lookup is started when the client hello callback has asked
+ * to retry the handshake.  Once the lookup is finished, the session found
+ * is left in c->ssl->fetched_session and the connection read event
+ * is posted to continue the handshake.
+ */
+
+ngx_int_t
+ngx_ssl_session_store_fetch(ngx_connection_t *c)
+{
+    size_t                        len;
+    const u_char                 *id;
+    ngx_ssl_session_store_t      *store;
+    ngx_ssl_session_store_ctx_t  *ctx;
+
+    c->ssl->session_fetched = 1;
+
+    store = SSL_CTX_get_ex_data(c->ssl->session_ctx,
+                                ngx_ssl_session_store_index);
+    if (store == NULL) {
+        return NGX_DECLINED;
+    }
+
+    len = SSL_client_hello_get0_session_id(c->ssl->connection, &id);
+
+    if (len == 0) {
+        return NGX_DECLINED;
+    }
+
+    ctx = ngx_calloc(sizeof(ngx_ssl_session_store_ctx_t), c->log);
+    if (ctx == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ctx->store = store;
+    ctx->connection = c;
+
+    ctx->buf.start = ctx->data;
+    ctx->buf.pos = ctx->data;
+    ctx->buf.end = ctx->data + NGX_SSL_SESSION_STORE_BUF;
+
+    ctx->buf.last = ngx_cpymem(ctx->data, "get ", sizeof("get ") - 1);
+    ctx->buf.last = ngx_ssl_session_store_key(ctx->buf.last, id, len);
+    *ctx->buf.last++ = CR; *ctx->buf.last++ = LF;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl session store get: \"%*s\"",
+                   ctx->buf.last - ctx->buf.pos - 6, ctx->buf.pos + 4);
+
+    if (ngx_ssl_session_store_request(ctx) != NGX_OK) {
+        ngx_free(ctx);
+        return NGX_DECLINED;
+    }
+
+    c->ssl->session_fetching = 1;
+
+    return NGX_AGAIN;
+}
+
+
+void
+ngx_ssl_session_store_save(ngx_connection_t *c, ngx_ssl_session_t *sess)
+{
+    int                           len;
+    u_char                       *id;
+    unsigned int                  id_len;
+    ngx_ssl_session_store_t      *store;
+    ngx_ssl_session_store_ctx_t  *ctx;
+
+    store = SSL_CTX_get_ex_data(c->ssl->session_ctx,
+                                ngx_ssl_session_store_index);
+    if (store == NULL) {
+        return;
+    }
+
+    id = (u_char *) SSL_SESSION_get_id(sess, &id_len);
+
+    if (id_len == 0) {
+        return;
+    }
+
+    len = i2d_SSL_SESSION(sess, NULL);
+
+    /* do not store too big session */
+
+    if (len > (int) NGX_SSL_MAX_SESSION_SIZE) {
+        return;
+    }
+
+    ctx = ngx_calloc(sizeof(ngx_ssl_session_store_ctx_t), c->log);
+    if (ctx == NULL) {
+        return;
+    }
+
+    ctx->store = store;
+
+    ctx->buf.start = ctx->data;
+    ctx->buf.pos = ctx->data;
+    ctx->buf.end = ctx->data + NGX_SSL_SESSION_STORE_BUF;
+
+    /* the reply is not waited for, the connection is kept alive at once */
+
+    ctx->buf.last = ngx_cpymem(ctx->data, "set ", sizeof("set ") - 1);
+    ctx->buf.last = ngx_ssl_session_store_key(ctx->buf.last, id, id_len);
+    ctx->buf.last = ngx_sprintf(ctx->buf.last, " 0 %l %d noreply" CRLF,
+                                SSL_CTX_get_timeout(c->ssl->session_ctx),
+                                len);
+    i2d_SSL_SESSION(sess, &ctx->buf.last);
+    *ctx->buf.last++ = CR; *ctx->buf.last++ = LF;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl session store set: %ud:%d", id_len, len);
+
+    if (ngx_ssl_session_store_request(ctx) != NGX_OK) {
+        ngx_free(ctx);
+    }
+}
+
+
+static ngx_int_t
+ngx_ssl_session_store_request(ngx_ssl_session_store_ctx_t *ctx)
+{
+    ngx_int_t                       rc;
+    ngx_queue_t                    *q;
+    ngx_connection_t               *pc;
+    ngx_peer_connection_t           peer;
+    ngx_ssl_session_store_t        *store;
+    ngx_ssl_session_store_cache_t  *item;
+
+    store = ctx->store;
+
+    if (!ngx_queue_empty(&store->cache)) {
+
+        q = ngx_queue_head(&store->cache);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_ssl_session_store_cache_t, queue);
+        ngx_queue_insert_head(&store->free, q);
+
+        pc = item->connection;
+        pc->idle = 0;
+
+        rc = NGX_OK;
+
+    } else {
+        ngx_memzero(&peer, sizeof(ngx_peer_connection_t));
+
+        peer.sockaddr = store->addrs[0].sockaddr;
+        peer.socklen = store->addrs[0].socklen;
+        peer.name = &store->addrs[0].name;
+        peer.get = ngx_event_get_peer;
+        peer.log = ngx_cycle->log;
+        peer.log_error = NGX_ERROR_ERR;
+
+        rc = ngx_event_connect_peer(&peer);
+
+        if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+            return NGX_ERROR;
+        }
+
+        pc = peer.connection;
+    }
+
+    ctx->peer = pc;
+
+    pc->data = ctx;
+
+    pc->read->handler = ngx_ssl_session_store_read_handler;
+    pc->write->handler = ngx_ssl_session_store_write_handler;
+
+    ngx_add_timer(pc->write, store->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_ssl_session_store_write_handler(pc->write);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_ssl_session_store_write_handler(ngx_event_t *wev)
+{
+    ssize_t                       n, size;
+    ngx_connection_t             *pc;
+    ngx_ssl_session_store_ctx_t  *ctx;
+
+    pc = wev->data;
+    ctx = pc->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, wev->log, 0,
+                   "ssl session store write handler");
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, wev->log, NGX_ETIMEDOUT,
+                      "session store timed out");
+        ngx_ssl_session_store_finalize(ctx, NULL, 0);
+        return;
+    }
+
+    size = ctx->buf.last - ctx->buf.pos;
+
+    n = ngx_send(pc, ctx->buf.pos, size);
+
+    if (n == NGX_ERROR) {
+        ngx_ssl_session_store_finalize(ctx, NULL, 0);
+        return;
+    }
+
+    if (n != size) {
+
+        if (n > 0) {
+            ctx->buf.pos += n;
+        }
+
+        if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+            ngx_ssl_session_store_finalize(ctx, NULL, 0);
+        }
+
+        return;
+    }
+
+    wev->handler = ngx_ssl_session_store_dummy_handler;
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    if (ctx->connection == NULL) {
+        ngx_ssl_session_store_finalize(ctx, NULL, 1);
+        return;
+    }
+
+    ctx->buf.pos = ctx->data;
+    ctx->buf.last = ctx->data;
+
+    ngx_add_timer(pc->read, ctx->store->timeout);
+
+    if (pc->read->ready) {
+        ngx_ssl_session_store_read_handler(pc->read);
+        return;
+    }
+
+    if (ngx_handle_read_event(pc->read, 0) != NGX_OK) {
+        ngx_ssl_session_store_finalize(ctx, NULL, 0);
+    }
+}
+
+
+static void
+ngx_ssl_session_store_read_handler(ngx_event_t *rev)
+{
+    ssize_t                       n;
+    ngx_int_t                     rc;
+    ngx_connection_t             *pc;
+    ngx_ssl_session_t            *sess;
+    ngx_ssl_session_store_ctx_t  *ctx;
+
+    pc = rev->data;
+    ctx = pc->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, rev->log, 0,
+                   "ssl session store read handler");
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, NGX_ETIMEDOUT,
+                      "session store timed out");
+        ngx_ssl_session_store_finalize(ctx, NULL, 0);
+        return;
+    }
+
+    if (ctx->connection == NULL) {
+        /* no reply is expected when saving */
+        return;
+    }
+
+    for ( ;; ) {
+
+        n = ngx_recv(pc, ctx->buf.last, ctx->buf.end - ctx->buf.last);
+
+        if (n > 0) {
+            ctx->buf.last += n;
+
+            sess = NULL;
+
+            rc = ngx_ssl_session_store_parse(ctx, &sess);
+
+            if (rc == NGX_AGAIN && ctx->buf.last < ctx->buf.end) {
+                continue;
+            }
+
+            ngx_ssl_session_store_finalize(ctx, sess, rc == NGX_OK);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_ssl_session_store_finalize(ctx, NULL, 0);
+            }
+
+            return;
+        }
+
+        break;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                  "session store prematurely closed connection");
+
+    ngx_ssl_session_store_finalize(ctx, NULL, 0);
+}
+
+
+/*
+ * "VALUE <key> <flags> <bytes>" CRLF <data> CRLF "END" CRLF
+ * or "END" CRLF if there is no such a session
+ */
+
+static ngx_int_t
+ngx_ssl_session_store_parse(ngx_ssl_session_store_ctx_t *ctx,
+    ngx_ssl_session_t **sess)
+{
+    u_char        *p, *line, *last;
+    size_t         len;
+    ngx_int_t      n;
+    const u_char  *data;
+
+    line = ctx->buf.pos;
+    last = ctx->buf.last;
+
+    p = ngx_strlchr(line, last, LF);
+
+    if (p == NULL) {
+        return NGX_AGAIN;
+    }
+
+    if (p - line == sizeof("END") && ngx_strncmp(line, "END" CRLF, 5) == 0) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ctx->connection->log, 0,
+                       "ssl session store: not found");
+        return NGX_OK;
+    }
+
+    if (ngx_strncmp(line, "VALUE ", sizeof("VALUE ") - 1) != 0) {
+        goto invalid;
+    }
+
+    /* the bytes are the last field of the line */
+
+    for (data = p - 1; data > line && *(data - 1) != ' '; data--) {
+        /* void */
+    }
+
+    n = ngx_atoi((u_char *) data, p - 1 - data);
+
+    if (n == NGX_ERROR || n > NGX_SSL_MAX_SESSION_SIZE) {
+        goto invalid;
+    }
+
+    len = n;
+    p++;
+
+    if ((size_t) (last - p) < len + sizeof(CRLF "END" CRLF) - 1) {
+        return NGX_AGAIN;
+    }
+
+    if (ngx_strncmp(p + len, CRLF "END" CRLF, sizeof(CRLF "END" CRLF) - 1)
+        != 0)
+    {
+        goto invalid;
+    }
+
+    data = p;
+
+    *sess = d2i_SSL_SESSION(NULL, &data, len);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ctx->connection->log, 0,
+                   "ssl session store: found %uz bytes, session: %p",
+                   len, *sess);
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, ctx->connection->log, 0,
+                  "session store sent invalid response: \"%*s\"",
+                  ngx_min(last - line, 64), line);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_ssl_session_store_finalize(ngx_ssl_session_store_ctx_t *ctx,
+    ngx_ssl_session_t *sess, ngx_uint_t keepalive)
+{
+    ngx_queue_t                    *q;
+    ngx_connection_t               *c, *pc;
+    ngx_ssl_session_store_t        *store;
+    ngx_ssl_session_store_cache_t  *item;
+
+    c = ctx->connection;
+    pc = ctx->peer;
+    store = ctx->store;
+
+    if (c) {
+        c->ssl->session_fetching = 0;
+        c->ssl->fetched_session = sess;
+
+        ngx_post_event(c->read, &ngx_posted_events);
+    }
+
+    ngx_free(ctx);
+
+    if (pc->read->timer_set) {
+        ngx_del_timer(pc->read);
+    }
+
+    if (pc->write->timer_set) {
+        ngx_del_timer(pc->write);
+    }
+
+    if (!keepalive
+        || ngx_queue_empty(&store->free)
+        || pc->read->eof
+        || pc->read->error
+        || pc->write->error)
+    {
+        ngx_close_connection(pc);
+        return;
+    }
+
+    if (ngx_handle_read_event(pc->read, 0) != NGX_OK) {
+        ngx_close_connection(pc);
+        return;
+    }
+
+    q = ngx_queue_head(&store->free);
+    ngx_queue_remove(q);
+
+    item = ngx_queue_data(q, ngx_ssl_session_store_cache_t, queue);
+    ngx_queue_insert_head(&store->cache, q);
+
+    item->connection = pc;
+
+    pc->data = item;
+    pc->idle = 1;
+
+    pc->read->handler = ngx_ssl_session_store_close_handler;
+    pc->write->handler = ngx_ssl_session_store_dummy_handler;
+
+    if (pc->read->ready) {
+        ngx_ssl_session_store_close_handler(pc->read);
+    }
+}
+
+
+static void
+ngx_ssl_session_store_close_handler(ngx_event_t *ev)
+{
+    int                             n;
+    char                            buf[1];
+    ngx_connection_t               *c;
+    ngx_ssl_session_store_cache_t  *item;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "ssl session store close handler");
+
+    c = ev->data;
+
+    if (c->close) {
+        goto close;
+    }
+
+    n = recv(c->fd, buf, 1, MSG_PEEK);
+
+    if (n == -1 && ngx_socket_errno == NGX_EAGAIN) {
+        ev->ready = 0;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            goto close;
+        }
+
+        return;
+    }
+
+close:
+
+    item = c->data;
+
+    ngx_close_connection(c);
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&item->store->free, &item->queue);
+}
+
+
+static void
+ngx_ssl_session_store_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "ssl session store dummy handler");
+}
+
+
+static u_char *
+ngx_ssl_session_store_key(u_char *p, const u_char *id, size_t len)
+{
+    p = ngx_cpymem(p, NGX_SSL_SESSION_STORE_KEY,
+                   sizeof(NGX_SSL_SESSION_STORE_KEY) - 1);
+
+    return ngx_hex_dump(p, (u_char *) id, len);
+}
+
+
+#else
+
+
+ngx_ssl_session_store_t *
+ngx_ssl_session_store_create(ngx_conf_t *cf, ngx_str_t *addr,
+    ngx_msec_t timeout, ngx_uint_t keepalive)
+{
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "session store requires OpenSSL 1.1.1 or newer");
+
+    return NULL;
+}
+
+
+ngx_int_t
+ngx_ssl_session_store_fetch(ngx_connection_t *c)
+{
+    return NGX_DECLINED;
+}
+
+
+void
+ngx_ssl_session_store_save(ngx_connection_t *c, ngx_ssl_session_t *sess)
+{
+}
+
+
+#endif
@@ -11,9 +11,54 @@
 #include <ngx_event_connect.h>
 
 
+static ngx_int_t ngx_ssl_stapling_cache_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+
+
+/* the zone tag differs from ssl_session_cache ones, so names do not clash */
+static ngx_uint_t  ngx_ssl_stapling_cache_tag;
+
+
 #if (!defined OPENSSL_NO_OCSP && defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB)
 
 
+#define NGX_SSL_STAPLING_ID_LEN  20
+
+/*
+ * workers touch the nodes of their certificates at least on each refresh,
+ * that is, at least once an hour
+ */
+#define NGX_SSL_STAPLING_CACHE_EXPIRE  (2 * 3600)
+
+
+typedef struct {
+    ngx_rbtree_node_t            node;
+    u_char                       id[NGX_SSL_STAPLING_ID_LEN];
+
+    ngx_queue_t                  queue;
+    time_t                       expire;
+
+    ngx_uint_t                   version;
+
+    time_t                       valid;
+    time_t                       refresh;
+    time_t                       loading;
+
+    size_t                       len;
+    u_char                      *data;
+} ngx_ssl_stapling_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                 rbtree;
+    ngx_rbtree_node_t            sentinel;
+    ngx_queue_t                  expire_queue;
+
+    /* changed when nodes are freed, so workers look their nodes up again */
+    ngx_uint_t                   generation;
+} ngx_ssl_stapling_cache_t;
+
+
 typedef struct {
     ngx_str_t                    staple;
     ngx_msec_t                   timeout;
@@ -34,11 +79,31 @@ typedef struct {
     time_t                       valid;
     time_t                       refresh;
 
+    ngx_shm_zone_t              *shm_zone;
+    ngx_ssl_stapling_node_t     *node;
+    ngx_uint_t                   generation;
+    ngx_uint_t                   version;
+    u_char                       id[NGX_SSL_STAPLING_ID_LEN];
+
+    ngx_event_t                  event;
+
+    /* protects the response from handshakes run in threads */
+    ngx_atomic_t                 lock;
+
     unsigned                     verify:1;
     unsigned                     loading:1;
 } ngx_ssl_stapling_t;
 
 
+#if (NGX_THREADS)
+#define ngx_ssl_stapling_lock(staple)    ngx_spinlock(&(staple)->lock, 1, 2048)
+#define ngx_ssl_stapling_unlock(staple)  ngx_unlock(&(staple)->lock)
+#else
+#define ngx_ssl_stapling_lock(staple)
+#define ngx_ssl_stapling_unlock(staple)
+#endif
+
+
 typedef struct ngx_ssl_ocsp_ctx_s  ngx_ssl_ocsp_ctx_t;
 
 struct ngx_ssl_ocsp_ctx_s {
@@ -96,6 +161,20 @@ static int ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn,
     void *data);
 static void ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple);
 static void ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx);
+static void ngx_ssl_stapling_prefetch_handler(ngx_event_t *ev);
+
+static void ngx_ssl_stapling_set(ngx_ssl_stapling_t *staple, u_char *data,
+    size_t len, time_t valid);
+static void ngx_ssl_stapling_cache_sync(ngx_ssl_stapling_t *staple);
+static ngx_int_t ngx_ssl_stapling_cache_lock(ngx_ssl_stapling_t *staple);
+static void ngx_ssl_stapling_cache_store(ngx_ssl_stapling_t *staple,
+    ngx_uint_t response);
+static ngx_ssl_stapling_node_t *ngx_ssl_stapling_cache_node(
+    ngx_ssl_stapling_t *staple);
+static void ngx_ssl_stapling_cache_expire(ngx_ssl_stapling_cache_t *cache,
+    ngx_slab_pool_t *shpool, ngx_ssl_stapling_node_t *keep, ngx_uint_t n);
+static void ngx_ssl_stapling_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
 static time_t ngx_ssl_stapling_time(ASN1_GENERALIZEDTIME *asn1time);
 
@@ -477,12 +556,127 @@ ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
 }
 
 
+ngx_int_t
+ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone)
+{
+    X509                *cert;
+    unsigned int         len;
+    ngx_ssl_stapling_t  *staple;
+
+    for (cert = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_certificate_index);
+         cert;
+         cert = X509_get_ex_data(cert, ngx_ssl_next_certificate_index))
+    {
+        staple = X509_get_ex_data(cert, ngx_ssl_stapling_index);
+
+        if (staple->host.len == 0) {
+            /* the response is loaded from a file, or stapling is ignored */
+            continue;
+        }
+
+        /* responses are shared by the certificate fingerprint */
+
+        if (X509_digest(cert, EVP_sha1(), staple->id, &len) == 0) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "X509_digest() failed");
+            return NGX_ERROR;
+        }
+
+        staple->shm_zone = shm_zone;
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_ssl_stapling_prefetch(ngx_ssl_t *ssl)
+{
+    X509                *cert;
+    ngx_ssl_stapling_t  *staple;
+
+    for (cert = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_certificate_index);
+         cert;
+         cert = X509_get_ex_data(cert, ngx_ssl_next_certificate_index))
+    {
+        staple = X509_get_ex_data(cert, ngx_ssl_stapling_index);
+
+        if (staple == NULL
+            || staple->host.len == 0
+            || staple->event.timer_set)
+        {
+            continue;
+        }
+
+        staple->event.handler = ngx_ssl_stapling_prefetch_handler;
+        staple->event.data = staple;
+        staple->event.log = ngx_cycle->log;
+        staple->event.cancelable = 1;
+
+        ngx_add_timer(&staple->event, 1);
+    }
+}
+
+
+static ngx_int_t
+ngx_ssl_stapling_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    size_t                     len;
+    ngx_slab_pool_t           *shpool;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    if (data) {
+        shm_zone->data = data;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_stapling_cache_t));
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = cache;
+    shm_zone->data = cache;
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_ssl_stapling_rbtree_insert_value);
+
+    ngx_queue_init(&cache->expire_queue);
+
+    cache->generation = 0;
+
+    len = sizeof(" in OCSP stapling cache \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in OCSP stapling cache \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 static int
 ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
 {
     int                  rc;
     X509                *cert;
     u_char              *p;
+    size_t               len;
+    ngx_uint_t           update;
     ngx_connection_t    *c;
     ngx_ssl_stapling_t  *staple;
 
@@ -500,30 +694,81 @@ ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
         return rc;
     }
 
+    update = 1;
+
+#if (NGX_THREADS)
+
+    if (c->ssl->handshake_in_thread) {
+
+        /*
+         * the callback is called in a thread pool thread: the cache
+         * is synced and the response is refreshed by the worker
+         * once the handshake step is finished
+         */
+
+        c->ssl->pending_staple = staple;
+        update = 0;
+    }
+
+#endif
+
+    if (update) {
+        ngx_ssl_stapling_cache_sync(staple);
+    }
+
+    ngx_ssl_stapling_lock(staple);
+
     if (staple->staple.len
         && staple->valid >= ngx_time())
     {
         /* we have to copy ocsp response as OpenSSL will free it by itself */
 
-        p = OPENSSL_malloc(staple->staple.len);
+        len = staple->staple.len;
+
+        p = OPENSSL_malloc(len);
         if (p == NULL) {
+            ngx_ssl_stapling_unlock(staple);
             ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "OPENSSL_malloc() failed");
             return SSL_TLSEXT_ERR_NOACK;
         }
 
-        ngx_memcpy(p, staple->staple.data, staple->staple.len);
+        ngx_memcpy(p, staple->staple.data, len);
+
+        ngx_ssl_stapling_unlock(staple);
 
-        SSL_set_tlsext_status_ocsp_resp(ssl_conn, p, staple->staple.len);
+        SSL_set_tlsext_status_ocsp_resp(ssl_conn, p, len);
 
         rc = SSL_TLSEXT_ERR_OK;
+
+    } else {
+        ngx_ssl_stapling_unlock(staple);
     }
 
-    ngx_ssl_stapling_update(staple);
+    if (update) {
+        ngx_ssl_stapling_update(staple);
+    }
 
     return rc;
 }
 
 
+#if (NGX_THREADS)
+
+void
+ngx_ssl_stapling_pending(ngx_connection_t *c)
+{
+    ngx_ssl_stapling_t  *staple;
+
+    staple = c->ssl->pending_staple;
+    c->ssl->pending_staple = NULL;
+
+    ngx_ssl_stapling_cache_sync(staple);
+    ngx_ssl_stapling_update(staple);
+}
+
+#endif
+
+
 static void
 ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
 {
@@ -535,6 +780,10 @@ ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
         return;
     }
 
+    if (ngx_ssl_stapling_cache_lock(staple) != NGX_OK) {
+        return;
+    }
+
     staple->loading = 1;
 
     ctx = ngx_ssl_ocsp_start();
@@ -712,12 +961,7 @@ ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
                    "ssl ocsp response, %s, %uz",
                    OCSP_cert_status_str(n), response.len);
 
-    if (staple->staple.data) {
-        ngx_free(staple->staple.data);
-    }
-
-    staple->staple = response;
-    staple->valid = valid;
+    ngx_ssl_stapling_set(staple, response.data, response.len, valid);
 
     /*
      * refresh before the response expires,
@@ -727,6 +971,8 @@ ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
     staple->loading = 0;
     staple->refresh = ngx_max(ngx_min(valid - 300, now + 3600), now + 300);
 
+    ngx_ssl_stapling_cache_store(staple, 1);
+
     ngx_ssl_ocsp_done(ctx);
     return;
 
@@ -735,6 +981,8 @@ error:
     staple->loading = 0;
     staple->refresh = now + 300;
 
+    ngx_ssl_stapling_cache_store(staple, 0);
+
     if (id) {
         OCSP_CERTID_free(id);
     }
@@ -751,6 +999,435 @@ error:
 }
 
 
+static void
+ngx_ssl_stapling_prefetch_handler(ngx_event_t *ev)
+{
+    time_t               delay;
+    ngx_ssl_stapling_t  *staple;
+
+    staple = ev->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "ssl stapling prefetch");
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    ngx_ssl_stapling_cache_sync(staple);
+    ngx_ssl_stapling_update(staple);
+
+    /*
+     * wake up when the response is to be refreshed; while a request
+     * is in progress, check again in a second
+     */
+
+    delay = staple->refresh - ngx_time();
+
+    if (staple->loading || delay <= 0) {
+        delay = 1;
+    }
+
+    ngx_add_timer(ev, (ngx_msec_t) delay * 1000);
+}
+
+
+/*
+ * the response is replaced under the lock, so a handshake thread
+ * never copies a freed or a partially updated response
+ */
+
+static void
+ngx_ssl_stapling_set(ngx_ssl_stapling_t *staple, u_char *data, size_t len,
+    time_t valid)
+{
+    u_char  *old;
+
+    ngx_ssl_stapling_lock(staple);
+
+    old = staple->staple.data;
+
+    staple->staple.data = data;
+    staple->staple.len = len;
+    staple->valid = valid;
+
+    ngx_ssl_stapling_unlock(staple);
+
+    if (old) {
+        ngx_free(old);
+    }
+}
+
+
+static void
+ngx_ssl_stapling_cache_sync(ngx_ssl_stapling_t *staple)
+{
+    u_char                    *p;
+    ngx_slab_pool_t           *shpool;
+    ngx_ssl_stapling_node_t   *sn;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    if (staple->shm_zone == NULL) {
+        return;
+    }
+
+    /*
+     * the version is only changed by a worker which updated the response,
+     * and the node is only freed after the generation of the cache changed
+     */
+
+    sn = staple->node;
+    cache = staple->shm_zone->data;
+
+    if (sn
+        && staple->generation == cache->generation
+        && sn->version == staple->version)
+    {
+        return;
+    }
+
+    shpool = (ngx_slab_pool_t *) staple->shm_zone->shm.addr;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = ngx_ssl_stapling_cache_node(staple);
+
+    if (sn == NULL || sn->version == staple->version) {
+        goto done;
+    }
+
+    if (sn->len) {
+        p = ngx_alloc(sn->len, ngx_cycle->log);
+        if (p == NULL) {
+            goto done;
+        }
+
+        ngx_memcpy(p, sn->data, sn->len);
+
+        ngx_ssl_stapling_set(staple, p, sn->len, sn->valid);
+    }
+
+    staple->refresh = sn->refresh;
+    staple->version = sn->version;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                   "ssl stapling cache sync: %uz, version %ui",
+                   staple->staple.len, staple->version);
+
+done:
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+static ngx_int_t
+ngx_ssl_stapling_cache_lock(ngx_ssl_stapling_t *staple)
+{
+    time_t                    now;
+    ngx_int_t                 rc;
+    ngx_slab_pool_t          *shpool;
+    ngx_ssl_stapling_node_t  *sn;
+
+    if (staple->shm_zone == NULL) {
+        return NGX_OK;
+    }
+
+    now = ngx_time();
+    rc = NGX_OK;
+
+    shpool = (ngx_slab_pool_t *) staple->shm_zone->shm.addr;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = ngx_ssl_stapling_cache_node(staple);
+
+    if (sn == NULL) {
+        /* no memory, the response is requested by each worker */
+        goto done;
+    }
+
+    if (sn->refresh > now) {
+        /* updated by another worker, synchronized on the next call */
+        rc = NGX_DECLINED;
+        goto done;
+    }
+
+    if (sn->loading > now) {
+
+        /* another worker requests the response, do not check until it fails */
+
+        staple->refresh = sn->loading;
+        rc = NGX_DECLINED;
+        goto done;
+    }
+
+    sn->loading = now + (staple->timeout + staple->resolver_timeout) / 1000
+                  + 1;
+
+done:
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    return rc;
+}
+
+
+static void
+ngx_ssl_stapling_cache_store(ngx_ssl_stapling_t *staple, ngx_uint_t response)
+{
+    u_char                    *p;
+    ngx_slab_pool_t           *shpool;
+    ngx_ssl_stapling_node_t   *sn;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    if (staple->shm_zone == NULL) {
+        return;
+    }
+
+    shpool = (ngx_slab_pool_t *) staple->shm_zone->shm.addr;
+    cache = staple->shm_zone->data;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = ngx_ssl_stapling_cache_node(staple);
+
+    if (sn == NULL) {
+        goto done;
+    }
+
+    if (response) {
+        p = ngx_slab_alloc_locked(shpool, staple->staple.len);
+
+        if (p == NULL) {
+
+            /* drop the least recently used nodes, except for our own */
+
+            ngx_ssl_stapling_cache_expire(cache, shpool, sn, 0);
+            staple->generation = cache->generation;
+
+            p = ngx_slab_alloc_locked(shpool, staple->staple.len);
+        }
+
+        if (p == NULL) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "could not allocate OCSP response%s",
+                          shpool->log_ctx);
+            sn->loading = 0;
+            goto done;
+        }
+
+        ngx_memcpy(p, staple->staple.data, staple->staple.len);
+
+        if (sn->data) {
+            ngx_slab_free_locked(shpool, sn->data);
+        }
+
+        sn->data = p;
+        sn->len = staple->staple.len;
+        sn->valid = staple->valid;
+    }
+
+    /* failures are shared too, so other workers do not retry at once */
+
+    sn->refresh = staple->refresh;
+    sn->loading = 0;
+    sn->version++;
+
+    staple->version = sn->version;
+
+done:
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+static ngx_ssl_stapling_node_t *
+ngx_ssl_stapling_cache_node(ngx_ssl_stapling_t *staple)
+{
+    uint32_t                   hash;
+    ngx_int_t                  rc;
+    ngx_slab_pool_t           *shpool;
+    ngx_rbtree_node_t         *node, *sentinel;
+    ngx_ssl_stapling_node_t   *sn;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    /* the shared memory mutex must be locked */
+
+    shpool = (ngx_slab_pool_t *) staple->shm_zone->shm.addr;
+    cache = staple->shm_zone->data;
+
+    sn = staple->node;
+
+    if (sn && staple->generation == cache->generation) {
+        goto found;
+    }
+
+    /* the node was freed or is not known yet, nothing is copied from it */
+
+    staple->node = NULL;
+    staple->generation = cache->generation;
+    staple->version = 0;
+
+    hash = ngx_crc32_short(staple->id, NGX_SSL_STAPLING_ID_LEN);
+
+    node = cache->rbtree.root;
+    sentinel = cache->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        sn = (ngx_ssl_stapling_node_t *) node;
+
+        rc = ngx_memcmp(staple->id, sn->id, NGX_SSL_STAPLING_ID_LEN);
+
+        if (rc == 0) {
+            staple->node = sn;
+            goto found;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* drop one or two expired nodes */
+
+    ngx_ssl_stapling_cache_expire(cache, shpool, NULL, 1);
+
+    sn = ngx_slab_calloc_locked(shpool, sizeof(ngx_ssl_stapling_node_t));
+
+    if (sn == NULL) {
+
+        /* drop the least recently used node of a full zone */
+
+        ngx_ssl_stapling_cache_expire(cache, shpool, NULL, 0);
+
+        sn = ngx_slab_calloc_locked(shpool, sizeof(ngx_ssl_stapling_node_t));
+        if (sn == NULL) {
+            return NULL;
+        }
+    }
+
+    sn->node.key = hash;
+    ngx_memcpy(sn->id, staple->id, NGX_SSL_STAPLING_ID_LEN);
+
+    ngx_rbtree_insert(&cache->rbtree, &sn->node);
+    ngx_queue_insert_head(&cache->expire_queue, &sn->queue);
+
+    staple->node = sn;
+
+found:
+
+    staple->generation = cache->generation;
+
+    sn->expire = ngx_time() + NGX_SSL_STAPLING_CACHE_EXPIRE;
+
+    ngx_queue_remove(&sn->queue);
+    ngx_queue_insert_head(&cache->expire_queue, &sn->queue);
+
+    return sn;
+}
+
+
+/*
+ * Nodes of certificates no longer used by any worker are dropped after
+ * they were not touched for NGX_SSL_STAPLING_CACHE_EXPIRE.  With n == 0
+ * the least recently used node is dropped even if it is not expired yet,
+ * as ngx_ssl_expire_sessions() does for the session cache.
+ */
+
+static void
+ngx_ssl_stapling_cache_expire(ngx_ssl_stapling_cache_t *cache,
+    ngx_slab_pool_t *shpool, ngx_ssl_stapling_node_t *keep, ngx_uint_t n)
+{
+    time_t                    now;
+    ngx_queue_t              *q;
+    ngx_ssl_stapling_node_t  *sn;
+
+    now = ngx_time();
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&cache->expire_queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->expire_queue);
+
+        sn = ngx_queue_data(q, ngx_ssl_stapling_node_t, queue);
+
+        if (sn == keep || (n++ != 0 && sn->expire > now)) {
+            return;
+        }
+
+        ngx_queue_remove(q);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                       "expire stapling cache node: %T", sn->expire);
+
+        ngx_rbtree_delete(&cache->rbtree, &sn->node);
+
+        if (sn->data) {
+            ngx_slab_free_locked(shpool, sn->data);
+        }
+
+        ngx_slab_free_locked(shpool, sn);
+
+        cache->generation++;
+    }
+}
+
+
+static void
+ngx_ssl_stapling_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t        **p;
+    ngx_ssl_stapling_node_t   *sn, *snt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            sn = (ngx_ssl_stapling_node_t *) node;
+            snt = (ngx_ssl_stapling_node_t *) temp;
+
+            p = (ngx_memcmp(sn->id, snt->id, NGX_SSL_STAPLING_ID_LEN) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
 static time_t
 ngx_ssl_stapling_time(ASN1_GENERALIZEDTIME *asn1time)
 {
@@ -1851,4 +2528,58 @@ ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
 }
 
 
+ngx_int_t
+ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone)
+{
+    return NGX_OK;
+}
+
+
+void
+ngx_ssl_stapling_prefetch(ngx_ssl_t *ssl)
+{
+    return;
+}
+
+
+#if (NGX_THREADS)
+
+void
+ngx_ssl_stapling_pending(ngx_connection_t *c)
+{
+    return;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_ssl_stapling_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    if (data) {
+        shm_zone->data = data;
+    }
+
+    return NGX_OK;
+}
+
+
 #endif
+
+
+ngx_shm_zone_t *
+ngx_ssl_stapling_cache_zone(ngx_conf_t *cf, ngx_str_t *name, size_t size)
+{
+    ngx_shm_zone_t  *shm_zone;
+
+    shm_zone = ngx_shared_memory_add(cf, name, size,
+                                     &ngx_ssl_stapling_cache_tag);
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
+    shm_zone->init = ngx_ssl_stapling_cache_init;
+
+    return shm_zone;
+}
@@ -388,9 +388,16 @@ ngx_http_gunzip_filter_get_buf(ngx_http_request_t *r,
 
         ctx->out_buf->flush = 0;
 
+        if (ctx->out_buf->start == NULL
+            && ngx_buf_cache_alloc(r->pool, ctx->out_buf, conf->bufs.size)
+               != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
     } else if (ctx->bufs < conf->bufs.num) {
 
-        ctx->out_buf = ngx_create_temp_buf(r->pool, conf->bufs.size);
+        ctx->out_buf = ngx_create_cached_buf(r->pool, conf->bufs.size);
         if (ctx->out_buf == NULL) {
             return NGX_ERROR;
         }
@@ -0,0 +1,901 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * log-linear histogram: values below NGX_HTTP_HISTOGRAM_SUB milliseconds
+ * have a bucket each, every next power of two is split into
+ * NGX_HTTP_HISTOGRAM_HALF linear buckets, so the relative error
+ * of a reported value does not exceed 1/NGX_HTTP_HISTOGRAM_HALF
+ */
+
+#define NGX_HTTP_HISTOGRAM_SUB_BITS   5
+#define NGX_HTTP_HISTOGRAM_SUB        (1 << NGX_HTTP_HISTOGRAM_SUB_BITS)
+#define NGX_HTTP_HISTOGRAM_HALF       (NGX_HTTP_HISTOGRAM_SUB / 2)
+#define NGX_HTTP_HISTOGRAM_BUCKETS                                            \
+    (NGX_HTTP_HISTOGRAM_SUB                                                   \
+     + (32 - NGX_HTTP_HISTOGRAM_SUB_BITS) * NGX_HTTP_HISTOGRAM_HALF)
+
+
+#define NGX_HTTP_HISTOGRAM_REQUEST_TIME    0
+#define NGX_HTTP_HISTOGRAM_CONNECT_TIME    1
+#define NGX_HTTP_HISTOGRAM_HEADER_TIME     2
+#define NGX_HTTP_HISTOGRAM_RESPONSE_TIME   3
+#define NGX_HTTP_HISTOGRAM_METRICS         4
+
+#define NGX_HTTP_HISTOGRAM_EXPIRE          3
+
+
+typedef struct {
+    uint64_t                      count;
+    uint64_t                      sum;
+    uint64_t                      max;
+    uint64_t                      buckets[NGX_HTTP_HISTOGRAM_BUCKETS];
+} ngx_http_histogram_t;
+
+
+typedef struct {
+    u_char                        color;
+    u_char                        len;
+    u_short                       reserved;
+    ngx_queue_t                   queue;
+    ngx_http_histogram_t          hist[NGX_HTTP_HISTOGRAM_METRICS];
+    u_char                        data[1];
+} ngx_http_histogram_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                  rbtree;
+    ngx_rbtree_node_t             sentinel;
+    ngx_queue_t                   queue;
+} ngx_http_histogram_shctx_t;
+
+
+typedef struct {
+    ngx_http_histogram_shctx_t   *sh;
+    ngx_slab_pool_t              *shpool;
+    ngx_uint_t                    full;   /* unsigned  full:1; */
+} ngx_http_histogram_ctx_t;
+
+
+typedef struct {
+    ngx_str_t                     name;
+    ngx_uint_t                    permille;
+} ngx_http_histogram_percentile_t;
+
+
+typedef struct {
+    ngx_shm_zone_t               *shm_zone;
+    ngx_http_complex_value_t     *key;
+    ngx_shm_zone_t               *status;
+} ngx_http_histogram_conf_t;
+
+
+static ngx_int_t ngx_http_histogram_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_histogram_status_handler(ngx_http_request_t *r);
+static ngx_http_histogram_node_t *ngx_http_histogram_alloc(
+    ngx_http_histogram_ctx_t *ctx, ngx_str_t *key, uint32_t hash,
+    ngx_log_t *log);
+static ngx_http_histogram_node_t *ngx_http_histogram_lookup(
+    ngx_http_histogram_ctx_t *ctx, ngx_str_t *key, uint32_t hash);
+static void ngx_http_histogram_add(ngx_http_histogram_t *h, ngx_msec_int_t ms);
+static ngx_uint_t ngx_http_histogram_index(uint32_t value);
+static uint64_t ngx_http_histogram_bound(ngx_uint_t index);
+static uint64_t ngx_http_histogram_percentile(ngx_http_histogram_t *h,
+    ngx_uint_t permille);
+static ngx_int_t ngx_http_histogram_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
+static void *ngx_http_histogram_create_conf(ngx_conf_t *cf);
+static char *ngx_http_histogram_merge_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_http_histogram_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_histogram(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_histogram_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_histogram_init(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_http_histogram_commands[] = {
+
+    { ngx_string("histogram_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_histogram_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("histogram"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_histogram,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("histogram_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_histogram_status,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_histogram_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_histogram_init,               /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_histogram_create_conf,        /* create location configuration */
+    ngx_http_histogram_merge_conf          /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_histogram_module = {
+    NGX_MODULE_V1,
+    &ngx_http_histogram_module_ctx,        /* module context */
+    ngx_http_histogram_commands,           /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_str_t  ngx_http_histogram_metrics[] = {
+    ngx_string("request_time"),
+    ngx_string("upstream_connect_time"),
+    ngx_string("upstream_header_time"),
+    ngx_string("upstream_response_time")
+};
+
+
+static ngx_http_histogram_percentile_t  ngx_http_histogram_percentiles[] = {
+    { ngx_string("p50"), 500 },
+    { ngx_string("p90"), 900 },
+    { ngx_string("p99"), 990 },
+    { ngx_string("p999"), 999 },
+    { ngx_null_string, 0 }
+};
+
+
+static ngx_int_t
+ngx_http_histogram_handler(ngx_http_request_t *r)
+{
+    uint32_t                     hash;
+    ngx_str_t                    key;
+    ngx_uint_t                   i;
+    ngx_time_t                  *tp;
+    ngx_msec_int_t               ms;
+    ngx_http_histogram_t        *hist;
+    ngx_http_histogram_ctx_t    *ctx;
+    ngx_http_histogram_node_t   *hn;
+    ngx_http_upstream_state_t   *state;
+    ngx_http_histogram_conf_t   *hcf;
+    ngx_http_core_loc_conf_t    *clcf;
+
+    hcf = ngx_http_get_module_loc_conf(r, ngx_http_histogram_module);
+
+    if (hcf->shm_zone == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (hcf->key) {
+        if (ngx_http_complex_value(r, hcf->key, &key) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+    } else {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+        key = clcf->name;
+    }
+
+    if (key.len == 0) {
+        return NGX_DECLINED;
+    }
+
+    if (key.len > 255) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "the value of the histogram key "
+                      "is more than 255 bytes: \"%V\"", &key);
+        return NGX_DECLINED;
+    }
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t)
+             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+
+    hash = ngx_crc32_short(key.data, key.len);
+
+    ctx = hcf->shm_zone->data;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    hn = ngx_http_histogram_lookup(ctx, &key, hash);
+
+    if (hn) {
+        ngx_queue_remove(&hn->queue);
+        ngx_queue_insert_head(&ctx->sh->queue, &hn->queue);
+
+    } else {
+        hn = ngx_http_histogram_alloc(ctx, &key, hash, r->connection->log);
+
+        if (hn == NULL) {
+            ngx_shmtx_unlock(&ctx->shpool->mutex);
+            return NGX_DECLINED;
+        }
+    }
+
+    hist = hn->hist;
+
+    ngx_http_histogram_add(&hist[NGX_HTTP_HISTOGRAM_REQUEST_TIME], ms);
+
+    if (r->upstream_states) {
+        state = r->upstream_states->elts;
+
+        for (i = 0; i < r->upstream_states->nelts; i++) {
+
+            if (state[i].status == 0) {
+                continue;
+            }
+
+            if (state[i].connect_time != (ngx_msec_t) -1) {
+                ngx_http_histogram_add(&hist[NGX_HTTP_HISTOGRAM_CONNECT_TIME],
+                                       state[i].connect_time);
+            }
+
+            if (state[i].header_time != (ngx_msec_t) -1) {
+                ngx_http_histogram_add(&hist[NGX_HTTP_HISTOGRAM_HEADER_TIME],
+                                       state[i].header_time);
+            }
+
+            ngx_http_histogram_add(&hist[NGX_HTTP_HISTOGRAM_RESPONSE_TIME],
+                                   state[i].response_time);
+        }
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "histogram: \"%V\" %08XD %M", &key, hash, ms);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_histogram_add(ngx_http_histogram_t *h, ngx_msec_int_t ms)
+{
+    uint32_t  value;
+
+    if (ms < 0) {
+        value = 0;
+
+    } else if ((uint64_t) ms > 0xffffffff) {
+        value = 0xffffffff;
+
+    } else {
+        value = (uint32_t) ms;
+    }
+
+    h->count++;
+    h->sum += value;
+
+    if (h->max < value) {
+        h->max = value;
+    }
+
+    h->buckets[ngx_http_histogram_index(value)]++;
+}
+
+
+static ngx_uint_t
+ngx_http_histogram_index(uint32_t value)
+{
+    ngx_uint_t  shift;
+
+    if (value < NGX_HTTP_HISTOGRAM_SUB) {
+        return value;
+    }
+
+    shift = 1;
+
+    while ((value >> shift) >= NGX_HTTP_HISTOGRAM_SUB) {
+        shift++;
+    }
+
+    return NGX_HTTP_HISTOGRAM_SUB + (shift - 1) * NGX_HTTP_HISTOGRAM_HALF
+           + (value >> shift) - NGX_HTTP_HISTOGRAM_HALF;
+}
+
+
+static uint64_t
+ngx_http_histogram_bound(ngx_uint_t index)
+{
+    ngx_uint_t  shift;
+
+    /* the largest value which falls into the bucket */
+
+    if (index < NGX_HTTP_HISTOGRAM_SUB) {
+        return index;
+    }
+
+    index -= NGX_HTTP_HISTOGRAM_SUB;
+    shift = index / NGX_HTTP_HISTOGRAM_HALF + 1;
+
+    return (((uint64_t) (index % NGX_HTTP_HISTOGRAM_HALF)
+             + NGX_HTTP_HISTOGRAM_HALF + 1) << shift) - 1;
+}
+
+
+static uint64_t
+ngx_http_histogram_percentile(ngx_http_histogram_t *h, ngx_uint_t permille)
+{
+    uint64_t    rank, seen, value;
+    ngx_uint_t  i;
+
+    if (h->count == 0) {
+        return 0;
+    }
+
+    rank = (h->count * permille + 999) / 1000;
+    seen = 0;
+
+    for (i = 0; i < NGX_HTTP_HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+
+        if (seen >= rank) {
+            value = ngx_http_histogram_bound(i);
+            return ngx_min(value, h->max);
+        }
+    }
+
+    return h->max;
+}
+
+
+static ngx_int_t
+ngx_http_histogram_status_handler(ngx_http_request_t *r)
+{
+    size_t                            size;
+    ngx_int_t                         rc;
+    ngx_buf_t                        *b;
+    ngx_uint_t                        k, nodes;
+    ngx_chain_t                       out;
+    ngx_queue_t                      *q;
+    ngx_http_histogram_t             *h;
+    ngx_http_histogram_ctx_t         *ctx;
+    ngx_http_histogram_node_t        *hn;
+    ngx_http_histogram_conf_t        *hcf;
+    ngx_http_histogram_percentile_t  *pc;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    hcf = ngx_http_get_module_loc_conf(r, ngx_http_histogram_module);
+    ctx = hcf->status->data;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    nodes = 0;
+
+    for (q = ngx_queue_head(&ctx->sh->queue);
+         q != ngx_queue_sentinel(&ctx->sh->queue);
+         q = ngx_queue_next(q))
+    {
+        nodes++;
+    }
+
+    size = sizeof("key \"\"\n") + 255
+           + NGX_HTTP_HISTOGRAM_METRICS
+             * (sizeof("upstream_response_time count= sum= max="
+                       " p50= p90= p99= p999=\n") - 1
+                + 7 * NGX_INT64_LEN);
+
+    size *= nodes;
+
+    b = ngx_create_temp_buf(r->pool, size ? size : 1);
+    if (b == NULL) {
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    for (q = ngx_queue_head(&ctx->sh->queue);
+         q != ngx_queue_sentinel(&ctx->sh->queue);
+         q = ngx_queue_next(q))
+    {
+        hn = ngx_queue_data(q, ngx_http_histogram_node_t, queue);
+
+        b->last = ngx_sprintf(b->last, "key \"%*s\"\n",
+                              (size_t) hn->len, hn->data);
+
+        for (k = 0; k < NGX_HTTP_HISTOGRAM_METRICS; k++) {
+            h = &hn->hist[k];
+
+            if (h->count == 0) {
+                continue;
+            }
+
+            b->last = ngx_sprintf(b->last, "%V count=%uL sum=%uL max=%uL",
+                                  &ngx_http_histogram_metrics[k],
+                                  h->count, h->sum, h->max);
+
+            for (pc = ngx_http_histogram_percentiles; pc->name.len; pc++) {
+                b->last = ngx_sprintf(b->last, " %V=%uL", &pc->name,
+                                ngx_http_histogram_percentile(h, pc->permille));
+            }
+
+            *b->last++ = LF;
+        }
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    out.buf = b;
+    out.next = NULL;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static void
+ngx_http_histogram_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t          **p;
+    ngx_http_histogram_node_t   *hn, *hnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            hn = (ngx_http_histogram_node_t *) &node->color;
+            hnt = (ngx_http_histogram_node_t *) &temp->color;
+
+            p = (ngx_memn2cmp(hn->data, hnt->data, hn->len, hnt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+/*
+ * the least recently used keys are dropped to make room for a new one;
+ * if that does not help, the zone is reported as full once per process
+ */
+
+static ngx_http_histogram_node_t *
+ngx_http_histogram_alloc(ngx_http_histogram_ctx_t *ctx, ngx_str_t *key,
+    uint32_t hash, ngx_log_t *log)
+{
+    size_t                      n;
+    ngx_uint_t                  i;
+    ngx_queue_t                *q;
+    ngx_rbtree_node_t          *node;
+    ngx_http_histogram_node_t  *hn;
+
+    n = offsetof(ngx_rbtree_node_t, color)
+        + offsetof(ngx_http_histogram_node_t, data)
+        + key->len;
+
+    for (i = 0; /* void */ ; i++) {
+
+        node = ngx_slab_calloc_locked(ctx->shpool, n);
+
+        if (node) {
+            break;
+        }
+
+        if (i == NGX_HTTP_HISTOGRAM_EXPIRE
+            || ngx_queue_empty(&ctx->sh->queue))
+        {
+            if (!ctx->full) {
+                ctx->full = 1;
+
+                ngx_log_error(NGX_LOG_ERR, log, 0,
+                              "histogram zone is full, new keys are not "
+                              "counted%s", ctx->shpool->log_ctx);
+            }
+
+            return NULL;
+        }
+
+        q = ngx_queue_last(&ctx->sh->queue);
+
+        hn = ngx_queue_data(q, ngx_http_histogram_node_t, queue);
+
+        ngx_queue_remove(q);
+
+        node = (ngx_rbtree_node_t *)
+                   ((u_char *) hn - offsetof(ngx_rbtree_node_t, color));
+
+        ngx_rbtree_delete(&ctx->sh->rbtree, node);
+
+        ngx_slab_free_locked(ctx->shpool, node);
+    }
+
+    hn = (ngx_http_histogram_node_t *) &node->color;
+
+    node->key = hash;
+    hn->len = (u_char) key->len;
+    ngx_memcpy(hn->data, key->data, key->len);
+
+    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+    ngx_queue_insert_head(&ctx->sh->queue, &hn->queue);
+
+    return hn;
+}
+
+
+static ngx_http_histogram_node_t *
+ngx_http_histogram_lookup(ngx_http_histogram_ctx_t *ctx, ngx_str_t *key,
+    uint32_t hash)
+{
+    ngx_int_t                   rc;
+    ngx_rbtree_node_t          *node, *sentinel;
+    ngx_http_histogram_node_t  *hn;
+
+    node = ctx->sh->rbtree.root;
+    sentinel = ctx->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        hn = (ngx_http_histogram_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(key->data, hn->data, key->len, (size_t) hn->len);
+
+        if (rc == 0) {
+            return hn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_histogram_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_histogram_ctx_t  *octx = data;
+
+    size_t                     len;
+    ngx_http_histogram_ctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_histogram_shctx_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
+                    ngx_http_histogram_rbtree_insert_value);
+
+    ngx_queue_init(&ctx->sh->queue);
+
+    ctx->shpool->log_nomem = 0;
+
+    len = sizeof(" in histogram zone \"\"") + shm_zone->shm.name.len;
+
+    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ctx->shpool->log_ctx, " in histogram zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_histogram_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_histogram_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_histogram_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->key = NULL;
+     *     conf->status = NULL;
+     */
+
+    conf->shm_zone = NGX_CONF_UNSET_PTR;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_histogram_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_histogram_conf_t *prev = parent;
+    ngx_http_histogram_conf_t *conf = child;
+
+    if (conf->shm_zone == NGX_CONF_UNSET_PTR) {
+        conf->shm_zone = prev->shm_zone;
+        conf->key = prev->key;
+    }
+
+    ngx_conf_merge_ptr_value(conf->shm_zone, prev->shm_zone, NULL);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_histogram_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    u_char                    *p;
+    ssize_t                    size;
+    ngx_str_t                 *value, name, s;
+    ngx_shm_zone_t            *shm_zone;
+    ngx_http_histogram_ctx_t  *ctx;
+
+    value = cf->args->elts;
+
+    if (ngx_strncmp(value[1].data, "zone=", 5) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.data = value[1].data + 5;
+
+    p = (u_char *) ngx_strchr(name.data, ':');
+
+    if (p == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.len = p - name.data;
+
+    s.data = p + 1;
+    s.len = value[1].data + value[1].len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_histogram_ctx_t));
+    if (ctx == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_histogram_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_histogram_init_zone;
+    shm_zone->data = ctx;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_histogram(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_histogram_conf_t *hcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_http_compile_complex_value_t   ccv;
+
+    if (hcf->shm_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        hcf->shm_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    hcf->shm_zone = ngx_shared_memory_add(cf, &value[1], 0,
+                                          &ngx_http_histogram_module);
+    if (hcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts == 2) {
+        return NGX_CONF_OK;
+    }
+
+    hcf->key = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+    if (hcf->key == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[2];
+    ccv.complex_value = hcf->key;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_histogram_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t                  *value;
+    ngx_http_core_loc_conf_t   *clcf;
+    ngx_http_histogram_conf_t  *hcf;
+
+    value = cf->args->elts;
+
+    hcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_histogram_module);
+
+    if (hcf->status) {
+        return "is duplicate";
+    }
+
+    hcf->status = ngx_shared_memory_add(cf, &value[1], 0,
+                                        &ngx_http_histogram_module);
+    if (hcf->status == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_histogram_status_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_histogram_init(ngx_conf_t *cf)
+{
+    ngx_http_handler_pt        *h;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_histogram_handler;
+
+    return NGX_OK;
+}
@@ -680,6 +680,80 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 }
 
 
+static ngx_int_t
+ngx_http_limit_req_resize_zone(ngx_shm_zone_t *shm_zone,
+    ngx_shm_zone_t *oshm_zone)
+{
+    ngx_http_limit_req_ctx_t  *octx = oshm_zone->data;
+
+    size_t                      size;
+    ngx_uint_t                  n;
+    ngx_queue_t                *q;
+    ngx_rbtree_node_t          *node, *onode;
+    ngx_http_limit_req_ctx_t   *ctx;
+    ngx_http_limit_req_node_t  *lr, *olr;
+
+    ctx = shm_zone->data;
+
+    if (ctx->key.value.len != octx->key.value.len
+        || ngx_strncmp(ctx->key.value.data, octx->key.value.data,
+                       ctx->key.value.len)
+           != 0)
+    {
+        return NGX_OK;
+    }
+
+    /*
+     * the states are copied starting from the most recently used ones,
+     * so a smaller zone drops the oldest states
+     */
+
+    n = 0;
+
+    ngx_shmtx_lock(&octx->shpool->mutex);
+
+    for (q = ngx_queue_head(&octx->sh->queue);
+         q != ngx_queue_sentinel(&octx->sh->queue);
+         q = ngx_queue_next(q))
+    {
+        olr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
+
+        onode = (ngx_rbtree_node_t *)
+                    ((u_char *) olr - offsetof(ngx_rbtree_node_t, color));
+
+        size = offsetof(ngx_rbtree_node_t, color)
+               + offsetof(ngx_http_limit_req_node_t, data)
+               + olr->len;
+
+        node = ngx_slab_alloc_locked(ctx->shpool, size);
+        if (node == NULL) {
+            break;
+        }
+
+        ngx_memcpy(node, onode, size);
+
+        lr = (ngx_http_limit_req_node_t *) &node->color;
+
+        /* the requests delayed in the old zone are accounted there */
+
+        lr->count = 0;
+
+        ngx_rbtree_insert(&ctx->sh->rbtree, node);
+        ngx_queue_insert_tail(&ctx->sh->queue, &lr->queue);
+
+        n++;
+    }
+
+    ngx_shmtx_unlock(&octx->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, shm_zone->shm.log, 0,
+                   "limit_req zone \"%V\": %ui states copied",
+                   &shm_zone->shm.name, n);
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_http_limit_req_create_conf(ngx_conf_t *cf)
 {
@@ -851,6 +925,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     shm_zone->init = ngx_http_limit_req_init_zone;
+    shm_zone->resize = ngx_http_limit_req_resize_zone;
     shm_zone->data = ctx;
 
     return NGX_CONF_OK;
@@ -52,9 +52,41 @@ typedef struct {
     ngx_event_t                *event;
     ngx_msec_t                  flush;
     ngx_int_t                   gzip;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+    ngx_thread_task_t          *free;
+    ngx_uint_t                  tasks;
+    ngx_uint_t                  dropped;
+    time_t                      error_log_time;
+#endif
 } ngx_http_log_buf_t;
 
 
+#if (NGX_THREADS)
+
+/*
+ * a buffer is handed to a thread task as a whole and replaced with
+ * the spare memory of the task, so at most NGX_HTTP_LOG_THREAD_TASKS
+ * buffers of a log may wait for the disk, and the following ones are dropped
+ */
+
+#define NGX_HTTP_LOG_THREAD_TASKS  8
+
+
+typedef struct {
+    ngx_open_file_t            *file;
+    ngx_http_log_buf_t         *buffer;
+    ngx_fd_t                    fd;
+    u_char                     *start;
+    size_t                      len;
+    ssize_t                     n;
+    ngx_err_t                   err;
+} ngx_http_log_thread_ctx_t;
+
+#endif
+
+
 typedef struct {
     ngx_array_t                *lengths;
     ngx_array_t                *values;
@@ -90,6 +122,31 @@ typedef struct {
 } ngx_http_log_var_t;
 
 
+/*
+ * the escape scanners test 8 bytes at once: a word is skipped as a whole
+ * if none of its bytes is a control character, a quote, or a backslash
+ */
+
+#define NGX_HTTP_LOG_WORD_ONES    ((uint64_t) 0x0101010101010101)
+#define NGX_HTTP_LOG_WORD_HIGHS   ((uint64_t) 0x8080808080808080)
+
+#define ngx_http_log_word_has_less(w, n)                                      \
+    (((w) - NGX_HTTP_LOG_WORD_ONES * (n)) & ~(w) & NGX_HTTP_LOG_WORD_HIGHS)
+
+#define ngx_http_log_word_has_byte(w, c)                                      \
+    ngx_http_log_word_has_less((w) ^ (NGX_HTTP_LOG_WORD_ONES * (c)), 1)
+
+#define ngx_http_log_word_json_clean(w)                                       \
+    (!(ngx_http_log_word_has_less(w, 0x20)                                    \
+       | ngx_http_log_word_has_byte(w, '"')                                   \
+       | ngx_http_log_word_has_byte(w, '\\')))
+
+#define ngx_http_log_word_clean(w)                                            \
+    (!((w) & NGX_HTTP_LOG_WORD_HIGHS)                                         \
+     && !ngx_http_log_word_has_byte(w, 0x7f)                                  \
+     && ngx_http_log_word_json_clean(w))
+
+
 static void ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log,
     u_char *buf, size_t len);
 static ssize_t ngx_http_log_script_write(ngx_http_request_t *r,
@@ -106,6 +163,12 @@ static void ngx_http_log_gzip_free(void *opaque, void *address);
 static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_http_log_flush_handler(ngx_event_t *ev);
 
+#if (NGX_THREADS)
+static void ngx_http_log_thread_flush(ngx_open_file_t *file, ngx_log_t *log);
+static void ngx_http_log_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_log_thread_event_handler(ngx_event_t *ev);
+#endif
+
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_time(ngx_http_request_t *r, u_char *buf,
@@ -118,6 +181,9 @@ static u_char *ngx_http_log_request_time(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_status(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
+static u_char *ngx_http_log_json_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static ngx_uint_t ngx_http_log_status_code(ngx_http_request_t *r);
 static u_char *ngx_http_log_bytes_sent(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_body_bytes_sent(ngx_http_request_t *r,
@@ -132,6 +198,13 @@ static size_t ngx_http_log_variable_getlen(ngx_http_request_t *r,
 static u_char *ngx_http_log_variable(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static uintptr_t ngx_http_log_escape(u_char *dst, u_char *src, size_t size);
+static size_t ngx_http_log_json_variable_getlen(ngx_http_request_t *r,
+    uintptr_t data);
+static u_char *ngx_http_log_json_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static uintptr_t ngx_http_log_json_escape(u_char *dst, u_char *src,
+    size_t size);
+static u_char *ngx_http_log_uint(u_char *buf, uint64_t n);
 
 
 static void *ngx_http_log_create_main_conf(ngx_conf_t *cf);
@@ -144,6 +217,12 @@ static char *ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_log_compile_format(ngx_conf_t *cf,
     ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s);
+static char *ngx_http_log_compile_json(ngx_conf_t *cf, ngx_array_t *flushes,
+    ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s);
+static ngx_int_t ngx_http_log_json_literal(ngx_array_t *json, u_char *data,
+    size_t len);
+static ngx_int_t ngx_http_log_compile_literal(ngx_conf_t *cf,
+    ngx_http_log_op_t *op, u_char *data, size_t len);
 static char *ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_log_init(ngx_conf_t *cf);
@@ -314,8 +393,16 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
             if (len > (size_t) (buffer->last - buffer->pos)) {
 
-                ngx_http_log_write(r, &log[l], buffer->start,
-                                   buffer->pos - buffer->start);
+#if (NGX_THREADS)
+                if (buffer->thread_pool) {
+                    ngx_http_log_thread_flush(log[l].file, r->connection->log);
+
+                } else
+#endif
+                {
+                    ngx_http_log_write(r, &log[l], buffer->start,
+                                       buffer->pos - buffer->start);
+                }
 
                 buffer->pos = buffer->start;
             }
@@ -712,6 +799,13 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
         return;
     }
 
+#if (NGX_THREADS)
+    if (buffer->thread_pool) {
+        ngx_http_log_thread_flush(file, log);
+        return;
+    }
+#endif
+
 #if (NGX_ZLIB)
     if (buffer->gzip) {
         n = ngx_http_log_gzip(file->fd, buffer->start, len, buffer->gzip, log);
@@ -764,6 +858,176 @@ ngx_http_log_flush_handler(ngx_event_t *ev)
 }
 
 
+#if (NGX_THREADS)
+
+static void
+ngx_http_log_thread_flush(ngx_open_file_t *file, ngx_log_t *log)
+{
+    u_char                     *start;
+    ngx_fd_t                    fd;
+    ngx_thread_task_t          *task;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+
+    buffer = file->data;
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
+
+    if (buffer->pos == buffer->start) {
+        return;
+    }
+
+    task = buffer->free;
+
+    if (task) {
+        buffer->free = task->next;
+
+    } else if (buffer->tasks < NGX_HTTP_LOG_THREAD_TASKS) {
+
+        task = ngx_thread_task_alloc(ngx_cycle->pool,
+                                     sizeof(ngx_http_log_thread_ctx_t));
+        if (task == NULL) {
+            goto drop;
+        }
+
+        ctx = task->ctx;
+
+        ctx->start = ngx_pnalloc(ngx_cycle->pool,
+                                 buffer->last - buffer->start);
+        if (ctx->start == NULL) {
+            goto drop;
+        }
+
+        ctx->file = file;
+        ctx->buffer = buffer;
+
+        task->handler = ngx_http_log_thread_handler;
+        task->event.data = task;
+        task->event.handler = ngx_http_log_thread_event_handler;
+        task->event.log = ngx_cycle->log;
+
+        buffer->tasks++;
+
+    } else {
+        goto drop;
+    }
+
+    /*
+     * the file may be reopened while the task waits in the queue,
+     * so the task writes to a duplicate of the descriptor
+     */
+
+    fd = dup(file->fd);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "dup() of \"%s\" failed", file->name.data);
+
+        task->next = buffer->free;
+        buffer->free = task;
+
+        goto drop;
+    }
+
+    ctx = task->ctx;
+
+    ctx->fd = fd;
+    ctx->len = buffer->pos - buffer->start;
+
+    start = ctx->start;
+    ctx->start = buffer->start;
+
+    if (ngx_thread_task_post(buffer->thread_pool, task) != NGX_OK) {
+        ctx->start = start;
+
+        (void) ngx_close_file(fd);
+
+        task->next = buffer->free;
+        buffer->free = task;
+
+        goto drop;
+    }
+
+    buffer->last = start + (buffer->last - buffer->start);
+    buffer->start = start;
+    buffer->pos = start;
+
+    return;
+
+drop:
+
+    buffer->dropped++;
+    buffer->pos = buffer->start;
+
+    if (ngx_time() - buffer->error_log_time > 59) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "access log \"%s\" is not written fast enough, "
+                      "%ui buffers dropped", file->name.data, buffer->dropped);
+
+        buffer->error_log_time = ngx_time();
+    }
+}
+
+
+static void
+ngx_http_log_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_log_thread_ctx_t *ctx = data;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "http log thread write: %d, %uz", ctx->fd, ctx->len);
+
+#if (NGX_ZLIB)
+    if (ctx->buffer->gzip) {
+        ctx->n = ngx_http_log_gzip(ctx->fd, ctx->start, ctx->len,
+                                   ctx->buffer->gzip, log);
+    } else {
+        ctx->n = ngx_write_fd(ctx->fd, ctx->start, ctx->len);
+    }
+#else
+    ctx->n = ngx_write_fd(ctx->fd, ctx->start, ctx->len);
+#endif
+
+    ctx->err = (ctx->n == -1) ? ngx_errno : 0;
+
+    (void) ngx_close_file(ctx->fd);
+}
+
+
+static void
+ngx_http_log_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_thread_task_t          *task;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+
+    task = ev->data;
+    ctx = task->ctx;
+    buffer = ctx->buffer;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http log thread write done: %z", ctx->n);
+
+    if (ctx->n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, ctx->err,
+                      ngx_write_fd_n " to \"%s\" failed",
+                      ctx->file->name.data);
+
+    } else if ((size_t) ctx->n != ctx->len) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                      ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
+                      ctx->file->name.data, ctx->n, ctx->len);
+    }
+
+    task->next = buffer->free;
+    buffer->free = task;
+}
+
+#endif
+
+
 static u_char *
 ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
@@ -825,7 +1089,14 @@ ngx_http_log_msec(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
 
     tp = ngx_timeofday();
 
-    return ngx_sprintf(buf, "%T.%03M", tp->sec, tp->msec);
+    buf = ngx_http_log_uint(buf, tp->sec);
+
+    *buf++ = '.';
+    *buf++ = (u_char) ('0' + tp->msec / 100);
+    *buf++ = (u_char) ('0' + tp->msec / 10 % 10);
+    *buf++ = (u_char) ('0' + tp->msec % 10);
+
+    return buf;
 }
 
 
@@ -842,7 +1113,16 @@ ngx_http_log_request_time(ngx_http_request_t *r, u_char *buf,
              ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
     ms = ngx_max(ms, 0);
 
-    return ngx_sprintf(buf, "%T.%03M", (time_t) ms / 1000, ms % 1000);
+    buf = ngx_http_log_uint(buf, ms / 1000);
+
+    ms %= 1000;
+
+    *buf++ = '.';
+    *buf++ = (u_char) ('0' + ms / 100);
+    *buf++ = (u_char) ('0' + ms / 10 % 10);
+    *buf++ = (u_char) ('0' + ms % 10);
+
+    return buf;
 }
 
 
@@ -851,20 +1131,46 @@ ngx_http_log_status(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
 {
     ngx_uint_t  status;
 
-    if (r->err_status) {
-        status = r->err_status;
+    status = ngx_http_log_status_code(r);
 
-    } else if (r->headers_out.status) {
-        status = r->headers_out.status;
+    if (status > 999) {
+        return ngx_http_log_uint(buf, status);
+    }
 
-    } else if (r->http_version == NGX_HTTP_VERSION_9) {
-        status = 9;
+    *buf++ = (u_char) ('0' + status / 100);
+    *buf++ = (u_char) ('0' + status / 10 % 10);
+    *buf++ = (u_char) ('0' + status % 10);
 
-    } else {
-        status = 0;
+    return buf;
+}
+
+
+/* a JSON number must not have leading zeros */
+
+static u_char *
+ngx_http_log_json_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_uint(buf, ngx_http_log_status_code(r));
+}
+
+
+static ngx_uint_t
+ngx_http_log_status_code(ngx_http_request_t *r)
+{
+    if (r->err_status) {
+        return r->err_status;
     }
 
-    return ngx_sprintf(buf, "%03ui", status);
+    if (r->headers_out.status) {
+        return r->headers_out.status;
+    }
+
+    if (r->http_version == NGX_HTTP_VERSION_9) {
+        return 9;
+    }
+
+    return 0;
 }
 
 
@@ -872,7 +1178,7 @@ static u_char *
 ngx_http_log_bytes_sent(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
 {
-    return ngx_sprintf(buf, "%O", r->connection->sent);
+    return ngx_http_log_uint(buf, r->connection->sent);
 }
 
 
@@ -890,7 +1196,7 @@ ngx_http_log_body_bytes_sent(ngx_http_request_t *r, u_char *buf,
     length = r->connection->sent - r->header_size;
 
     if (length > 0) {
-        return ngx_sprintf(buf, "%O", length);
+        return ngx_http_log_uint(buf, length);
     }
 
     *buf = '0';
@@ -903,7 +1209,27 @@ static u_char *
 ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
 {
-    return ngx_sprintf(buf, "%O", r->request_length);
+    return ngx_http_log_uint(buf, r->request_length);
+}
+
+
+/*
+ * the numeric operation codes are run for every logged request,
+ * so the numbers are written directly instead of via ngx_sprintf()
+ */
+
+static u_char *
+ngx_http_log_uint(u_char *buf, uint64_t n)
+{
+    u_char  *p, temp[NGX_INT64_LEN];
+
+    p = temp + NGX_INT64_LEN;
+
+    do {
+        *--p = (u_char) (n % 10 + '0');
+    } while (n /= 10);
+
+    return ngx_cpymem(buf, p, temp + NGX_INT64_LEN - p);
 }
 
 
@@ -971,6 +1297,7 @@ ngx_http_log_variable(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
 static uintptr_t
 ngx_http_log_escape(u_char *dst, u_char *src, size_t size)
 {
+    uint64_t        w;
     ngx_uint_t      n;
     static u_char   hex[] = "0123456789ABCDEF";
 
@@ -1000,6 +1327,17 @@ ngx_http_log_escape(u_char *dst, u_char *src, size_t size)
         n = 0;
 
         while (size) {
+
+            if (size >= sizeof(uint64_t)) {
+                ngx_memcpy(&w, src, sizeof(uint64_t));
+
+                if (ngx_http_log_word_clean(w)) {
+                    src += sizeof(uint64_t);
+                    size -= sizeof(uint64_t);
+                    continue;
+                }
+            }
+
             if (escape[*src >> 5] & (1U << (*src & 0x1f))) {
                 n++;
             }
@@ -1011,6 +1349,18 @@ ngx_http_log_escape(u_char *dst, u_char *src, size_t size)
     }
 
     while (size) {
+
+        if (size >= sizeof(uint64_t)) {
+            ngx_memcpy(&w, src, sizeof(uint64_t));
+
+            if (ngx_http_log_word_clean(w)) {
+                dst = ngx_cpymem(dst, src, sizeof(uint64_t));
+                src += sizeof(uint64_t);
+                size -= sizeof(uint64_t);
+                continue;
+            }
+        }
+
         if (escape[*src >> 5] & (1U << (*src & 0x1f))) {
             *dst++ = '\\';
             *dst++ = 'x';
@@ -1028,6 +1378,163 @@ ngx_http_log_escape(u_char *dst, u_char *src, size_t size)
 }
 
 
+static size_t
+ngx_http_log_json_variable_getlen(ngx_http_request_t *r, uintptr_t data)
+{
+    uintptr_t                   len;
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, data);
+
+    if (value == NULL || value->not_found) {
+        return 0;
+    }
+
+    len = ngx_http_log_json_escape(NULL, value->data, value->len);
+
+    value->escape = len ? 1 : 0;
+
+    return value->len + len;
+}
+
+
+static u_char *
+ngx_http_log_json_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, op->data);
+
+    if (value == NULL || value->not_found) {
+        return buf;
+    }
+
+    if (value->escape == 0) {
+        return ngx_cpymem(buf, value->data, value->len);
+
+    } else {
+        return (u_char *) ngx_http_log_json_escape(buf, value->data,
+                                                   value->len);
+    }
+}
+
+
+static uintptr_t
+ngx_http_log_json_escape(u_char *dst, u_char *src, size_t size)
+{
+    u_char      ch;
+    uint64_t    w;
+    ngx_uint_t  len;
+
+    if (dst == NULL) {
+
+        /* find the number of the extra characters */
+
+        len = 0;
+
+        while (size) {
+
+            if (size >= sizeof(uint64_t)) {
+                ngx_memcpy(&w, src, sizeof(uint64_t));
+
+                if (ngx_http_log_word_json_clean(w)) {
+                    src += sizeof(uint64_t);
+                    size -= sizeof(uint64_t);
+                    continue;
+                }
+            }
+
+            ch = *src++;
+            size--;
+
+            if (ch == '\\' || ch == '"') {
+                len++;
+
+            } else if (ch <= 0x1f) {
+
+                switch (ch) {
+                case '\n':
+                case '\r':
+                case '\t':
+                case '\b':
+                case '\f':
+                    len++;
+                    break;
+
+                default:
+                    len += sizeof("\\u001F") - 2;
+                }
+            }
+        }
+
+        return (uintptr_t) len;
+    }
+
+    while (size) {
+
+        if (size >= sizeof(uint64_t)) {
+            ngx_memcpy(&w, src, sizeof(uint64_t));
+
+            if (ngx_http_log_word_json_clean(w)) {
+                dst = ngx_cpymem(dst, src, sizeof(uint64_t));
+                src += sizeof(uint64_t);
+                size -= sizeof(uint64_t);
+                continue;
+            }
+        }
+
+        ch = *src++;
+        size--;
+
+        if (ch > 0x1f) {
+
+            if (ch == '\\' || ch == '"') {
+                *dst++ = '\\';
+            }
+
+            *dst++ = ch;
+
+            continue;
+        }
+
+        *dst++ = '\\';
+
+        switch (ch) {
+        case '\n':
+            *dst++ = 'n';
+            break;
+
+        case '\r':
+            *dst++ = 'r';
+            break;
+
+        case '\t':
+            *dst++ = 't';
+            break;
+
+        case '\b':
+            *dst++ = 'b';
+            break;
+
+        case '\f':
+            *dst++ = 'f';
+            break;
+
+        default:
+            *dst++ = 'u'; *dst++ = '0'; *dst++ = '0';
+            *dst++ = '0' + (ch >> 4);
+
+            ch &= 0xf;
+
+            *dst++ = (ch < 10) ? ('0' + ch) : ('A' + ch - 10);
+        }
+    }
+
+    return (uintptr_t) dst;
+}
+
+
 static void *
 ngx_http_log_create_main_conf(ngx_conf_t *cf)
 {
@@ -1157,6 +1664,9 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_log_main_conf_t          *lmcf;
     ngx_http_script_compile_t          sc;
     ngx_http_compile_complex_value_t   ccv;
+#if (NGX_THREADS)
+    ngx_thread_pool_t                 *tp;
+#endif
 
     value = cf->args->elts;
 
@@ -1270,6 +1780,9 @@ process_formats:
     size = 0;
     flush = 0;
     gzip = 0;
+#if (NGX_THREADS)
+    tp = NULL;
+#endif
 
     for (i = 3; i < cf->args->nelts; i++) {
 
@@ -1336,6 +1849,32 @@ process_formats:
 #endif
         }
 
+        if (ngx_strncmp(value[i].data, "threads", 7) == 0
+            && (value[i].len == 7 || value[i].data[7] == '='))
+        {
+#if (NGX_THREADS)
+            if (value[i].len == 7) {
+                tp = ngx_thread_pool_add(cf, NULL);
+
+            } else {
+                s.len = value[i].len - 8;
+                s.data = value[i].data + 8;
+
+                tp = ngx_thread_pool_add(cf, &s);
+            }
+
+            if (tp == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "nginx was built without threads support");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         if (ngx_strncmp(value[i].data, "if=", 3) == 0) {
             s.len = value[i].len - 3;
             s.data = value[i].data + 3;
@@ -1371,6 +1910,15 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_THREADS)
+    if (tp && size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no buffer is defined for access_log \"%V\"",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+#endif
+
     if (size) {
 
         if (log->script) {
@@ -1390,7 +1938,11 @@ process_formats:
 
             if (buffer->last - buffer->start != size
                 || buffer->flush != flush
-                || buffer->gzip != gzip)
+                || buffer->gzip != gzip
+#if (NGX_THREADS)
+                || buffer->thread_pool != tp
+#endif
+                )
             {
                 ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                    "access_log \"%V\" already defined "
@@ -1431,6 +1983,10 @@ process_formats:
 
         buffer->gzip = gzip;
 
+#if (NGX_THREADS)
+        buffer->thread_pool = tp;
+#endif
+
         log->file->flush = ngx_http_log_flush;
         log->file->data = buffer;
     }
@@ -1479,6 +2035,20 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (ngx_strcmp(value[2].data, "format=json") == 0) {
+
+        if (cf->args->nelts < 5 || cf->args->nelts % 2 == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "JSON log format \"%V\" must be specified "
+                               "as pairs of field names and values",
+                               &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        return ngx_http_log_compile_json(cf, fmt->flushes, fmt->ops,
+                                         cf->args, 3);
+    }
+
     return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops, cf->args, 2);
 }
 
@@ -1487,7 +2057,7 @@ static char *
 ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
     ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s)
 {
-    u_char              *data, *p, ch;
+    u_char              *data, ch;
     size_t               i, len;
     ngx_str_t           *value, var;
     ngx_int_t           *flush;
@@ -1603,41 +2173,281 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
             len = &value[s].data[i] - data;
 
             if (len) {
+                if (ngx_http_log_compile_literal(cf, op, data, len) != NGX_OK) {
+                    return NGX_CONF_ERROR;
+                }
+            }
+        }
+    }
 
-                op->len = len;
-                op->getlen = NULL;
+    return NGX_CONF_OK;
 
-                if (len <= sizeof(uintptr_t)) {
-                    op->run = ngx_http_log_copy_short;
-                    op->data = 0;
+invalid:
 
-                    while (len--) {
-                        op->data <<= 8;
-                        op->data |= data[len];
-                    }
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid parameter \"%s\"", data);
 
-                } else {
-                    op->run = ngx_http_log_copy_long;
+    return NGX_CONF_ERROR;
+}
 
-                    p = ngx_pnalloc(cf->pool, len);
-                    if (p == NULL) {
-                        return NGX_CONF_ERROR;
-                    }
 
-                    ngx_memcpy(p, data, len);
-                    op->data = (uintptr_t) p;
+static ngx_int_t
+ngx_http_log_compile_literal(ngx_conf_t *cf, ngx_http_log_op_t *op,
+    u_char *data, size_t len)
+{
+    u_char  *p;
+
+    op->len = len;
+    op->getlen = NULL;
+
+    if (len <= sizeof(uintptr_t)) {
+        op->run = ngx_http_log_copy_short;
+        op->data = 0;
+
+        while (len--) {
+            op->data <<= 8;
+            op->data |= data[len];
+        }
+
+    } else {
+        op->run = ngx_http_log_copy_long;
+
+        p = ngx_pnalloc(cf->pool, len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(p, data, len);
+        op->data = (uintptr_t) p;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * a JSON format is compiled into the same operation codes as a plain one:
+ * field names, quotes and separators are escaped and merged into literal
+ * copies at configuration time, variables are escaped with the JSON rules,
+ * and the numeric log variables such as $status or $request_time are
+ * written unquoted
+ */
+
+static char *
+ngx_http_log_compile_json(ngx_conf_t *cf, ngx_array_t *flushes,
+    ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s)
+{
+    u_char              *p, sep, bytes[sizeof(uintptr_t)];
+    uintptr_t            data;
+    ngx_str_t           *value, *arg;
+    ngx_uint_t           i, j;
+    ngx_array_t          json, fops, fargs;
+    ngx_http_log_op_t   *op, *fop;
+
+    value = args->elts;
+
+    if (ngx_array_init(&json, cf->temp_pool, 64, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_array_init(&fops, cf->temp_pool, 8, sizeof(ngx_http_log_op_t))
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_array_init(&fargs, cf->temp_pool, 1, sizeof(ngx_str_t))
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    arg = ngx_array_push(&fargs);
+    if (arg == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    sep = '{';
+
+    for ( /* void */ ; s < args->nelts; s += 2) {
+
+        p = ngx_array_push_n(&json, 2);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        p[0] = sep;
+        p[1] = '"';
+
+        sep = ',';
+
+        if (ngx_http_log_json_literal(&json, value[s].data, value[s].len)
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+        p = ngx_array_push_n(&json, 2);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        p[0] = '"';
+        p[1] = ':';
+
+        fops.nelts = 0;
+        *arg = value[s + 1];
+
+        if (ngx_http_log_compile_format(cf, flushes, &fops, &fargs, 0)
+            != NGX_CONF_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+        fop = fops.elts;
+
+        if (fops.nelts == 1
+            && (fop->run == ngx_http_log_status
+                || fop->run == ngx_http_log_bytes_sent
+                || fop->run == ngx_http_log_body_bytes_sent
+                || fop->run == ngx_http_log_request_length
+                || fop->run == ngx_http_log_request_time
+                || fop->run == ngx_http_log_msec))
+        {
+            op = ngx_array_push_n(ops, 2);
+            if (op == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            if (ngx_http_log_compile_literal(cf, &op[0], json.elts, json.nelts)
+                != NGX_OK)
+            {
+                return NGX_CONF_ERROR;
+            }
+
+            json.nelts = 0;
+
+            op[1] = *fop;
+
+            if (fop->run == ngx_http_log_status) {
+                op[1].run = ngx_http_log_json_status;
+            }
+
+            continue;
+        }
+
+        p = ngx_array_push(&json);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *p = '"';
+
+        for (i = 0; i < fops.nelts; i++) {
+
+            if (fop[i].run == ngx_http_log_copy_short) {
+                data = fop[i].data;
+
+                for (j = 0; j < fop[i].len; j++) {
+                    bytes[j] = (u_char) (data & 0xff);
+                    data >>= 8;
                 }
+
+                if (ngx_http_log_json_literal(&json, bytes, fop[i].len)
+                    != NGX_OK)
+                {
+                    return NGX_CONF_ERROR;
+                }
+
+                continue;
+            }
+
+            if (fop[i].run == ngx_http_log_copy_long) {
+                if (ngx_http_log_json_literal(&json, (u_char *) fop[i].data,
+                                              fop[i].len)
+                    != NGX_OK)
+                {
+                    return NGX_CONF_ERROR;
+                }
+
+                continue;
+            }
+
+            if (json.nelts) {
+                op = ngx_array_push(ops);
+                if (op == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                if (ngx_http_log_compile_literal(cf, op, json.elts, json.nelts)
+                    != NGX_OK)
+                {
+                    return NGX_CONF_ERROR;
+                }
+
+                json.nelts = 0;
+            }
+
+            op = ngx_array_push(ops);
+            if (op == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            *op = fop[i];
+
+            if (op->run == ngx_http_log_variable) {
+                op->getlen = ngx_http_log_json_variable_getlen;
+                op->run = ngx_http_log_json_variable;
             }
         }
+
+        p = ngx_array_push(&json);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *p = '"';
+    }
+
+    p = ngx_array_push(&json);
+    if (p == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *p = '}';
+
+    op = ngx_array_push(ops);
+    if (op == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_log_compile_literal(cf, op, json.elts, json.nelts) != NGX_OK) {
+        return NGX_CONF_ERROR;
     }
 
     return NGX_CONF_OK;
+}
 
-invalid:
 
-    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid parameter \"%s\"", data);
+static ngx_int_t
+ngx_http_log_json_literal(ngx_array_t *json, u_char *data, size_t len)
+{
+    u_char  *p;
+    size_t   n;
 
-    return NGX_CONF_ERROR;
+    n = len + ngx_http_log_json_escape(NULL, data, len);
+
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+    p = ngx_array_push_n(json, n);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_log_json_escape(p, data, len);
+
+    return NGX_OK;
 }
 
 
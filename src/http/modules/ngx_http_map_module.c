@@ -185,6 +185,11 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_variable_t               *var;
     ngx_http_map_conf_ctx_t            ctx;
     ngx_http_compile_complex_value_t   ccv;
+#if (NGX_PCRE)
+    ngx_uint_t                         i;
+    ngx_regex_elt_t                   *elts;
+    ngx_http_map_regex_t              *reg;
+#endif
 
     if (mcf->hash_max_size == NGX_CONF_UNSET_UINT) {
         mcf->hash_max_size = 2048;
@@ -351,6 +356,28 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         map->map.nregex = ctx.regexes.nelts;
     }
 
+    if (ctx.regexes.nelts > 1) {
+        elts = ngx_palloc(pool, ctx.regexes.nelts * sizeof(ngx_regex_elt_t));
+        if (elts == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+
+        reg = ctx.regexes.elts;
+
+        for (i = 0; i < ctx.regexes.nelts; i++) {
+            elts[i].regex = reg[i].regex->regex;
+            elts[i].name = reg[i].regex->name.data;
+        }
+
+        map->map.regex_sets = ngx_regex_compile_sets(cf->pool, elts,
+                                                     ctx.regexes.nelts);
+        if (map->map.regex_sets == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+    }
+
 #endif
 
     ngx_destroy_pool(pool);
@@ -0,0 +1,453 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    ngx_shm_zone_t               *shm_zone;
+    ngx_cycle_t                  *cycle;
+} ngx_http_palloc_profile_main_conf_t;
+
+
+typedef struct {
+    ngx_atomic_uint_t             bytes;
+    ngx_atomic_uint_t             count;
+    ngx_uint_t                    worker;
+    ngx_palloc_site_t            *site;
+} ngx_http_palloc_profile_entry_t;
+
+
+static ngx_int_t ngx_http_palloc_profile_status_handler(ngx_http_request_t *r);
+static int ngx_libc_cdecl ngx_http_palloc_profile_cmp(const void *one,
+    const void *two);
+static ngx_int_t ngx_http_palloc_profile_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
+static void *ngx_http_palloc_profile_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_palloc_profile(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_palloc_profile_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_palloc_profile_init_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_palloc_profile_commands[] = {
+
+    { ngx_string("palloc_profile"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_palloc_profile,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("palloc_profile_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_palloc_profile_status,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_palloc_profile_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_http_palloc_profile_create_main_conf,
+                                           /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_palloc_profile_module = {
+    NGX_MODULE_V1,
+    &ngx_http_palloc_profile_module_ctx,   /* module context */
+    ngx_http_palloc_profile_commands,      /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_palloc_profile_init_process,  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_palloc_profile_status_handler(ngx_http_request_t *r)
+{
+    size_t                                size;
+    ngx_int_t                             rc;
+    ngx_buf_t                            *b;
+    ngx_uint_t                            i, w, n;
+    ngx_chain_t                           out;
+    ngx_palloc_site_t                    *site;
+    ngx_palloc_profile_t                 *pp;
+    ngx_http_palloc_profile_entry_t      *entries;
+    ngx_http_palloc_profile_main_conf_t  *ppmcf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    ppmcf = ngx_http_get_module_main_conf(r, ngx_http_palloc_profile_module);
+    pp = ((ngx_slab_pool_t *) ppmcf->shm_zone->shm.addr)->data;
+
+    /*
+     * the tables are read without locking, so the counters are
+     * copied once to keep the sort consistent
+     */
+
+    entries = ngx_palloc(r->pool, pp->workers * pp->sites
+                                  * sizeof(ngx_http_palloc_profile_entry_t));
+    if (entries == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    n = 0;
+    size = sizeof("workers:  sites:  lost: \n") + 3 * NGX_ATOMIC_T_LEN
+           + sizeof("bytes count worker site\n") - 1;
+
+    for (w = 0; w < pp->workers; w++) {
+        for (i = 0; i < pp->sites; i++) {
+            site = &pp->table[w * pp->sites + i];
+
+            if (site->file == 0 || site->count == 0) {
+                continue;
+            }
+
+            entries[n].bytes = site->bytes;
+            entries[n].count = site->count;
+            entries[n].worker = w;
+            entries[n].site = site;
+            n++;
+
+            size += 3 * NGX_ATOMIC_T_LEN + sizeof("   :\n") - 1
+                    + NGX_PALLOC_SITE_NAME_LEN + NGX_INT_T_LEN;
+        }
+    }
+
+    ngx_qsort(entries, n, sizeof(ngx_http_palloc_profile_entry_t),
+              ngx_http_palloc_profile_cmp);
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_sprintf(b->last, "workers: %ui sites: %ui lost: %uA\n",
+                          pp->workers, n, pp->lost);
+
+    b->last = ngx_cpymem(b->last, "bytes count worker site\n",
+                         sizeof("bytes count worker site\n") - 1);
+
+    for (i = 0; i < n; i++) {
+        site = entries[i].site;
+
+        b->last = ngx_sprintf(b->last, "%uA %uA %ui %*s:%ui\n",
+                              entries[i].bytes, entries[i].count,
+                              entries[i].worker,
+                              ngx_min(site->name_len,
+                                      NGX_PALLOC_SITE_NAME_LEN),
+                              site->name, site->line);
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static int ngx_libc_cdecl
+ngx_http_palloc_profile_cmp(const void *one, const void *two)
+{
+    ngx_http_palloc_profile_entry_t  *first, *second;
+
+    first = (ngx_http_palloc_profile_entry_t *) one;
+    second = (ngx_http_palloc_profile_entry_t *) two;
+
+    if (first->bytes == second->bytes) {
+        return 0;
+    }
+
+    return (first->bytes < second->bytes) ? 1 : -1;
+}
+
+
+static ngx_int_t
+ngx_http_palloc_profile_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    size_t                                size;
+    ngx_uint_t                            workers, sites;
+    ngx_core_conf_t                      *ccf;
+    ngx_slab_pool_t                      *shpool;
+    ngx_palloc_profile_t                 *pp;
+    ngx_http_palloc_profile_main_conf_t  *ppmcf;
+
+    ppmcf = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ppmcf->cycle->conf_ctx,
+                                           ngx_core_module);
+
+    workers = (ccf->master && ccf->worker_processes > 0)
+              ? (ngx_uint_t) ccf->worker_processes : 1;
+
+    if (data || shm_zone->shm.exists) {
+
+        /*
+         * old workers may still record into the tables, so they are
+         * kept as is; allocations of extra workers are counted as lost
+         */
+
+        pp = shpool->data;
+
+        if (pp->workers < workers) {
+            ngx_log_error(NGX_LOG_WARN, shm_zone->shm.log, 0,
+                          "palloc_profile zone \"%V\" has tables for "
+                          "%ui workers only", &shm_zone->shm.name,
+                          pp->workers);
+        }
+
+        return NGX_OK;
+    }
+
+    pp = ngx_slab_alloc(shpool, sizeof(ngx_palloc_profile_t)
+                                + workers * sizeof(ngx_atomic_t));
+    if (pp == NULL) {
+        return NGX_ERROR;
+    }
+
+    pp->workers = workers;
+    pp->lost = 0;
+    pp->locks = (ngx_atomic_t *) ((u_char *) pp
+                                  + sizeof(ngx_palloc_profile_t));
+
+    ngx_memzero((void *) pp->locks, workers * sizeof(ngx_atomic_t));
+
+    /* the largest power of two of sites per worker that fits the zone */
+
+    for (sites = 1; (sites * 2) * workers * sizeof(ngx_palloc_site_t)
+                    < shm_zone->shm.size;
+         sites *= 2)
+    {
+        /* void */
+    }
+
+    for ( /* void */ ; sites >= 64; sites /= 2) {
+        size = workers * sites * sizeof(ngx_palloc_site_t);
+
+        pp->table = ngx_slab_alloc(shpool, size);
+
+        if (pp->table) {
+            ngx_memzero((void *) pp->table, size);
+            break;
+        }
+    }
+
+    if (pp->table == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "palloc_profile zone \"%V\" is too small",
+                      &shm_zone->shm.name);
+        return NGX_ERROR;
+    }
+
+    pp->sites = sites;
+
+    shpool->data = pp;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_palloc_profile_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_palloc_profile_main_conf_t  *ppmcf;
+
+    ppmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_palloc_profile_main_conf_t));
+    if (ppmcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     ppmcf->shm_zone = NULL;
+     */
+
+    ppmcf->cycle = cf->cycle;
+
+    return ppmcf;
+}
+
+
+static char *
+ngx_http_palloc_profile(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_palloc_profile_main_conf_t *ppmcf = conf;
+
+    u_char          *p;
+    ssize_t          size;
+    ngx_str_t       *value, name, s;
+    ngx_shm_zone_t  *shm_zone;
+
+    if (ppmcf->shm_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strncmp(value[1].data, "zone=", 5) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.data = value[1].data + 5;
+
+    p = (u_char *) ngx_strchr(name.data, ':');
+
+    if (p == NULL || p == name.data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.len = p - name.data;
+
+    s.data = p + 1;
+    s.len = value[1].data + value[1].len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_palloc_profile_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_palloc_profile_init_zone;
+    shm_zone->data = ppmcf;
+
+    ppmcf->shm_zone = shm_zone;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_palloc_profile_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t             *clcf;
+    ngx_http_palloc_profile_main_conf_t  *ppmcf;
+
+    ppmcf = ngx_http_conf_get_module_main_conf(cf,
+                                               ngx_http_palloc_profile_module);
+
+    if (ppmcf->shm_zone == NULL) {
+        return "requires the \"palloc_profile\" directive";
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_palloc_profile_status_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_palloc_profile_init_process(ngx_cycle_t *cycle)
+{
+    ngx_http_palloc_profile_main_conf_t  *ppmcf;
+
+    ppmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_palloc_profile_module);
+
+    if (ppmcf == NULL || ppmcf->shm_zone == NULL) {
+        return NGX_OK;
+    }
+
+    /*
+     * the cache manager and loader keep ngx_worker 0 and would be
+     * counted in the table of the first worker, so they are not profiled
+     */
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    ngx_palloc_profile = ((ngx_slab_pool_t *) ppmcf->shm_zone->shm.addr)->data;
+
+    return NGX_OK;
+}
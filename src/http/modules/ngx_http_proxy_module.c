@@ -2899,6 +2899,7 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     u_char                     *p;
     size_t                      size;
     ngx_int_t                   rc;
+    ngx_uint_t                  defaults;
     ngx_hash_init_t             hash;
     ngx_http_core_loc_conf_t   *clcf;
     ngx_http_proxy_rewrite_t   *pr;
@@ -3331,6 +3332,8 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         }
     }
 
+    defaults = (conf->headers_source == NULL && prev->headers_source == NULL);
+
     if (conf->headers_source == NULL) {
         conf->headers = prev->headers;
 #if (NGX_HTTP_CACHE)
@@ -3357,6 +3360,20 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
 #endif
 
+    if (defaults) {
+
+        /*
+         * the default headers are compiled once and kept in the
+         * http level conf, so the rest of the servers inherit them
+         */
+
+        prev->headers = conf->headers;
+#if (NGX_HTTP_CACHE)
+        prev->headers_cache = conf->headers_cache;
+#endif
+        prev->headers_source = conf->headers_source;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -27,6 +27,16 @@ typedef struct {
     ngx_uint_t                      verify_depth;
 
     size_t                          buffer_size;
+    ngx_flag_t                      ktls;
+
+    ngx_flag_t                      dyn_rec_enable;
+    size_t                          dyn_rec_size_lo;
+    size_t                          dyn_rec_threshold;
+    ngx_msec_t                      dyn_rec_timeout;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t              *thread_pool;
+#endif
 
     ssize_t                         builtin_session_cache;
 
@@ -35,6 +45,10 @@ typedef struct {
     ngx_array_t                    *certificates;
     ngx_array_t                    *certificate_keys;
 
+    ngx_array_t                    *certificate_values;
+    ngx_array_t                    *certificate_key_values;
+    ngx_ssl_cert_cache_t           *certificate_cache;
+
     ngx_str_t                       dhparam;
     ngx_str_t                       ecdh_curve;
     ngx_str_t                       client_certificate;
@@ -46,14 +60,18 @@ typedef struct {
     ngx_array_t                    *passwords;
 
     ngx_shm_zone_t                 *shm_zone;
+    ngx_ssl_session_store_t        *session_store;
 
     ngx_flag_t                      session_tickets;
     ngx_array_t                    *session_ticket_keys;
+    time_t                          session_ticket_key_rotation;
+    time_t                          session_ticket_key_lifetime;
 
     ngx_flag_t                      stapling;
     ngx_flag_t                      stapling_verify;
     ngx_str_t                       stapling_file;
     ngx_str_t                       stapling_responder;
+    ngx_shm_zone_t                 *stapling_shm_zone;
 
     u_char                         *file;
     ngx_uint_t                      line;
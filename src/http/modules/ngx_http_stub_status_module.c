@@ -76,6 +76,27 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
     { ngx_string("connections_waiting"), NULL, ngx_http_stub_status_variable,
       3, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("pool_cache_hits"), NULL, ngx_http_stub_status_variable,
+      4, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("pool_cache_misses"), NULL, ngx_http_stub_status_variable,
+      5, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("pool_cache_size"), NULL, ngx_http_stub_status_variable,
+      6, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("buf_cache_hits"), NULL, ngx_http_stub_status_variable,
+      7, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("buf_cache_misses"), NULL, ngx_http_stub_status_variable,
+      8, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("buf_cache_busy"), NULL, ngx_http_stub_status_variable,
+      9, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("buf_cache_size"), NULL, ngx_http_stub_status_variable,
+      10, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_null_string, NULL, NULL, 0, 0, 0 }
 };
 
@@ -189,6 +210,36 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
         value = *ngx_stat_waiting;
         break;
 
+    /* the pool and buffer caches are per worker process */
+
+    case 4:
+        value = ngx_pool_cache_stat.hits;
+        break;
+
+    case 5:
+        value = ngx_pool_cache_stat.misses;
+        break;
+
+    case 6:
+        value = ngx_pool_cache_stat.size;
+        break;
+
+    case 7:
+        value = ngx_buf_cache_stat.hits;
+        break;
+
+    case 8:
+        value = ngx_buf_cache_stat.misses;
+        break;
+
+    case 9:
+        value = ngx_buf_cache_stat.busy;
+        break;
+
+    case 10:
+        value = ngx_buf_cache_stat.size;
+        break;
+
     /* suppress warning */
     default:
         value = 0;
@@ -63,6 +63,12 @@ static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
 
+#if !(NGX_WIN32)
+static ngx_int_t ngx_http_upstream_keepalive_pass(ngx_connection_t *c);
+static void ngx_http_upstream_keepalive_adopt(ngx_cycle_t *cycle,
+    ngx_socket_t s);
+#endif
+
 #if (NGX_HTTP_SSL)
 static ngx_int_t ngx_http_upstream_keepalive_set_session(
     ngx_peer_connection_t *pc, void *data);
@@ -73,6 +79,7 @@ static void ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc,
 static void *ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static ngx_int_t ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle);
 
 
 static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
@@ -110,7 +117,7 @@ ngx_module_t  ngx_http_upstream_keepalive_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_keepalive_init_process, /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -306,7 +313,14 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         goto invalid;
     }
 
-    if (ngx_terminate || ngx_exiting) {
+    if (ngx_terminate) {
+        goto invalid;
+    }
+
+    if (ngx_exiting) {
+#if !(NGX_WIN32)
+        (void) ngx_http_upstream_keepalive_pass(c);
+#endif
         goto invalid;
     }
 
@@ -393,6 +407,11 @@ ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev)
     c = ev->data;
 
     if (c->close) {
+#if !(NGX_WIN32)
+        if (ngx_exiting) {
+            (void) ngx_http_upstream_keepalive_pass(c);
+        }
+#endif
         goto close;
     }
 
@@ -443,6 +462,157 @@ ngx_http_upstream_keepalive_close(ngx_connection_t *c)
 }
 
 
+#if !(NGX_WIN32)
+
+static ngx_int_t
+ngx_http_upstream_keepalive_pass(ngx_connection_t *c)
+{
+#if (NGX_SSL)
+    if (c->ssl) {
+        return NGX_DECLINED;
+    }
+#endif
+
+    if (ngx_pass_connection((ngx_cycle_t *) ngx_cycle, c->fd) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "keepalive connection %p passed", c);
+
+    /*
+     * the socket stays open in the new worker, so it has to be removed
+     * from epoll explicitly rather than by close()
+     */
+
+    if (ngx_event_flags & NGX_USE_EPOLL_EVENT) {
+        ngx_del_conn(c, 0);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_keepalive_adopt(ngx_cycle_t *cycle, ngx_socket_t s)
+{
+    socklen_t                                socklen;
+    ngx_uint_t                               i;
+    ngx_queue_t                             *q;
+    ngx_sockaddr_t                           sockaddr;
+    ngx_connection_t                        *c;
+    ngx_http_upstream_rr_peer_t             *peer;
+    ngx_http_upstream_rr_peers_t            *peers;
+    ngx_http_upstream_srv_conf_t           **uscfp;
+    ngx_http_upstream_main_conf_t           *umcf;
+    ngx_http_upstream_keepalive_cache_t     *item;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    socklen = sizeof(ngx_sockaddr_t);
+
+    if (getpeername(s, &sockaddr.sockaddr, &socklen) == -1) {
+        goto failed;
+    }
+
+    /* the connection goes to the first upstream with this server */
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        kcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                           ngx_http_upstream_keepalive_module);
+
+        if (kcf->max_cached == 0 || ngx_queue_empty(&kcf->free)) {
+            continue;
+        }
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+            for (peer = peers->peer; peer; peer = peer->next) {
+
+                if (ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                     &sockaddr.sockaddr, socklen, 1)
+                    == NGX_OK)
+                {
+                    goto found;
+                }
+            }
+        }
+    }
+
+failed:
+
+    if (ngx_close_socket(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      ngx_close_socket_n " passed connection failed");
+    }
+
+    return;
+
+found:
+
+    c = ngx_get_connection(s, cycle->log);
+    if (c == NULL) {
+        goto failed;
+    }
+
+    c->pool = ngx_create_pool(128, cycle->log);
+    if (c->pool == NULL) {
+        ngx_close_connection(c);
+        return;
+    }
+
+    c->recv = ngx_recv;
+    c->send = ngx_send;
+    c->recv_chain = ngx_recv_chain;
+    c->send_chain = ngx_send_chain;
+    c->sendfile = 1;
+
+    if (sockaddr.sockaddr.sa_family == AF_UNIX) {
+        c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+        c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+    }
+
+    c->log_error = NGX_ERROR_ERR;
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+
+    q = ngx_queue_head(&kcf->free);
+    ngx_queue_remove(q);
+
+    item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+
+    ngx_queue_insert_head(&kcf->cache, q);
+
+    item->connection = c;
+    item->socklen = socklen;
+    ngx_memcpy(&item->sockaddr, &sockaddr, socklen);
+
+    c->write->handler = ngx_http_upstream_keepalive_dummy_handler;
+    c->read->handler = ngx_http_upstream_keepalive_close_handler;
+
+    c->data = item;
+    c->idle = 1;
+    c->read->log = cycle->log;
+    c->write->log = cycle->log;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cycle->log, 0,
+                   "keepalive connection %p adopted", c);
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        c->close = 1;
+        ngx_http_upstream_keepalive_close_handler(c->read);
+    }
+}
+
+#endif
+
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t
@@ -489,6 +659,47 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
 }
 
 
+static ngx_int_t
+ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle)
+{
+#if !(NGX_WIN32)
+    ngx_uint_t                               i;
+    ngx_http_upstream_srv_conf_t           **uscfp;
+    ngx_http_upstream_main_conf_t           *umcf;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER) {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        kcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                           ngx_http_upstream_keepalive_module);
+
+        if (kcf->max_cached) {
+            ngx_adopt_connection = ngx_http_upstream_keepalive_adopt;
+            break;
+        }
+    }
+#endif
+
+    return NGX_OK;
+}
+
+
 static char *
 ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
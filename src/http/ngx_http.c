@@ -27,9 +27,11 @@ static ngx_int_t ngx_http_add_address(ngx_conf_t *cf,
 static ngx_int_t ngx_http_add_server(ngx_conf_t *cf,
     ngx_http_core_srv_conf_t *cscf, ngx_http_conf_addr_t *addr);
 
+#if (NGX_DEBUG)
+static ngx_msec_t ngx_http_conf_elapsed(ngx_msec_t *start);
+#endif
 static char *ngx_http_merge_servers(ngx_conf_t *cf,
-    ngx_http_core_main_conf_t *cmcf, ngx_http_module_t *module,
-    ngx_uint_t ctx_index);
+    ngx_http_core_main_conf_t *cmcf);
 static char *ngx_http_merge_locations(ngx_conf_t *cf,
     ngx_queue_t *locations, void **loc_conf, ngx_http_module_t *module,
     ngx_uint_t ctx_index);
@@ -129,6 +131,9 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_core_loc_conf_t    *clcf;
     ngx_http_core_srv_conf_t   **cscfp;
     ngx_http_core_main_conf_t   *cmcf;
+#if (NGX_DEBUG)
+    ngx_msec_t                   start;
+#endif
 
     if (*(ngx_http_conf_ctx_t **) conf) {
         return "is duplicate";
@@ -242,12 +247,20 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cf->module_type = NGX_HTTP_MODULE;
     cf->cmd_type = NGX_HTTP_MAIN_CONF;
     //继续解析 http{}内的配置
+#if (NGX_DEBUG)
+    ngx_time_update();
+    start = ngx_current_msec;
+#endif
+
     rv = ngx_conf_parse(cf, NULL);
 
     if (rv != NGX_CONF_OK) {
         goto failed;
     }
 
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "http conf parse: %M", ngx_http_conf_elapsed(&start));
+
     /*
      * init http{} main_conf's, merge the server{}s' srv_conf's
      * and its location{}s' loc_conf's
@@ -272,13 +285,20 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                 goto failed;
             }
         }
-        //合并 server级配置项,这个函数会也会合并loc配置项
-        rv = ngx_http_merge_servers(cf, cmcf, module, mi);
-        if (rv != NGX_CONF_OK) {
-            goto failed;
-        }
     }
 
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "http conf init: %M", ngx_http_conf_elapsed(&start));
+
+    //合并 server级配置项,这个函数会也会合并loc配置项
+    rv = ngx_http_merge_servers(cf, cmcf);
+    if (rv != NGX_CONF_OK) {
+        goto failed;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "http conf merge: %M", ngx_http_conf_elapsed(&start));
+
 
     /* create location trees */
     //所有静态的 location组织成树结构,便于根据 URL查找 location
@@ -295,6 +315,9 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
     }
 
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "http conf locations: %M", ngx_http_conf_elapsed(&start));
+
     //给 ngx_http_core模块中 main_conf中定义的数组分配空间
     //自定义模块时,就是通过向 handler中添加回调函数实现自定义模块的介入
     if (ngx_http_init_phases(cf, cmcf) != NGX_OK) {
@@ -324,6 +347,10 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "http conf postconfiguration: %M",
+                   ngx_http_conf_elapsed(&start));
+
     /*
      * http{}'s cf->ctx was needed while the configuration merging
      * and in postconfiguration process
@@ -345,6 +372,10 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "http conf optimize servers: %M",
+                   ngx_http_conf_elapsed(&start));
+
     return NGX_CONF_OK;
 
 failed:
@@ -355,6 +386,24 @@ failed:
 }
 
 
+#if (NGX_DEBUG)
+
+static ngx_msec_t
+ngx_http_conf_elapsed(ngx_msec_t *start)
+{
+    ngx_msec_t  elapsed;
+
+    ngx_time_update();
+
+    elapsed = ngx_current_msec - *start;
+    *start = ngx_current_msec;
+
+    return elapsed;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_init_phases(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
 {
@@ -414,6 +463,7 @@ ngx_http_init_phases(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
 static ngx_int_t
 ngx_http_init_headers_in_hash(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
 {
+    ngx_int_t           rc;
     ngx_array_t         headers_in;
     ngx_hash_key_t     *hk;
     ngx_hash_init_t     hash;
@@ -438,12 +488,25 @@ ngx_http_init_headers_in_hash(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
 
     hash.hash = &cmcf->headers_in_hash;
     hash.key = ngx_hash_key_lc;
-    hash.max_size = 512;
+    hash.max_size = 1024;
     hash.bucket_size = ngx_align(64, ngx_cacheline_size);
     hash.name = "headers_in_hash";
     hash.pool = cf->pool;
     hash.temp_pool = NULL;
 
+    /*
+     * the headers are looked up for every request header line,
+     * so a collision free hash is preferred
+     */
+
+    rc = ngx_hash_init_perfect(&hash, headers_in.elts, headers_in.nelts);
+
+    if (rc != NGX_DECLINED) {
+        return rc;
+    }
+
+    hash.max_size = 512;
+
     if (ngx_hash_init(&hash, headers_in.elts, headers_in.nelts) != NGX_OK) {
         return NGX_ERROR;
     }
@@ -571,11 +634,11 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
   * 合并 server配置项的函数
   */
 static char *
-ngx_http_merge_servers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
-    ngx_http_module_t *module, ngx_uint_t ctx_index)
+ngx_http_merge_servers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
 {
     char                        *rv;
-    ngx_uint_t                   s;
+    ngx_uint_t                   s, m, ctx_index;
+    ngx_http_module_t           *module;
     ngx_http_conf_ctx_t         *ctx, saved;
     ngx_http_core_loc_conf_t    *clcf;
     ngx_http_core_srv_conf_t   **cscfp;
@@ -585,41 +648,58 @@ ngx_http_merge_servers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
     saved = *ctx;
     rv = NGX_CONF_OK;
 
-    for (s = 0; s < cmcf->servers.nelts; s++) {
+    /*
+     * all modules are merged for a server before the next one, so
+     * the configuration of thousands of servers is walked only once
+     */
 
-        /* merge the server{}s' srv_conf's */
+    for (s = 0; s < cmcf->servers.nelts; s++) {
 
-        ctx->srv_conf = cscfp[s]->ctx->srv_conf;
-        //调用每个模块的 merge_srv_conf函数合并 server配置项
-        if (module->merge_srv_conf) {
-            rv = module->merge_srv_conf(cf, saved.srv_conf[ctx_index],
-                                        cscfp[s]->ctx->srv_conf[ctx_index]);
-            if (rv != NGX_CONF_OK) {
-                goto failed;
+        for (m = 0; cf->cycle->modules[m]; m++) {
+            if (cf->cycle->modules[m]->type != NGX_HTTP_MODULE) {
+                continue;
             }
-        }
-        //调用每个模块的 merge_loc_conf函数合并 location配置项
-        if (module->merge_loc_conf) {
 
-            /* merge the server{}'s loc_conf */
+            module = cf->cycle->modules[m]->ctx;
+            ctx_index = cf->cycle->modules[m]->ctx_index;
 
-            ctx->loc_conf = cscfp[s]->ctx->loc_conf;
+            /* merge the server{}s' srv_conf's */
 
-            rv = module->merge_loc_conf(cf, saved.loc_conf[ctx_index],
-                                        cscfp[s]->ctx->loc_conf[ctx_index]);
-            if (rv != NGX_CONF_OK) {
-                goto failed;
+            ctx->srv_conf = cscfp[s]->ctx->srv_conf;
+            //调用每个模块的 merge_srv_conf函数合并 server配置项
+            if (module->merge_srv_conf) {
+                rv = module->merge_srv_conf(cf,
+                                          saved.srv_conf[ctx_index],
+                                          cscfp[s]->ctx->srv_conf[ctx_index]);
+                if (rv != NGX_CONF_OK) {
+                    goto failed;
+                }
             }
+            //调用每个模块的 merge_loc_conf函数合并 location配置项
+            if (module->merge_loc_conf) {
 
-            /* merge the locations{}' loc_conf's */
+                /* merge the server{}'s loc_conf */
 
-            clcf = cscfp[s]->ctx->loc_conf[ngx_http_core_module.ctx_index];
+                ctx->loc_conf = cscfp[s]->ctx->loc_conf;
 
-            rv = ngx_http_merge_locations(cf, clcf->locations,
-                                          cscfp[s]->ctx->loc_conf,
-                                          module, ctx_index);
-            if (rv != NGX_CONF_OK) {
-                goto failed;
+                rv = module->merge_loc_conf(cf,
+                                          saved.loc_conf[ctx_index],
+                                          cscfp[s]->ctx->loc_conf[ctx_index]);
+                if (rv != NGX_CONF_OK) {
+                    goto failed;
+                }
+
+                /* merge the locations{}' loc_conf's */
+
+                clcf = cscfp[s]->ctx->loc_conf
+                                         [ngx_http_core_module.ctx_index];
+
+                rv = ngx_http_merge_locations(cf, clcf->locations,
+                                              cscfp[s]->ctx->loc_conf,
+                                              module, ctx_index);
+                if (rv != NGX_CONF_OK) {
+                    goto failed;
+                }
             }
         }
     }
@@ -687,8 +767,9 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_location_queue_t   *lq;
     ngx_http_core_loc_conf_t   **clcfp;
 #if (NGX_PCRE)
-    ngx_uint_t                   r;
+    ngx_uint_t                   r, i;
     ngx_queue_t                 *regex;
+    ngx_regex_elt_t             *elts;
 #endif
 
     locations = pclcf->locations;
@@ -798,6 +879,25 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
         *clcfp = NULL;
 
         ngx_queue_split(locations, regex, &tail);
+
+        if (r > 1) {
+            elts = ngx_palloc(cf->temp_pool, r * sizeof(ngx_regex_elt_t));
+            if (elts == NULL) {
+                return NGX_ERROR;
+            }
+
+            clcfp = pclcf->regex_locations;
+
+            for (i = 0; i < r; i++) {
+                elts[i].regex = clcfp[i]->regex->regex;
+                elts[i].name = clcfp[i]->regex->name.data;
+            }
+
+            pclcf->regex_sets = ngx_regex_compile_sets(cf->pool, elts, r);
+            if (pclcf->regex_sets == NULL) {
+                return NGX_ERROR;
+            }
+        }
     }
 
 #endif
@@ -1340,6 +1440,7 @@ ngx_http_add_address(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 #if (NGX_PCRE)
     addr->nregex = 0;
     addr->regex = NULL;
+    addr->regex_sets = NULL;
 #endif
     addr->default_server = cscf;
     addr->servers.elts = NULL;
@@ -1354,7 +1455,6 @@ static ngx_int_t
 ngx_http_add_server(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_conf_addr_t *addr)
 {
-    ngx_uint_t                  i;
     ngx_http_core_srv_conf_t  **server;
 
     if (addr->servers.elts == NULL) {
@@ -1366,13 +1466,18 @@ ngx_http_add_server(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
         }
 
     } else {
+
+        /*
+         * listens are added while their server block is parsed, so
+         * a duplicate may only be the last server of the address
+         */
+
         server = addr->servers.elts;
-        for (i = 0; i < addr->servers.nelts; i++) {
-            if (server[i] == cscf) {
-                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                                   "a duplicate listen %s", addr->opt.addr);
-                return NGX_ERROR;
-            }
+
+        if (server[addr->servers.nelts - 1] == cscf) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "a duplicate listen %s", addr->opt.addr);
+            return NGX_ERROR;
         }
     }
 
@@ -1446,6 +1551,7 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
     ngx_http_core_srv_conf_t  **cscfp;
 #if (NGX_PCRE)
     ngx_uint_t                  regex, i;
+    ngx_regex_elt_t            *elts;
 
     regex = 0;
 #endif
@@ -1578,6 +1684,23 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
         }
     }
 
+    if (regex > 1) {
+        elts = ngx_palloc(cf->temp_pool, regex * sizeof(ngx_regex_elt_t));
+        if (elts == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < regex; i++) {
+            elts[i].regex = addr->regex[i].regex->regex;
+            elts[i].name = addr->regex[i].regex->name.data;
+        }
+
+        addr->regex_sets = ngx_regex_compile_sets(cf->pool, elts, regex);
+        if (addr->regex_sets == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
 #endif
 
     return NGX_OK;
@@ -1853,6 +1976,7 @@ ngx_http_add_addrs(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_PCRE)
         vn->nregex = addr[i].nregex;
         vn->regex = addr[i].regex;
+        vn->regex_sets = addr[i].regex_sets;
 #endif
     }
 
@@ -1918,6 +2042,7 @@ ngx_http_add_addrs6(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_PCRE)
         vn->nregex = addr[i].nregex;
         vn->regex = addr[i].regex;
+        vn->regex_sets = addr[i].regex_sets;
 #endif
     }
 
@@ -244,6 +244,9 @@ typedef struct {
 
     ngx_uint_t                 nregex;
     ngx_http_server_name_t    *regex;
+#if (NGX_PCRE)
+    ngx_regex_set_t           *regex_sets;
+#endif
 } ngx_http_virtual_names_t;
 
 
@@ -305,6 +308,7 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_uint_t                 nregex;
     ngx_http_server_name_t    *regex;
+    ngx_regex_set_t           *regex_sets;
 #endif
 
     /**
@@ -360,6 +364,7 @@ struct ngx_http_core_loc_conf_s {
     ngx_http_location_tree_node_t   *static_locations;
 #if (NGX_PCRE)
     ngx_http_core_loc_conf_t       **regex_locations;
+    ngx_regex_set_t                 *regex_sets;
 #endif
 
     /* pointer to the modules' loc_conf */
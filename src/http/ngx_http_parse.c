@@ -9,6 +9,20 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HAVE_AVX2)
+#include <immintrin.h>
+#elif (NGX_HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+
+
+static ngx_inline u_char *ngx_http_parse_find_delimiter(u_char *p,
+    u_char *last, u_char c);
+#if (NGX_HAVE_SSE2 && NGX_HAVE_GCC_CTZ)
+static ngx_inline ngx_uint_t ngx_http_parse_lowcase_name(u_char *p,
+    u_char *dst, ngx_uint_t *hash);
+#endif
+
 
 static uint32_t  usual[] = {
     0xffffdbfe, /* 1111 1111 1111 1111  1101 1011 1111 1110 */
@@ -627,7 +641,20 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_uri:
 
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
-                break;
+
+                /*
+                 * only SP, CR, LF, "#" and NUL matter in the rest of URI,
+                 * so skip to the nearest of them at once
+                 */
+
+                p = ngx_http_parse_find_delimiter(p, b->last, '#');
+
+                if (p == b->last) {
+                    p--;
+                    break;
+                }
+
+                ch = *p;
             }
 
             switch (ch) {
@@ -837,6 +864,9 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 {
     u_char      c, ch, *p;
     ngx_uint_t  hash, i;
+#if (NGX_HAVE_SSE2 && NGX_HAVE_GCC_CTZ)
+    ngx_uint_t  n;
+#endif
     enum {
         sw_start = 0,
         sw_name,
@@ -920,6 +950,29 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 
         /* header name */
         case sw_name:
+
+#if (NGX_HAVE_SSE2 && NGX_HAVE_GCC_CTZ)
+
+            if (b->last - p >= 16 && i + 16 <= NGX_HTTP_LC_HEADER_LEN) {
+
+                n = ngx_http_parse_lowcase_name(p, &r->lowcase_header[i],
+                                                &hash);
+
+                if (n) {
+                    i = (i + n) & (NGX_HTTP_LC_HEADER_LEN - 1);
+                    p += n;
+
+                    if (p == b->last) {
+                        p--;
+                        break;
+                    }
+
+                    ch = *p;
+                }
+            }
+
+#endif
+
             c = lowcase[ch];
 
             if (c) {
@@ -1006,6 +1059,16 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 
         /* header value */
         case sw_value:
+
+            p = ngx_http_parse_find_delimiter(p, b->last, ' ');
+
+            if (p == b->last) {
+                p--;
+                break;
+            }
+
+            ch = *p;
+
             switch (ch) {
             case ' ':
                 r->header_end = p;
@@ -1100,6 +1163,144 @@ header_done:
 }
 
 
+#if (NGX_HAVE_SSE2 && NGX_HAVE_GCC_CTZ)
+
+/*
+ * Lowercases the leading run of letters, digits and "-" from 16 bytes at p
+ * into dst and adds it to the hash, returns the length of the run.
+ * dst must have room for 16 bytes.
+ */
+
+static ngx_inline ngx_uint_t
+ngx_http_parse_lowcase_name(u_char *p, u_char *dst, ngx_uint_t *hash)
+{
+    ngx_uint_t  n, k, h;
+    __m128i     v, upper, valid;
+
+    v = _mm_loadu_si128((const __m128i *) p);
+
+    /* bytes above 0x7f are negative and fail all the range checks */
+
+    upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                          _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+
+    valid = _mm_or_si128(
+                _mm_or_si128(upper,
+                             _mm_and_si128(
+                                 _mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)),
+                                 _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1)))),
+                _mm_or_si128(_mm_and_si128(
+                                 _mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                 _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1))),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('-'))));
+
+    v = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+
+    _mm_storeu_si128((__m128i *) dst, v);
+
+    n = __builtin_ctz(~_mm_movemask_epi8(valid) | 0x10000);
+
+    /* ngx_hash() of 4 bytes at once, 923521 == 31^4 */
+
+    h = *hash;
+
+    for (k = 0; k + 4 <= n; k += 4) {
+        h = h * 923521 + dst[k] * 29791 + dst[k + 1] * 961 + dst[k + 2] * 31
+            + dst[k + 3];
+    }
+
+    for ( /* void */ ; k < n; k++) {
+        h = ngx_hash(h, dst[k]);
+    }
+
+    *hash = h;
+
+    return n;
+}
+
+#endif
+
+
+/*
+ * Returns the first SP, CR, LF, NUL or "c" byte in [p, last), or last.
+ * The vector loops only find out whether a block holds a delimiter,
+ * the exact position is left to the byte loop.
+ */
+
+static ngx_inline u_char *
+ngx_http_parse_find_delimiter(u_char *p, u_char *last, u_char c)
+{
+    u_char  ch;
+
+#if (NGX_HAVE_AVX2)
+    {
+    __m256i  v, sp, cr, lf, nul, x, m;
+
+    sp = _mm256_set1_epi8(' ');
+    cr = _mm256_set1_epi8(CR);
+    lf = _mm256_set1_epi8(LF);
+    nul = _mm256_setzero_si256();
+    x = _mm256_set1_epi8((char) c);
+
+    while (last - p >= 32) {
+        v = _mm256_loadu_si256((const __m256i *) p);
+
+        m = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+                                _mm256_cmpeq_epi8(v, cr)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, lf),
+                                _mm256_cmpeq_epi8(v, nul)));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, x));
+
+        if (_mm256_movemask_epi8(m)) {
+            break;
+        }
+
+        p += 32;
+    }
+    }
+#endif
+
+#if (NGX_HAVE_SSE2)
+    {
+    __m128i  v, sp, cr, lf, nul, x, m;
+
+    sp = _mm_set1_epi8(' ');
+    cr = _mm_set1_epi8(CR);
+    lf = _mm_set1_epi8(LF);
+    nul = _mm_setzero_si128();
+    x = _mm_set1_epi8((char) c);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+
+        m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp),
+                                      _mm_cmpeq_epi8(v, cr)),
+                         _mm_or_si128(_mm_cmpeq_epi8(v, lf),
+                                      _mm_cmpeq_epi8(v, nul)));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, x));
+
+        if (_mm_movemask_epi8(m)) {
+            break;
+        }
+
+        p += 16;
+    }
+    }
+#endif
+
+    for ( /* void */ ; p < last; p++) {
+        ch = *p;
+
+        if (ch == ' ' || ch == CR || ch == LF || ch == '\0' || ch == c) {
+            break;
+        }
+    }
+
+    return p;
+}
+
+
 ngx_int_t
 ngx_http_parse_uri(ngx_http_request_t *r)
 {
@@ -454,6 +454,12 @@ ngx_http_wait_request_handler(ngx_event_t *rev)
             b->start = NULL;
         }
 
+#if (NGX_HTTP_SSL)
+        if (c->ssl) {
+            ngx_ssl_free_buffer(c);
+        }
+#endif
+
         return;
     }
 
@@ -509,18 +515,42 @@ ngx_http_wait_request_handler(ngx_event_t *rev)
 
 ngx_http_request_t *
 ngx_http_create_request(ngx_connection_t *c)
+{
+    ngx_http_request_t  *r;
+    ngx_http_log_ctx_t  *ctx;
+
+    r = ngx_http_alloc_request(c);
+    if (r == NULL) {
+        return NULL;
+    }
+
+    c->requests++;
+
+    ctx = c->log->data;
+    ctx->request = r;
+    ctx->current_request = r;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_reading, 1);
+    r->stat_reading = 1;
+    (void) ngx_atomic_fetch_add(ngx_stat_requests, 1);
+#endif
+
+    return r;
+}
+
+
+ngx_http_request_t *
+ngx_http_alloc_request(ngx_connection_t *c)
 {
     ngx_pool_t                 *pool;
     ngx_time_t                 *tp;
     ngx_http_request_t         *r;
-    ngx_http_log_ctx_t         *ctx;
     ngx_http_connection_t      *hc;
     ngx_http_core_srv_conf_t   *cscf;
     ngx_http_core_loc_conf_t   *clcf;
     ngx_http_core_main_conf_t  *cmcf;
 
-    c->requests++;
-
     hc = c->data;
 
     cscf = ngx_http_get_module_srv_conf(hc->conf_ctx, ngx_http_core_module);
@@ -578,7 +608,7 @@ ngx_http_create_request(ngx_connection_t *c)
     }
 
 #if (NGX_HTTP_SSL)
-    if (c->ssl) {
+    if (c->ssl && !c->ssl->sendfile) {
         r->main_filter_need_in_memory = 1;
     }
 #endif
@@ -603,17 +633,8 @@ ngx_http_create_request(ngx_connection_t *c)
 
     r->http_state = NGX_HTTP_READING_REQUEST_STATE;
 
-    ctx = c->log->data;
-    ctx->request = r;
-    ctx->current_request = r;
     r->log_handler = ngx_http_log_error_handler;
 
-#if (NGX_STAT_STUB)
-    (void) ngx_atomic_fetch_add(ngx_stat_reading, 1);
-    r->stat_reading = 1;
-    (void) ngx_atomic_fetch_add(ngx_stat_requests, 1);
-#endif
-
     return r;
 }
 
@@ -914,6 +935,76 @@ ngx_http_ssl_servername(ngx_ssl_conn_t *ssl_conn, int *ad, void *arg)
 
 #endif
 
+
+#ifdef SSL_R_CERT_CB_ERROR
+
+int
+ngx_http_ssl_certificate(ngx_ssl_conn_t *ssl_conn, void *arg)
+{
+    ngx_str_t                  cert, key;
+    ngx_uint_t                 i, nelts;
+    ngx_connection_t          *c;
+    ngx_http_request_t        *r;
+    ngx_http_ssl_srv_conf_t   *sscf;
+    ngx_http_complex_value_t  *certs, *keys;
+
+    c = ngx_ssl_get_connection(ssl_conn);
+
+    if (c->ssl->handshaked) {
+        return 0;
+    }
+
+    /*
+     * a fake request is used to evaluate variables in the certificate
+     * names, its pool is destroyed right away
+     */
+
+    r = ngx_http_alloc_request(c);
+    if (r == NULL) {
+        return 0;
+    }
+
+    sscf = arg;
+
+    nelts = sscf->certificate_values->nelts;
+    certs = sscf->certificate_values->elts;
+    keys = sscf->certificate_key_values->elts;
+
+    for (i = 0; i < nelts; i++) {
+
+        if (ngx_http_complex_value(r, &certs[i], &cert) != NGX_OK) {
+            goto failed;
+        }
+
+        if (ngx_http_complex_value(r, &keys[i], &key) != NGX_OK) {
+            goto failed;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "ssl cert: \"%s\", key: \"%s\"", cert.data, key.data);
+
+        if (ngx_ssl_connection_certificate(c, r->pool, &cert, &key,
+                                           sscf->passwords,
+                                           sscf->certificate_cache)
+            != NGX_OK)
+        {
+            goto failed;
+        }
+    }
+
+    ngx_destroy_pool(r->pool);
+
+    return 1;
+
+failed:
+
+    ngx_destroy_pool(r->pool);
+
+    return 0;
+}
+
+#endif
+
 #endif
 
 
@@ -2128,12 +2219,31 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
 
         sn = virtual_names->regex;
 
+        i = 0;
+
+        if (virtual_names->regex_sets) {
+
+            /* skip to the first matching name in a single pass */
+
+            n = ngx_regex_exec_sets(virtual_names->regex_sets, host, c->log);
+
+            if (n == NGX_DECLINED) {
+                return NGX_DECLINED;
+            }
+
+            if (n == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            i = n;
+        }
+
 #if (NGX_HTTP_SSL && defined SSL_CTRL_SET_TLSEXT_HOSTNAME)
 
         if (r == NULL) {
             ngx_http_connection_t  *hc;
 
-            for (i = 0; i < virtual_names->nregex; i++) {
+            for ( /* void */ ; i < virtual_names->nregex; i++) {
 
                 n = ngx_regex_exec(sn[i].regex->regex, host, NULL, 0);
 
@@ -2162,7 +2272,7 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
 
 #endif /* NGX_HTTP_SSL && defined SSL_CTRL_SET_TLSEXT_HOSTNAME */
 
-        for (i = 0; i < virtual_names->nregex; i++) {
+        for ( /* void */ ; i < virtual_names->nregex; i++) {
 
             n = ngx_http_regex_exec(r, sn[i].regex, host);
 
@@ -3002,6 +3112,10 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
     }
 #endif
 
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http keepalive footprint: %uz",
+                   ngx_pool_footprint(c->pool));
+
     rev->handler = ngx_http_keepalive_handler;
 
     if (wev->active && (ngx_event_flags & NGX_USE_LEVEL_EVENT)) {
@@ -3159,6 +3273,12 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
             b->pos = NULL;
         }
 
+#if (NGX_HTTP_SSL)
+        if (c->ssl) {
+            ngx_ssl_free_buffer(c);
+        }
+#endif
+
         return;
     }
 
@@ -5969,7 +5969,7 @@ ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     ngx_str_t *default_hide_headers, ngx_hash_init_t *hash)
 {
     ngx_str_t       *h;
-    ngx_uint_t       i, j;
+    ngx_uint_t       i, j, inherit;
     ngx_array_t      hide_headers;
     ngx_hash_key_t  *hk;
 
@@ -5981,16 +5981,22 @@ ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
 
         conf->hide_headers_hash = prev->hide_headers_hash;
 
-        if (conf->hide_headers_hash.buckets
+        /* the http level conf is never merged and its cache is unset */
+
+        inherit = 1;
+
 #if (NGX_HTTP_CACHE)
-            && ((conf->cache == 0) == (prev->cache == 0))
+        inherit = ((conf->cache == 0)
+                   == (prev->cache == 0 || prev->cache == NGX_CONF_UNSET));
 #endif
-           )
-        {
+
+        if (conf->hide_headers_hash.buckets && inherit) {
             return NGX_OK;
         }
 
     } else {
+        inherit = 0;
+
         if (conf->hide_headers == NGX_CONF_UNSET_PTR) {
             conf->hide_headers = prev->hide_headers;
         }
@@ -6071,7 +6077,21 @@ ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     hash->pool = cf->pool;
     hash->temp_pool = NULL;
 
-    return ngx_hash_init(hash, hide_headers.elts, hide_headers.nelts);
+    if (ngx_hash_init(hash, hide_headers.elts, hide_headers.nelts) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (inherit) {
+
+        /*
+         * as with ngx_http_merge_types(), the hash is kept in prev,
+         * so the rest of the servers do not build it again
+         */
+
+        prev->hide_headers_hash = conf->hide_headers_hash;
+    }
+
+    return NGX_OK;
 }
 
 
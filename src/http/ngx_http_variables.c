@@ -124,6 +124,8 @@ static ngx_int_t ngx_http_variable_connection(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_connection_requests(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_variable_connection_memory(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 
 static ngx_int_t ngx_http_variable_nginx_version(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
@@ -324,6 +326,9 @@ static ngx_http_variable_t  ngx_http_core_variables[] = {
     { ngx_string("connection_requests"), NULL,
       ngx_http_variable_connection_requests, 0, 0, 0 },
 
+    { ngx_string("connection_memory"), NULL,
+      ngx_http_variable_connection_memory, 0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_string("nginx_version"), NULL, ngx_http_variable_nginx_version,
       0, 0, 0 },
 
@@ -2141,6 +2146,49 @@ ngx_http_variable_connection_requests(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_variable_connection_memory(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                    *p;
+    size_t                     size;
+#if (NGX_HTTP_V2)
+    ngx_http_v2_connection_t  *h2c;
+#endif
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the memory kept by the client connection, not by the request */
+
+#if (NGX_HTTP_V2)
+    if (r->stream) {
+        h2c = r->stream->connection;
+
+        size = ngx_pool_footprint(h2c->connection->pool);
+
+        if (h2c->pool) {
+            size += ngx_pool_footprint(h2c->pool);
+        }
+
+    } else
+#endif
+    {
+        size = ngx_pool_footprint(r->connection->pool);
+    }
+
+    v->len = ngx_sprintf(p, "%uz", size) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_variable_nginx_version(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -2297,7 +2345,23 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
 
         reg = map->regex;
 
-        for (i = 0; i < map->nregex; i++) {
+        i = 0;
+
+        if (map->regex_sets) {
+
+            /* skip to the first matching regex in a single pass */
+
+            n = ngx_regex_exec_sets(map->regex_sets, match,
+                                    r->connection->log);
+
+            if (n == NGX_DECLINED || n == NGX_ERROR) {
+                return NULL;
+            }
+
+            i = n;
+        }
+
+        for ( /* void */ ; i < map->nregex; i++) {
 
             n = ngx_http_regex_exec(r, reg[i].regex, match);
 
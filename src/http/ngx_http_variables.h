@@ -93,6 +93,7 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_http_map_regex_t         *regex;
     ngx_uint_t                    nregex;
+    ngx_regex_set_t              *regex_sets;
 #endif
 } ngx_http_map_t;
 
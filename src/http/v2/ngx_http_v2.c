@@ -631,6 +631,9 @@ ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c)
     }
 #endif
 
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 idle footprint: %uz", ngx_pool_footprint(c->pool));
+
     c->destroyed = 1;
     c->idle = 1;
     ngx_reusable_connection(c, 1);
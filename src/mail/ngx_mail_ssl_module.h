@@ -52,6 +52,8 @@ typedef struct {
 
     ngx_flag_t       session_tickets;
     ngx_array_t     *session_ticket_keys;
+    time_t          session_ticket_key_rotation;
+    time_t          session_ticket_key_lifetime;
 
     u_char          *file;
     ngx_uint_t       line;
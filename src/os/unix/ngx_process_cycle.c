@@ -51,6 +51,14 @@ sig_atomic_t  ngx_noaccept;
 ngx_uint_t    ngx_noaccepting;
 ngx_uint_t    ngx_restart;
 
+ngx_adopt_connection_pt  ngx_adopt_connection;
+
+
+/* the new worker that takes over idle connections of an exiting worker */
+
+static ngx_int_t  ngx_successor_slot = -1;
+static ngx_pid_t  ngx_successor_pid;
+
 
 static u_char  master_process[] = "master process";
 
@@ -470,7 +478,7 @@ ngx_pass_open_channel(ngx_cycle_t *cycle, ngx_channel_t *ch)
 static void
 ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
 {
-    ngx_int_t      i;
+    ngx_int_t      i, n, next, successors[NGX_MAX_PROCESSES];
     ngx_err_t      err;
     ngx_channel_t  ch;
 
@@ -504,6 +512,24 @@ ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
 
     ch.fd = -1;
 
+    /*
+     * on reconfiguration the workers just spawned are assigned in turn
+     * to the old workers to take over their idle connections
+     */
+
+    n = 0;
+    next = 0;
+
+    if (ch.command == NGX_CMD_QUIT) {
+        for (i = 0; i < ngx_last_process; i++) {
+            if (ngx_processes[i].just_spawn
+                && ngx_processes[i].pid != -1
+                && ngx_processes[i].proc == ngx_worker_process_cycle)
+            {
+                successors[n++] = i;
+            }
+        }
+    }
 
     for (i = 0; i < ngx_last_process; i++) {
        //记录进程的状态
@@ -532,6 +558,15 @@ ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
             continue;
         }
 
+        if (n && ngx_processes[i].proc == ngx_worker_process_cycle) {
+            ch.slot = successors[next++ % n];
+            ch.pid = ngx_processes[ch.slot].pid;
+
+        } else {
+            ch.slot = 0;
+            ch.pid = 0;
+        }
+
         if (ch.command) {
             if (ngx_write_channel(ngx_processes[i].channel[0],
                                   &ch, sizeof(ngx_channel_t), cycle->log)
@@ -1078,6 +1113,12 @@ ngx_channel_handler(ngx_event_t *ev)
 
         case NGX_CMD_QUIT:
             ngx_quit = 1;
+
+            if (ch.pid) {
+                ngx_successor_slot = ch.slot;
+                ngx_successor_pid = ch.pid;
+            }
+
             break;
 
         case NGX_CMD_TERMINATE:
@@ -1112,11 +1153,57 @@ ngx_channel_handler(ngx_event_t *ev)
 
             ngx_processes[ch.slot].channel[0] = -1;
             break;
+
+        case NGX_CMD_PASS_CONNECTION:
+
+            ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "get connection s:%i pid:%P fd:%d",
+                           ch.slot, ch.pid, ch.fd);
+
+            if (ngx_adopt_connection && !ngx_exiting) {
+                ngx_adopt_connection((ngx_cycle_t *) ngx_cycle, ch.fd);
+                break;
+            }
+
+            if (close(ch.fd) == -1) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
+                              "close() passed connection failed");
+            }
+
+            break;
         }
     }
 }
 
 
+ngx_int_t
+ngx_pass_connection(ngx_cycle_t *cycle, ngx_socket_t s)
+{
+    ngx_channel_t  ch;
+
+    if (ngx_successor_slot == -1
+        || ngx_processes[ngx_successor_slot].pid != ngx_successor_pid
+        || ngx_processes[ngx_successor_slot].channel[0] == -1)
+    {
+        return NGX_DECLINED;
+    }
+
+    ngx_memzero(&ch, sizeof(ngx_channel_t));
+
+    ch.command = NGX_CMD_PASS_CONNECTION;
+    ch.pid = ngx_pid;
+    ch.slot = ngx_process_slot;
+    ch.fd = s;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                   "pass connection s:%i pid:%P fd:%d",
+                   ngx_successor_slot, ngx_successor_pid, s);
+
+    return ngx_write_channel(ngx_processes[ngx_successor_slot].channel[0],
+                             &ch, sizeof(ngx_channel_t), cycle->log);
+}
+
+
 static void
 ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
 {
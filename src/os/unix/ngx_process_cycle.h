@@ -18,6 +18,7 @@
 #define NGX_CMD_QUIT           3
 #define NGX_CMD_TERMINATE      4
 #define NGX_CMD_REOPEN         5
+#define NGX_CMD_PASS_CONNECTION  6
 
 // Nginx的5种运行模式
 #define NGX_PROCESS_SINGLE     0
@@ -33,11 +34,16 @@ typedef struct {
     ngx_msec_t                 delay;
 } ngx_cache_manager_ctx_t;
 
+
+/* takes over a connection passed by an exiting worker, closes it on failure */
+typedef void (*ngx_adopt_connection_pt)(ngx_cycle_t *cycle, ngx_socket_t s);
+
 /*
  * 这两个函数在 main函数的最后被调用,进入master的循环
  */
 void ngx_master_process_cycle(ngx_cycle_t *cycle);///< master-worker模式
 void ngx_single_process_cycle(ngx_cycle_t *cycle);///<　单进程模式
+ngx_int_t ngx_pass_connection(ngx_cycle_t *cycle, ngx_socket_t s);
 
 //在循环中用到的标志位
 extern ngx_uint_t      ngx_process;
@@ -48,6 +54,8 @@ extern ngx_uint_t      ngx_inherited;
 extern ngx_uint_t      ngx_daemonized;
 extern ngx_uint_t      ngx_exiting;
 
+extern ngx_adopt_connection_pt  ngx_adopt_connection;
+
 extern sig_atomic_t    ngx_reap;
 extern sig_atomic_t    ngx_sigio;
 extern sig_atomic_t    ngx_sigalrm;
@@ -17,6 +17,15 @@ typedef struct {
 } ngx_stream_geo_range_t;
 
 
+typedef struct {
+    ngx_file_mapping_t                 fm;
+    ngx_stream_geo_range_t           **low;
+    ngx_file_uniq_t                    uniq;
+    time_t                             mtime;
+    time_t                             checked;
+} ngx_stream_geo_binary_t;
+
+
 typedef struct {
     ngx_radix_tree_t                  *tree;
 #if (NGX_HAVE_INET6)
@@ -28,6 +37,7 @@ typedef struct {
 typedef struct {
     ngx_stream_geo_range_t           **low;
     ngx_stream_variable_value_t       *default_value;
+    ngx_stream_geo_binary_t           *binary;
 } ngx_stream_geo_high_ranges_t;
 
 
@@ -99,6 +109,13 @@ static char *ngx_stream_geo_include(ngx_conf_t *cf,
     ngx_stream_geo_conf_ctx_t *ctx, ngx_str_t *name);
 static ngx_int_t ngx_stream_geo_include_binary_base(ngx_conf_t *cf,
     ngx_stream_geo_conf_ctx_t *ctx, ngx_str_t *name);
+static ngx_int_t ngx_stream_geo_map_binary_base(
+    ngx_stream_geo_binary_t *binary, ngx_log_t *log);
+static ngx_int_t ngx_stream_geo_check_binary_ranges(
+    ngx_stream_geo_binary_t *binary, u_char *values);
+static void ngx_stream_geo_check_binary_base(ngx_stream_geo_binary_t *binary,
+    ngx_log_t *log);
+static void ngx_stream_geo_cleanup_binary_base(void *data);
 static void ngx_stream_geo_create_binary_base(ngx_stream_geo_conf_ctx_t *ctx);
 static u_char *ngx_stream_geo_copy_values(u_char *base, u_char *p,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
@@ -233,14 +250,17 @@ ngx_stream_geo_range_variable(ngx_stream_session_t *s,
 {
     ngx_stream_geo_ctx_t *ctx = (ngx_stream_geo_ctx_t *) data;
 
-    in_addr_t                inaddr;
-    ngx_addr_t               addr;
-    ngx_uint_t               n;
-    struct sockaddr_in      *sin;
-    ngx_stream_geo_range_t  *range;
+    u_char                       *base;
+    in_addr_t                     inaddr;
+    ngx_addr_t                    addr;
+    ngx_uint_t                    n;
+    struct sockaddr_in           *sin;
+    ngx_stream_geo_range_t       *range, **low;
+    ngx_stream_geo_binary_t      *binary;
+    ngx_stream_variable_value_t  *vv;
 #if (NGX_HAVE_INET6)
-    u_char                  *p;
-    struct in6_addr         *inaddr6;
+    u_char                       *p;
+    struct in6_addr              *inaddr6;
 #endif
 
     *v = *ctx->u.high.default_value;
@@ -278,16 +298,53 @@ ngx_stream_geo_range_variable(ngx_stream_session_t *s,
         inaddr = INADDR_NONE;
     }
 
-    if (ctx->u.high.low) {
-        range = ctx->u.high.low[inaddr >> 16];
+    low = ctx->u.high.low;
+    base = NULL;
+
+    if (ctx->u.high.binary) {
+        binary = ctx->u.high.binary;
+
+        if (binary->checked != ngx_time()) {
+            ngx_stream_geo_check_binary_base(binary, s->connection->log);
+        }
+
+        low = binary->low;
+        base = binary->fm.addr;
+    }
+
+    if (low) {
+        range = low[inaddr >> 16];
 
         if (range) {
+            range = (ngx_stream_geo_range_t *)
+                        ((u_char *) range + (size_t) base);
+
             n = inaddr & 0xffff;
             do {
                 if (n >= (ngx_uint_t) range->start
                     && n <= (ngx_uint_t) range->end)
                 {
-                    *v = *range->value;
+                    if (base == NULL) {
+                        *v = *range->value;
+                        break;
+                    }
+
+                    /*
+                     * the binary base may be replaced while the session
+                     * still uses the value, so the value is copied
+                     */
+
+                    vv = (ngx_stream_variable_value_t *)
+                             (base + (size_t) range->value);
+
+                    *v = *vv;
+
+                    v->data = ngx_pnalloc(s->connection->pool, vv->len);
+                    if (v->data == NULL) {
+                        return NGX_ERROR;
+                    }
+
+                    ngx_memcpy(v->data, base + (size_t) vv->data, vv->len);
                     break;
                 }
             } while ((++range)->value);
@@ -516,7 +573,15 @@ ngx_stream_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         {
             return NGX_CONF_ERROR;
         }
+
+        if (ngx_radix_tree_compile(ctx.tree6) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
 #endif
+
+        if (ngx_radix_tree_compile(ctx.tree) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
     }
 
     return rv;
@@ -1294,26 +1359,17 @@ static ngx_int_t
 ngx_stream_geo_include_binary_base(ngx_conf_t *cf,
     ngx_stream_geo_conf_ctx_t *ctx, ngx_str_t *name)
 {
-    u_char                       *base, ch;
-    time_t                        mtime;
-    size_t                        size, len;
-    ssize_t                       n;
-    uint32_t                      crc32;
-    ngx_err_t                     err;
-    ngx_int_t                     rc;
-    ngx_uint_t                    i;
-    ngx_file_t                    file;
-    ngx_file_info_t               fi;
-    ngx_stream_geo_range_t       *range, **ranges;
-    ngx_stream_geo_header_t      *header;
-    ngx_stream_variable_value_t  *vv;
-
-    ngx_memzero(&file, sizeof(ngx_file_t));
-    file.name = *name;
-    file.log = cf->log;
-
-    file.fd = ngx_open_file(name->data, NGX_FILE_RDONLY, 0, 0);
-    if (file.fd == NGX_INVALID_FILE) {
+    u_char                    ch;
+    time_t                    mtime;
+    ngx_fd_t                  fd;
+    ngx_err_t                 err;
+    ngx_int_t                 rc;
+    ngx_file_info_t           fi;
+    ngx_pool_cleanup_t       *cln;
+    ngx_stream_geo_binary_t  *binary;
+
+    fd = ngx_open_file(name->data, NGX_FILE_RDONLY, 0, 0);
+    if (fd == NGX_INVALID_FILE) {
         err = ngx_errno;
         if (err != NGX_ENOENT) {
             ngx_conf_log_error(NGX_LOG_CRIT, cf, err,
@@ -1338,14 +1394,20 @@ ngx_stream_geo_include_binary_base(ngx_conf_t *cf,
         goto done;
     }
 
-    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
         ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
                            ngx_fd_info_n " \"%s\" failed", name->data);
         goto failed;
     }
 
-    size = (size_t) ngx_file_size(&fi);
-    mtime = ngx_file_mtime(&fi);
+    binary = ngx_pcalloc(ctx->pool, sizeof(ngx_stream_geo_binary_t));
+    if (binary == NULL) {
+        goto failed;
+    }
+
+    binary->fm.size = (size_t) ngx_file_size(&fi);
+    binary->uniq = ngx_file_uniq(&fi);
+    binary->mtime = ngx_file_mtime(&fi);
 
     ch = name->data[name->len - 4];
     name->data[name->len - 4] = '\0';
@@ -1358,137 +1420,347 @@ ngx_stream_geo_include_binary_base(ngx_conf_t *cf,
 
     name->data[name->len - 4] = ch;
 
-    if (mtime < ngx_file_mtime(&fi)) {
+    mtime = ngx_file_mtime(&fi);
+
+    if (binary->mtime < mtime) {
         ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
                            "stale binary geo range base \"%s\"", name->data);
         goto failed;
     }
 
-    base = ngx_palloc(ctx->pool, size);
-    if (base == NULL) {
+    binary->fm.name = ngx_pnalloc(ctx->pool, name->len + 1);
+    if (binary->fm.name == NULL) {
         goto failed;
     }
 
-    n = ngx_read_file(&file, base, size, 0);
+    (void) ngx_cpystrn(binary->fm.name, name->data, name->len + 1);
 
-    if (n == NGX_ERROR) {
-        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
-                           ngx_read_file_n " \"%s\" failed", name->data);
+    cln = ngx_pool_cleanup_add(ctx->pool, 0);
+    if (cln == NULL) {
         goto failed;
     }
 
-    if ((size_t) n != size) {
-        ngx_conf_log_error(NGX_LOG_CRIT, cf, 0,
-            ngx_read_file_n " \"%s\" returned only %z bytes instead of %z",
-            name->data, n, size);
-        goto failed;
+    binary->fm.fd = fd;
+    binary->fm.log = &cf->cycle->new_log;
+    binary->checked = ngx_time();
+
+    /*
+     * the file stays open with the mapping and is closed by
+     * ngx_close_file_mapping() in the pool cleanup; on errors
+     * ngx_stream_geo_map_binary_base() closes it itself
+     */
+
+    if (ngx_stream_geo_map_binary_base(binary, cf->log) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    cln->handler = ngx_stream_geo_cleanup_binary_base;
+    cln->data = binary;
+
+    ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                       "using binary geo range base \"%s\"", name->data);
+
+    ctx->include_name = *name;
+    ctx->binary_include = 1;
+    ctx->high.low = binary->low;
+    ctx->high.binary = binary;
+
+    return NGX_OK;
+
+failed:
+
+    rc = NGX_DECLINED;
+
+done:
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    return rc;
+}
+
+
+/*
+ * The binary base is mapped read-only and is not modified after mapping:
+ * ranges and values are referenced by offsets from the start of the base,
+ * so the pages are shared by all processes through the page cache.
+ */
+
+static ngx_int_t
+ngx_stream_geo_map_binary_base(ngx_stream_geo_binary_t *binary,
+    ngx_log_t *log)
+{
+    u_char                       *base, *last;
+    uint32_t                      crc32;
+    ngx_stream_geo_header_t      *header;
+    ngx_stream_variable_value_t  *vv;
+
+    if (binary->fm.size < sizeof(ngx_stream_geo_header_t)
+                          + sizeof(ngx_stream_variable_value_t)
+                          + 0x10000 * sizeof(ngx_stream_geo_range_t *))
+    {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "incompatible binary geo range base \"%s\"",
+                      binary->fm.name);
+
+        if (ngx_close_file(binary->fm.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", binary->fm.name);
+        }
+
+        return NGX_DECLINED;
+    }
+
+    if (ngx_open_file_mapping(&binary->fm) != NGX_OK) {
+        return NGX_DECLINED;
     }
 
+    base = binary->fm.addr;
+    last = base + binary->fm.size;
+
     header = (ngx_stream_geo_header_t *) base;
 
-    if (size < 16 || ngx_memcmp(&ngx_stream_geo_header, header, 12) != 0) {
-        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
-             "incompatible binary geo range base \"%s\"", name->data);
+    if (ngx_memcmp(&ngx_stream_geo_header, header, 12) != 0) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "incompatible binary geo range base \"%s\"",
+                      binary->fm.name);
         goto failed;
     }
 
-    ngx_crc32_init(crc32);
+    crc32 = ngx_crc32_long(base + sizeof(ngx_stream_geo_header_t),
+                           binary->fm.size - sizeof(ngx_stream_geo_header_t));
+
+    if (crc32 != header->crc32) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "CRC32 mismatch in binary geo range base \"%s\"",
+                      binary->fm.name);
+        goto failed;
+    }
 
     vv = (ngx_stream_variable_value_t *)
-            (base + sizeof(ngx_stream_geo_header_t));
+             (base + sizeof(ngx_stream_geo_header_t));
+
+    while ((u_char *) (vv + 1) <= last && vv->data) {
+        vv = (ngx_stream_variable_value_t *) ((u_char *) vv
+                 + ngx_align(sizeof(ngx_stream_variable_value_t) + vv->len,
+                             sizeof(void *)));
+    }
+
+    binary->low = (ngx_stream_geo_range_t **) (vv + 1);
+
+    if ((u_char *) &binary->low[0x10000] > last) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "incompatible binary geo range base \"%s\"",
+                      binary->fm.name);
+        goto failed;
+    }
 
-    while (vv->data) {
-        len = ngx_align(sizeof(ngx_stream_variable_value_t) + vv->len,
-                        sizeof(void *));
-        ngx_crc32_update(&crc32, (u_char *) vv, len);
-        vv->data += (size_t) base;
-        vv = (ngx_stream_variable_value_t *) ((u_char *) vv + len);
+    if (ngx_stream_geo_check_binary_ranges(binary, (u_char *) vv) != NGX_OK) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "invalid binary geo range base \"%s\"",
+                      binary->fm.name);
+        goto failed;
     }
-    ngx_crc32_update(&crc32, (u_char *) vv,
-                     sizeof(ngx_stream_variable_value_t));
-    vv++;
 
-    ranges = (ngx_stream_geo_range_t **) vv;
+    return NGX_OK;
+
+failed:
+
+    ngx_close_file_mapping(&binary->fm);
+
+    return NGX_DECLINED;
+}
+
+
+/*
+ * Lookups walk the ranges of a bucket up to the terminating NULL value
+ * without bounds checks, and the CRC32 does not protect against a base
+ * that was crafted or written by another version, so each range and
+ * value offset is checked once when the base is mapped.
+ */
+
+static ngx_int_t
+ngx_stream_geo_check_binary_ranges(ngx_stream_geo_binary_t *binary,
+    u_char *values)
+{
+    u_char                       *base, *last, *ranges;
+    size_t                        offset;
+    ngx_uint_t                    i;
+    ngx_stream_geo_range_t       *range;
+    ngx_stream_variable_value_t  *vv;
+
+    base = binary->fm.addr;
+    last = base + binary->fm.size;
+    ranges = (u_char *) &binary->low[0x10000];
 
     for (i = 0; i < 0x10000; i++) {
-        ngx_crc32_update(&crc32, (u_char *) &ranges[i], sizeof(void *));
-        if (ranges[i]) {
-            ranges[i] = (ngx_stream_geo_range_t *)
-                            ((u_char *) ranges[i] + (size_t) base);
+        offset = (size_t) binary->low[i];
+
+        if (offset == 0) {
+            continue;
         }
-    }
 
-    range = (ngx_stream_geo_range_t *) &ranges[0x10000];
+        if (offset < (size_t) (ranges - base) || offset % sizeof(void *)) {
+            return NGX_ERROR;
+        }
+
+        range = (ngx_stream_geo_range_t *) (base + offset);
+
+        do {
+            if ((u_char *) (range + 1) > last) {
+                return NGX_ERROR;
+            }
+
+            offset = (size_t) range->value;
+
+            if (offset < sizeof(ngx_stream_geo_header_t)
+                || offset % sizeof(void *)
+                || offset + sizeof(ngx_stream_variable_value_t)
+                   > (size_t) (values - base))
+            {
+                return NGX_ERROR;
+            }
+
+            vv = (ngx_stream_variable_value_t *) (base + offset);
+
+            if ((size_t) vv->data > binary->fm.size
+                || vv->len > binary->fm.size - (size_t) vv->data)
+            {
+                return NGX_ERROR;
+            }
 
-    while ((u_char *) range < base + size) {
-        while (range->value) {
-            ngx_crc32_update(&crc32, (u_char *) range,
-                             sizeof(ngx_stream_geo_range_t));
-            range->value = (ngx_stream_variable_value_t *)
-                               ((u_char *) range->value + (size_t) base);
             range++;
-        }
-        ngx_crc32_update(&crc32, (u_char *) range, sizeof(void *));
-        range = (ngx_stream_geo_range_t *) ((u_char *) range + sizeof(void *));
+
+            /* the terminator is only the value pointer */
+
+            if ((u_char *) range + sizeof(void *) > last) {
+                return NGX_ERROR;
+            }
+
+        } while (range->value);
     }
 
-    ngx_crc32_final(crc32);
+    return NGX_OK;
+}
 
-    if (crc32 != header->crc32) {
-        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
-                  "CRC32 mismatch in binary geo range base \"%s\"", name->data);
-        goto failed;
+
+/*
+ * Worker processes look for a replaced binary base once a second, so
+ * the base recreated by "nginx -t" after the source file was changed
+ * is used without reconfiguration.
+ */
+
+static void
+ngx_stream_geo_check_binary_base(ngx_stream_geo_binary_t *binary,
+    ngx_log_t *log)
+{
+    ngx_file_info_t          fi;
+    ngx_stream_geo_binary_t  nb;
+
+    binary->checked = ngx_time();
+
+    if (ngx_file_info(binary->fm.name, &fi) == NGX_FILE_ERROR) {
+        return;
     }
 
-    ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
-                       "using binary geo range base \"%s\"", name->data);
+    if (ngx_file_uniq(&fi) == binary->uniq
+        && ngx_file_mtime(&fi) == binary->mtime)
+    {
+        return;
+    }
 
-    ctx->include_name = *name;
-    ctx->binary_include = 1;
-    ctx->high.low = ranges;
-    rc = NGX_OK;
+    binary->uniq = ngx_file_uniq(&fi);
+    binary->mtime = ngx_file_mtime(&fi);
 
-    goto done;
+    nb = *binary;
 
-failed:
+    nb.fm.fd = ngx_open_file(nb.fm.name, NGX_FILE_RDONLY, 0, 0);
+    if (nb.fm.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", nb.fm.name);
+        return;
+    }
 
-    rc = NGX_DECLINED;
+    if (ngx_fd_info(nb.fm.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", nb.fm.name);
 
-done:
+        if (ngx_close_file(nb.fm.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", nb.fm.name);
+        }
 
-    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
-                      ngx_close_file_n " \"%s\" failed", name->data);
+        return;
     }
 
-    return rc;
+    nb.fm.size = (size_t) ngx_file_size(&fi);
+
+    if (ngx_stream_geo_map_binary_base(&nb, log) != NGX_OK) {
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "using new binary geo range base \"%s\"", nb.fm.name);
+
+    ngx_close_file_mapping(&binary->fm);
+
+    binary->fm = nb.fm;
+    binary->low = nb.low;
+}
+
+
+static void
+ngx_stream_geo_cleanup_binary_base(void *data)
+{
+    ngx_stream_geo_binary_t  *binary = data;
+
+    ngx_close_file_mapping(&binary->fm);
 }
 
 
 static void
 ngx_stream_geo_create_binary_base(ngx_stream_geo_conf_ctx_t *ctx)
 {
-    u_char                                *p;
+    u_char                                *p, *name;
     uint32_t                               hash;
     ngx_str_t                              s;
+    ngx_err_t                              err;
     ngx_uint_t                             i;
     ngx_file_mapping_t                     fm;
+#if (NGX_WIN32)
+    ngx_str_t                              from, to;
+#endif
     ngx_stream_geo_range_t                *r, *range, **ranges;
     ngx_stream_geo_header_t               *header;
     ngx_stream_geo_variable_value_node_t  *gvvn;
 
-    fm.name = ngx_pnalloc(ctx->temp_pool, ctx->include_name.len + 5);
+    name = ngx_pnalloc(ctx->temp_pool, ctx->include_name.len + 5);
+    if (name == NULL) {
+        return;
+    }
+
+    ngx_sprintf(name, "%V.bin%Z", &ctx->include_name);
+
+    /*
+     * the base is written to a temporary file and then renamed,
+     * as the previous base may still be mapped by worker processes
+     */
+
+    fm.name = ngx_pnalloc(ctx->temp_pool,
+                          ctx->include_name.len + 6 + NGX_INT64_LEN + 1);
     if (fm.name == NULL) {
         return;
     }
 
-    ngx_sprintf(fm.name, "%V.bin%Z", &ctx->include_name);
+    ngx_sprintf(fm.name, "%s.%P%Z", name, ngx_pid);
 
     fm.size = ctx->data_size;
     fm.log = ctx->pool->log;
 
     ngx_log_error(NGX_LOG_NOTICE, fm.log, 0,
-                  "creating binary geo range base \"%s\"", fm.name);
+                  "creating binary geo range base \"%s\"", name);
 
     if (ngx_create_file_mapping(&fm) != NGX_OK) {
         return;
@@ -1540,6 +1812,38 @@ ngx_stream_geo_create_binary_base(ngx_stream_geo_conf_ctx_t *ctx)
                                    fm.size - sizeof(ngx_stream_geo_header_t));
 
     ngx_close_file_mapping(&fm);
+
+    if (ngx_rename_file(fm.name, name) == NGX_FILE_ERROR) {
+        err = ngx_errno;
+
+#if (NGX_WIN32)
+
+        /* MoveFile() does not replace an existing file */
+
+        if (err == NGX_EEXIST || err == NGX_EEXIST_FILE) {
+            from.len = ngx_strlen(fm.name);
+            from.data = fm.name;
+            to.len = ngx_strlen(name);
+            to.data = name;
+
+            err = ngx_win32_rename_file(&from, &to, fm.log);
+
+            if (err == 0) {
+                return;
+            }
+        }
+
+#endif
+
+        ngx_log_error(NGX_LOG_CRIT, fm.log, err,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      fm.name, name);
+
+        if (ngx_delete_file(fm.name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, fm.log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", fm.name);
+        }
+    }
 }
 
 
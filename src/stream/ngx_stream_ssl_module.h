@@ -41,6 +41,8 @@ typedef struct {
 
     ngx_flag_t       session_tickets;
     ngx_array_t     *session_ticket_keys;
+    time_t          session_ticket_key_rotation;
+    time_t          session_ticket_key_lifetime;
 } ngx_stream_ssl_conf_t;
 
 